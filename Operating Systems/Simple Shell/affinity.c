@@ -0,0 +1,318 @@
+/*
+ * File:   affinity.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  CPU placement and scheduling of the stages of a job, set
+ *            with the sched prefix:
+ *
+ *               sched [-c CPUS] [-s] [-n NICE] [-p batch|idle|other] cmd
+ *
+ *            -c pins the stages to CPU lists such as 0-3,8. Lists
+ *               separated by : apply to successive stages (the last
+ *               one to any stages left), so -c 0:1 runs the producer
+ *               of a pipe on CPU 0 and the consumer on CPU 1.
+ *            -s places each stage on a CPU next to the previous
+ *               stage's, preferring a hyperthread of the same core
+ *               and then a core in the same package, so data passed
+ *               through a pipe stays in a shared cache.
+ *            -n adds to the nice value and -p sets the policy (other
+ *               is the default time-sharing one).
+ *
+ *            Everything is applied in the child before it executes
+ *            its command.
+ */
+
+#ifndef AFFINITY_C
+#define AFFINITY_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "stats.c"
+#include "log.c"
+#include "timeout.c"
+
+//policy left alone
+#define POLICY_KEEP -1
+
+//the most CPU lists -c takes, the last one covers any stages left
+#define SCHED_LISTS 16
+
+//placement and scheduling requested for a job
+struct job_sched
+{
+   int set;                      //the sched prefix was given
+   int ncpus;                    //entries used in cpus
+   cpu_set_t cpus[SCHED_LISTS];
+   int siblings;                 //co-locate adjacent stages (-s)
+   int nice;
+   int policy;
+};
+
+//set by the sched prefix for the next job only
+struct job_sched next_sched;
+
+//CPU of each stage when the job's stages are co-located, -1 for none
+int* sched_plan = NULL;
+int sched_plan_size = 0;
+int sched_planned = 0;
+
+/*
+ * Parses a CPU list like 0-3,8 into a set.
+ * Returns 0 or -1 if it is not valid
+ */
+int parse_cpu_list(char* text, cpu_set_t* set)
+{
+   CPU_ZERO(set);
+
+   char* cur = text;
+   while(*cur != '\0' && *cur != '\n')
+   {
+      char* end;
+      long first = strtol(cur, &end, 10);
+      long last = first;
+      if(end == cur || first < 0)
+         return -1;
+
+      if(*end == '-')
+      {
+         cur = end + 1;
+         last = strtol(cur, &end, 10);
+         if(end == cur || last < first)
+            return -1;
+      }
+
+      long cpu;
+      for(cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+         CPU_SET(cpu, set);
+
+      cur = end;
+      if(*cur == ',')
+         cur++;
+      else if(*cur != '\0' && *cur != '\n')
+         return -1;
+   }
+
+   return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/*
+ * Reads one of the topology lists of a CPU from sysfs, e.g.
+ *    thread_siblings_list.
+ * Returns 0 or -1 if it is not available
+ */
+int read_topology(int cpu, char* name, cpu_set_t* set)
+{
+   char path[128];
+   snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+
+   FILE* in = fopen(path, "r");
+   if(in == NULL)
+      return -1;
+
+   char buff[1024];
+   int ok = (fgets(buff, sizeof(buff), in) != NULL);
+   fclose(in);
+
+   return ok ? parse_cpu_list(buff, set) : -1;
+}
+
+/*
+ * Picks an allowed and unused CPU from a set.
+ * Returns the CPU or -1 if there is none
+ */
+int pick_cpu(cpu_set_t* from, cpu_set_t* allowed, cpu_set_t* used)
+{
+   int cpu;
+   for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if(CPU_ISSET(cpu, from) && CPU_ISSET(cpu, allowed) && !CPU_ISSET(cpu, used))
+         return cpu;
+
+   return -1;
+}
+
+/*
+ * Chooses a CPU for every stage so each one runs next to the one
+ *    feeding it. The first stage stays where the shell is running.
+ *    Stages are left where they are if no CPU can be chosen.
+ */
+void sched_plan_siblings(int count)
+{
+   sched_planned = 0;
+   int* grown = stats_grow(sched_plan, &sched_plan_size, count, sizeof(int));
+   if(grown == NULL)
+      return;
+   sched_plan = grown;
+   sched_planned = count;
+
+   int i;
+   for(i = 0; i < count; i++)
+      sched_plan[i] = -1;
+
+   cpu_set_t allowed, used, near;
+   CPU_ZERO(&used);
+   if(sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+      return;
+
+   int cpu = sched_getcpu();
+   if(cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+      cpu = pick_cpu(&allowed, &allowed, &used);
+   if(cpu < 0)
+      return;
+
+   for(i = 0; i < count; i++)
+   {
+      if(i > 0)
+      {
+         int prev = sched_plan[i - 1];
+         int next = -1;
+
+         //a hyperthread of the same core, then a core of the same package
+         if(read_topology(prev, "thread_siblings_list", &near) == 0)
+            next = pick_cpu(&near, &allowed, &used);
+         if(next == -1 && read_topology(prev, "core_siblings_list", &near) == 0)
+            next = pick_cpu(&near, &allowed, &used);
+         if(next == -1)
+            next = pick_cpu(&allowed, &allowed, &used);
+
+         //more stages than CPUs, share the previous stage's
+         cpu = (next != -1) ? next : prev;
+      }
+
+      sched_plan[i] = cpu;
+      CPU_SET(cpu, &used);
+   }
+}
+
+/*
+ * Strips a sched prefix from the front of a line.
+ * Returns 1 if a prefix was stripped
+ *         0 if there was none
+ *        -1 if it is not valid
+ */
+int sched_prefix(char** line)
+{
+   char* cur = *line;
+   char word[256];
+
+   if(next_word(&cur, word, sizeof(word)) == NULL || strcmp(word, "sched") != 0)
+      return 0;
+
+   struct job_sched req;
+   memset(&req, 0, sizeof(req));
+   req.set = 1;
+   req.policy = POLICY_KEEP;
+
+   while(1)
+   {
+      char* start = cur;
+      if(next_word(&cur, word, sizeof(word)) == NULL)
+         return -1;
+
+      if(strcmp(word, "-s") == 0)
+         req.siblings = 1;
+      else if(strcmp(word, "-c") == 0 || strcmp(word, "-n") == 0 || strcmp(word, "-p") == 0)
+      {
+         char value[256];
+         if(next_word(&cur, value, sizeof(value)) == NULL)
+            return -1;
+
+         if(word[1] == 'n')
+            req.nice = atoi(value);
+         else if(word[1] == 'p')
+         {
+            if(strcmp(value, "batch") == 0)
+               req.policy = SCHED_BATCH;
+            else if(strcmp(value, "idle") == 0)
+               req.policy = SCHED_IDLE;
+            else if(strcmp(value, "other") == 0)
+               req.policy = SCHED_OTHER;
+            else
+               return -1;
+         }
+         else
+         {
+            //one list per stage, separated by :
+            char* save = NULL;
+            char* list = strtok_r(value, ":", &save);
+            while(list != NULL && req.ncpus < SCHED_LISTS)
+            {
+               if(parse_cpu_list(list, &req.cpus[req.ncpus++]) == -1)
+                  return -1;
+               list = strtok_r(NULL, ":", &save);
+            }
+         }
+      }
+      else
+      {
+         //the command starts here
+         cur = start;
+         break;
+      }
+   }
+
+   next_sched = req;
+   *line = cur;
+
+   return 1;
+}
+
+/*
+ * Prepares the placement of a job's stages. Called in the parent
+ *    before its first stage is forked.
+ */
+void sched_begin_job(int count)
+{
+   sched_planned = 0;
+   if(next_sched.set && next_sched.siblings)
+      sched_plan_siblings(count);
+}
+
+/*
+ * Applies the job's placement and scheduling to the stage running in
+ *    this child.
+ */
+void sched_child(int index)
+{
+   if(!next_sched.set)
+      return;
+
+   cpu_set_t one;
+   cpu_set_t* set = NULL;
+
+   if(next_sched.siblings && index < sched_planned && sched_plan[index] >= 0)
+   {
+      CPU_ZERO(&one);
+      CPU_SET(sched_plan[index], &one);
+      set = &one;
+   }
+   else if(next_sched.ncpus > 0)
+      set = &next_sched.cpus[index < next_sched.ncpus ? index : next_sched.ncpus - 1];
+
+   if(set != NULL && sched_setaffinity(0, sizeof(*set), set) == -1)
+      fprintf(stderr, "Could not set the CPU affinity: %s\n", strerror(errno));
+
+   if(next_sched.policy != POLICY_KEEP)
+   {
+      struct sched_param param;
+      param.sched_priority = 0;
+      if(sched_setscheduler(0, next_sched.policy, &param) == -1)
+         fprintf(stderr, "Could not set the scheduling policy: %s\n", strerror(errno));
+   }
+
+   if(next_sched.nice != 0)
+   {
+      errno = 0;
+      int prio = getpriority(PRIO_PROCESS, 0);
+      if(errno == 0 && setpriority(PRIO_PROCESS, 0, prio + next_sched.nice) == -1)
+         fprintf(stderr, "Could not set the nice value: %s\n", strerror(errno));
+   }
+}
+
+#endif //AFFINITY_C
@@ -0,0 +1,331 @@
+/*
+ * File:   arith.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Evaluates the integer expressions of $(( )) with 64-bit
+ *            arithmetic and C's operators and precedence:
+ *
+ *               ( )  + - ! ~ (unary)  **  * / %  + -  << >>
+ *               < <= > >=  == !=  &  ^  |  &&  ||  ?:
+ *
+ *            Numbers may be decimal, 0x hex or 0 octal. A variable is
+ *            named with or without a $ and an unset or empty one is 0.
+ *            The operand which && || or ?: skips is still parsed, so
+ *            every evaluation looks up the same variables in the same
+ *            order, but it is not evaluated (it cannot divide by 0).
+ *
+ *            Since words are split on spaces the expression must be
+ *            written without any, e.g. $((i*2+1)).
+ */
+
+#ifndef ARITH_C
+#define ARITH_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+struct arith
+{
+   const char* cur;
+   const char* error;      //the first error, NULL if there is none
+   int skip;               //parsing an operand which is not evaluated
+
+   //returns the value of a variable
+   long long (*lookup)(void* data, const char* name, int len);
+   void* data;
+};
+
+long long arith_ternary(struct arith* a);
+
+//skips spaces and returns 1 if the next characters are op
+int arith_accept(struct arith* a, const char* op)
+{
+   while(isspace((unsigned char)*a->cur))
+      a->cur++;
+
+   int len = strlen(op);
+   if(strncmp(a->cur, op, len) != 0)
+      return 0;
+
+   a->cur += len;
+   return 1;
+}
+
+//accepts op unless the character after it is one of but, as in < and <<
+int arith_accept_but(struct arith* a, const char* op, const char* but)
+{
+   while(isspace((unsigned char)*a->cur))
+      a->cur++;
+
+   int len = strlen(op);
+   if(strncmp(a->cur, op, len) != 0 || (a->cur[len] != '\0' && strchr(but, a->cur[len]) != NULL))
+      return 0;
+
+   a->cur += len;
+   return 1;
+}
+
+//records the first error
+long long arith_fail(struct arith* a, const char* error)
+{
+   if(a->error == NULL)
+      a->error = error;
+   return 0;
+}
+
+//a number, a variable or a parenthesized expression
+long long arith_primary(struct arith* a)
+{
+   if(arith_accept(a, "("))
+   {
+      long long value = arith_ternary(a);
+      if(!arith_accept(a, ")"))
+         return arith_fail(a, "missing )");
+      return value;
+   }
+
+   if(isdigit((unsigned char)*a->cur))
+   {
+      char* end;
+      long long value = strtoll(a->cur, &end, 0);
+      if(isalnum((unsigned char)*end) || *end == '_')
+         return arith_fail(a, "invalid number");
+      a->cur = end;
+      return value;
+   }
+
+   if(*a->cur == '$')
+      a->cur++;
+
+   const char* name = a->cur;
+   while(isalnum((unsigned char)*a->cur) || *a->cur == '_')
+      a->cur++;
+   if(a->cur == name || isdigit((unsigned char)*name))
+      return arith_fail(a, "operand expected");
+
+   return a->lookup(a->data, name, a->cur - name);
+}
+
+long long arith_unary(struct arith* a)
+{
+   //overflow wraps around like the machine's arithmetic
+   if(arith_accept(a, "-"))
+      return (long long)(0ULL - (unsigned long long)arith_unary(a));
+   if(arith_accept(a, "+"))
+      return arith_unary(a);
+   if(arith_accept(a, "!"))
+      return !arith_unary(a);
+   if(arith_accept(a, "~"))
+      return ~arith_unary(a);
+
+   return arith_primary(a);
+}
+
+//** is right associative and binds tighter than the other operators
+long long arith_power(struct arith* a)
+{
+   long long base = arith_unary(a);
+   if(!arith_accept(a, "**"))
+      return base;
+
+   long long exp = arith_power(a);
+   if(exp < 0)
+      return a->skip ? 0 : arith_fail(a, "negative exponent");
+
+   //by squaring
+   unsigned long long value = 1, factor = base;
+   while(exp > 0)
+   {
+      if(exp & 1)
+         value *= factor;
+      factor *= factor;
+      exp >>= 1;
+   }
+   return (long long)value;
+}
+
+long long arith_mul(struct arith* a)
+{
+   long long value = arith_power(a);
+   while(1)
+   {
+      int op;
+      if(arith_accept_but(a, "*", "*"))
+         op = '*';
+      else if(arith_accept(a, "/"))
+         op = '/';
+      else if(arith_accept(a, "%"))
+         op = '%';
+      else
+         return value;
+
+      long long rhs = arith_power(a);
+      if(op == '*')
+         value = (long long)((unsigned long long)value * rhs);
+      else if(rhs == 0)
+         value = a->skip ? 0 : arith_fail(a, "division by 0");
+      else if(rhs == -1)
+         value = (op == '/') ? (long long)(0ULL - (unsigned long long)value) : 0;
+      else
+         value = (op == '/') ? value / rhs : value % rhs;
+   }
+}
+
+long long arith_add(struct arith* a)
+{
+   long long value = arith_mul(a);
+   while(1)
+   {
+      if(arith_accept(a, "+"))
+         value = (long long)((unsigned long long)value + arith_mul(a));
+      else if(arith_accept(a, "-"))
+         value = (long long)((unsigned long long)value - arith_mul(a));
+      else
+         return value;
+   }
+}
+
+long long arith_shift(struct arith* a)
+{
+   long long value = arith_add(a);
+   while(1)
+   {
+      if(arith_accept(a, "<<"))
+         value = (long long)((unsigned long long)value << (arith_add(a) & 63));
+      else if(arith_accept(a, ">>"))
+         value >>= (arith_add(a) & 63);
+      else
+         return value;
+   }
+}
+
+long long arith_compare(struct arith* a)
+{
+   long long value = arith_shift(a);
+   while(1)
+   {
+      if(arith_accept(a, "<="))
+         value = value <= arith_shift(a);
+      else if(arith_accept(a, ">="))
+         value = value >= arith_shift(a);
+      else if(arith_accept_but(a, "<", "<"))
+         value = value < arith_shift(a);
+      else if(arith_accept_but(a, ">", ">"))
+         value = value > arith_shift(a);
+      else
+         return value;
+   }
+}
+
+long long arith_equal(struct arith* a)
+{
+   long long value = arith_compare(a);
+   while(1)
+   {
+      if(arith_accept(a, "=="))
+         value = value == arith_compare(a);
+      else if(arith_accept(a, "!="))
+         value = value != arith_compare(a);
+      else
+         return value;
+   }
+}
+
+long long arith_bitand(struct arith* a)
+{
+   long long value = arith_equal(a);
+   while(arith_accept_but(a, "&", "&"))
+      value &= arith_equal(a);
+   return value;
+}
+
+long long arith_bitxor(struct arith* a)
+{
+   long long value = arith_bitand(a);
+   while(arith_accept(a, "^"))
+      value ^= arith_bitand(a);
+   return value;
+}
+
+long long arith_bitor(struct arith* a)
+{
+   long long value = arith_bitxor(a);
+   while(arith_accept_but(a, "|", "|"))
+      value |= arith_bitxor(a);
+   return value;
+}
+
+//parses the right operand of && or ||, evaluating it only if needed
+long long arith_rhs(struct arith* a, long long (*parse)(struct arith*), int needed)
+{
+   a->skip += !needed;
+   long long value = parse(a);
+   a->skip -= !needed;
+
+   return needed ? value : 0;
+}
+
+long long arith_and(struct arith* a)
+{
+   long long value = arith_bitor(a);
+   while(arith_accept(a, "&&"))
+   {
+      long long rhs = arith_rhs(a, arith_bitor, value != 0);
+      value = value && rhs;
+   }
+   return value;
+}
+
+long long arith_or(struct arith* a)
+{
+   long long value = arith_and(a);
+   while(arith_accept(a, "||"))
+   {
+      long long rhs = arith_rhs(a, arith_and, value == 0);
+      value = value || rhs;
+   }
+   return value;
+}
+
+long long arith_ternary(struct arith* a)
+{
+   long long cond = arith_or(a);
+   if(!arith_accept(a, "?"))
+      return cond;
+
+   long long yes = arith_rhs(a, arith_ternary, cond != 0);
+   if(!arith_accept(a, ":"))
+      return arith_fail(a, "missing :");
+   long long no = arith_rhs(a, arith_ternary, cond == 0);
+
+   return cond ? yes : no;
+}
+
+/*
+ * Evaluates an expression, looking its variables up with lookup.
+ * Returns the value and stores NULL or the error in error
+ */
+long long arith_eval(const char* text, long long (*lookup)(void* data, const char* name, int len),
+                     void* data, const char** error)
+{
+   struct arith a;
+   a.cur = text;
+   a.error = NULL;
+   a.skip = 0;
+   a.lookup = lookup;
+   a.data = data;
+
+   long long value = arith_ternary(&a);
+
+   while(isspace((unsigned char)*a.cur))
+      a.cur++;
+   if(*a.cur != '\0')
+      arith_fail(&a, "syntax error");
+
+   *error = a.error;
+   return value;
+}
+
+#endif //ARITH_C
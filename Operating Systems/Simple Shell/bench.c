@@ -0,0 +1,344 @@
+/*
+ * File:   bench.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Microbenchmarks for the shell's hot paths: parse_command,
+ *            spawning a single command (directly and through the
+ *            zygote), pipeline throughput (also with the stages
+ *            placed on chosen CPUs), redirection setup and logging.
+ *            A table is printed and the results are written as JSON
+ *            to the file named on the command line (default
+ *            bench_results.json) so they can be compared between
+ *            builds.
+ *
+ *            usage: bench [results.json]
+ */
+
+#define MYSHELL_NO_MAIN
+#include "main.c"
+
+//bytes pushed through the pipeline throughput benchmark
+#define PIPE_BYTES "268435456"
+
+//memory the shell is grown by before comparing direct fork to the zygote
+#define BALLAST_BYTES (256 * 1024 * 1024)
+
+//one benchmark result
+struct bench_result
+{
+   char name[48];
+   char unit[16];
+   int iterations;
+   double mean;
+   double p50;
+   double p99;
+};
+
+struct bench_result results[32];
+int num_results = 0;
+
+//sorts samples for the percentiles
+int compare_double(const void* a, const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+   return (x > y) - (x < y);
+}
+
+/*
+ * Summarises the samples of a benchmark and adds it to the results
+ */
+void bench_add(char* name, char* unit, double* samples, int count)
+{
+   qsort(samples, count, sizeof(double), compare_double);
+
+   double sum = 0;
+   int i;
+   for(i = 0; i < count; i++)
+      sum += samples[i];
+
+   struct bench_result* r = &results[num_results++];
+   snprintf(r->name, sizeof(r->name), "%s", name);
+   snprintf(r->unit, sizeof(r->unit), "%s", unit);
+   r->iterations = count;
+   r->mean = sum / count;
+   r->p50 = samples[count / 2];
+   r->p99 = samples[(int)(count * 0.99) < count ? (int)(count * 0.99) : count - 1];
+
+   printf("%-28s %8d %12.3f %12.3f %12.3f %s\n", r->name, r->iterations, r->mean, r->p50, r->p99, r->unit);
+   fflush(stdout);
+}
+
+/*
+ * Times parse_command on a line. Each sample is the mean of a batch
+ *    so the cost of reading the clock does not dominate.
+ */
+void bench_parse(char* name, char* line)
+{
+   const int SAMPLES = 200, BATCH = 500;
+   double samples[200];
+
+   char** cmd1 = malloc(100 * sizeof(char*));
+   char** cmd2 = malloc(100 * sizeof(char*));
+   char copy[1024], infile[INPUT_MAX], outfile[INPUT_MAX];
+   int stages;
+   int len = strlen(line) + 1;
+
+   int s, b;
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      for(b = 0; b < BATCH; b++)
+      {
+         //parse_command splits the line in place
+         memcpy(copy, line, len);
+         infile[0] = '\0';
+         outfile[0] = '\0';
+         cmd1[0] = NULL;
+         cmd2[0] = NULL;
+         parse_command(copy, cmd1, cmd2, &stages, infile, outfile, sizeof(infile));
+      }
+      samples[s] = (stats_clock() - start) / (double)BATCH;
+   }
+
+   bench_add(name, "ns/op", samples, SAMPLES);
+
+   free(cmd1);
+   free(cmd2);
+}
+
+/*
+ * Times exec_cmd from the call until the child has been reaped
+ */
+void bench_spawn(char* name)
+{
+   const int SAMPLES = 300;
+   double samples[300];
+   char* cmd[] = { "true", NULL };
+
+   int s;
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      exec_cmd(cmd);
+      samples[s] = (stats_clock() - start) / 1e3;
+   }
+
+   bench_add(name, "us/op", samples, SAMPLES);
+}
+
+/*
+ * Compares spawning directly with spawning through the zygote once
+ *    the shell has grown, which is when copying its page tables in
+ *    fork starts to cost
+ */
+void bench_zygote(int zygote)
+{
+   char* ballast = malloc(BALLAST_BYTES);
+   if(ballast == NULL)
+      return;
+   memset(ballast, 1, BALLAST_BYTES);
+
+   bench_spawn("spawn_direct_256MB");
+
+   if(zygote != -1)
+   {
+      zygote_fd = zygote;
+      bench_spawn("spawn_zygote_256MB");
+      zygote_fd = -1;
+   }
+
+   free(ballast);
+}
+
+/*
+ * Measures the throughput of a two stage pipeline through exec_pipe
+ *    with the stages placed by the sched prefix (NULL for none)
+ */
+void bench_pipe(char* name, char* sched)
+{
+   const int SAMPLES = 5;
+   double samples[5];
+   char* cmd1[] = { "head", "-c", PIPE_BYTES, "/dev/zero", NULL };
+   char* cmd2[] = { "wc", "-c", NULL };
+
+   int s;
+   for(s = 0; s < SAMPLES; s++)
+   {
+      if(sched != NULL)
+      {
+         char line[128];
+         char* cur = line;
+         snprintf(line, sizeof(line), "sched %s x", sched);
+         sched_prefix(&cur);
+      }
+
+      long long start = stats_clock();
+      exec_pipe_opt_in_write(cmd1, cmd2, "", "/dev/null");
+      next_sched.set = 0;
+      double secs = (stats_clock() - start) / 1e9;
+
+      samples[s] = atof(PIPE_BYTES) / (1024.0 * 1024.0) / secs;
+   }
+
+   bench_add(name, "MB/s", samples, SAMPLES);
+}
+
+/*
+ * Compares pipeline throughput with the stages left to the scheduler,
+ *    co-located on sibling CPUs, sharing one CPU and spread as far
+ *    apart as the machine allows
+ */
+void bench_affinity(void)
+{
+   char spread[64];
+   long last = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+   snprintf(spread, sizeof(spread), "-c 0:%ld", last > 0 ? last : 0);
+
+   bench_pipe("pipe_sched_siblings", "-s");
+   bench_pipe("pipe_sched_same_cpu", "-c 0");
+   bench_pipe("pipe_sched_spread", spread);
+}
+
+/*
+ * Times applying and restoring each kind of redirection
+ */
+void bench_redirections(void)
+{
+   const int SAMPLES = 2000;
+   static double samples[2000];
+   int saved, fd;
+
+   int s;
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      redirIn("/dev/null", &saved, &fd);
+      resIn(saved, fd);
+      samples[s] = (double)(stats_clock() - start);
+   }
+   bench_add("redirect_in", "ns/op", samples, SAMPLES);
+
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      redirOut("/dev/null", &saved, &fd);
+      resOut(saved, fd);
+      samples[s] = (double)(stats_clock() - start);
+   }
+   bench_add("redirect_out", "ns/op", samples, SAMPLES);
+
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      redirOutAppend("/dev/null", &saved, &fd);
+      resOut(saved, fd);
+      samples[s] = (double)(stats_clock() - start);
+   }
+   bench_add("redirect_out_append", "ns/op", samples, SAMPLES);
+}
+
+/*
+ * Times writing a typical line to the log, batched through the ring
+ *    if ring is set
+ */
+void bench_log_run(char* name, char* calls_name, int ring)
+{
+   const int SAMPLES = 2000;
+   static double samples[2000];
+
+   log_ring = ring;
+   unsigned long long calls = io_syscalls;
+
+   int s;
+   for(s = 0; s < SAMPLES; s++)
+   {
+      long long start = stats_clock();
+      log_line("Parent process is waiting. Child's PID=12345\n");
+      samples[s] = (stats_clock() - start) / 1e3;
+   }
+
+   //the batch still queued is counted too
+   log_sync();
+   double per_line = (double)(io_syscalls - calls) / SAMPLES;
+
+   bench_add(name, "us/op", samples, SAMPLES);
+   bench_add(calls_name, "syscalls/op", &per_line, 1);
+}
+
+/*
+ * Logs with plain system calls and an fsync per line, then batched
+ *    through the ring if the kernel has one
+ */
+void bench_log(void)
+{
+   bench_log_run("log_line", "log_line_syscalls", 0);
+   if(uring_ready())
+      bench_log_run("log_line_uring", "log_line_uring_syscalls", 1);
+}
+
+/*
+ * Writes the results as JSON
+ */
+int write_results(char* path)
+{
+   FILE* out = fopen(path, "w");
+   if(out == NULL)
+   {
+      fprintf(stderr, "Could not open file %s\n", path);
+      return -1;
+   }
+
+   char* commit = getenv("BENCH_COMMIT");
+
+   fprintf(out, "{\n  \"timestamp\": %ld,\n  \"commit\": \"%s\",\n  \"results\": [\n",
+           (long)time(NULL), commit != NULL ? commit : "");
+
+   int i;
+   for(i = 0; i < num_results; i++)
+   {
+      struct bench_result* r = &results[i];
+      fprintf(out, "    {\"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %d, "
+                   "\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f}%s\n",
+              r->name, r->unit, r->iterations, r->mean, r->p50, r->p99,
+              i + 1 < num_results ? "," : "");
+   }
+
+   fprintf(out, "  ]\n}\n");
+   fclose(out);
+
+   return 0;
+}
+
+int main(int argc, char* argv[])
+{
+   char* path = (argc > 1) ? argv[1] : "bench_results.json";
+
+   //keep the benchmark's log away from a real session's log
+   log_filename = "bench_log.txt";
+
+   //the zygote is started while the benchmark is still small
+   setenv("MYSHELL_ZYGOTE", "1", 1);
+   int zygote = zygote_start() ? zygote_fd : -1;
+   zygote_fd = -1;
+
+   printf("%-28s %8s %12s %12s %12s\n", "benchmark", "iters", "mean", "p50", "p99");
+
+   bench_parse("parse_short", "ls -l");
+   bench_parse("parse_long", "grep -n -i -e alpha -e beta -e gamma -e delta --color=never "
+                             "file1 file2 file3 file4 file5 file6 file7 file8 < in.txt | "
+                             "sort -k 2 -t : -n -r -u -s -o sorted.txt --parallel 4 >> out.txt");
+   bench_spawn("spawn_exec_cmd");
+   bench_pipe("pipe_throughput", NULL);
+   bench_affinity();
+   bench_redirections();
+   bench_log();
+   bench_zygote(zygote);
+
+   unlink(log_filename);
+
+   //hand the socket back so the zygote is stopped at exit
+   zygote_fd = zygote;
+
+   return write_results(path) == 0 ? 0 : 1;
+}
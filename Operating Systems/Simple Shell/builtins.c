@@ -0,0 +1,385 @@
+/*
+ * File:   builtins.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Commands which are implemented by the shell itself.
+ *            A builtin runs inside the shell (with its redirections
+ *            applied and then restored) when it is a simple command,
+ *            and inside the forked child when it is part of a pipe.
+ */
+
+#ifndef BUILTINS_C
+#define BUILTINS_C
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "redirections.c"
+#include "metrics.c"
+#include "timeout.c"
+#include "coproc.c"
+#include "vars.c"
+#include "test.c"
+#include "out.c"
+
+//a builtin returns its exit status
+struct builtin
+{
+   char* name;
+   int (*run)(char** argv);
+};
+
+int builtin_shellstat(char** argv);
+int builtin_deadline(char** argv);
+int builtin_export(char** argv);
+int builtin_unset(char** argv);
+int builtin_set(char** argv);
+int builtin_repeat(char** argv);
+int builtin_echo(char** argv);
+
+//implemented in execute.c
+int exec_cmd(char** cmd1);
+
+//table of the builtins, terminated by a NULL name
+struct builtin builtins[] = {
+   { "shellstat", builtin_shellstat },
+   { "deadline", builtin_deadline },
+   { "coproc", builtin_coproc },
+   { "cowrite", builtin_cowrite },
+   { "coread", builtin_coread },
+   { "coclose", builtin_coclose },
+   { "export", builtin_export },
+   { "unset", builtin_unset },
+   { "set", builtin_set },
+   { "repeat", builtin_repeat },
+   { "test", builtin_test },
+   { "[", builtin_test },
+   { "true", builtin_true },
+   { "false", builtin_false },
+   { ":", builtin_true },
+   { "echo", builtin_echo },
+   { NULL, NULL }
+};
+
+/*
+ * Returns the index of the named builtin or -1 if there is none
+ */
+int find_builtin(char* name)
+{
+   if(name == NULL)
+      return -1;
+
+   int i;
+   for(i = 0; builtins[i].name != NULL; i++)
+   {
+      if(strcmp(builtins[i].name, name) == 0)
+         return i;
+   }
+
+   return -1;
+}
+
+/*
+ * Calls a builtin in the current process
+ */
+int call_builtin(int index, char** argv)
+{
+   return builtins[index].run(argv);
+}
+
+/*
+ * Runs a builtin inside the shell with its redirections applied.
+ *    outRed is 0 for none, -1 for overwrite (>) and 1 for append (>>)
+ * Returns the exit status of the builtin
+ */
+int run_builtin(int index, char** argv, char* infile, char* outfile, int outRed)
+{
+   int stdin_fd, in_fd, stdout_fd, out_fd;
+   int redirectedIn = 0, redirectedOut = 0;
+
+   //anything already buffered belongs to the old stdout
+   out_flush();
+
+   if(infile[0] != '\0')
+   {
+      if(redirIn(infile, &stdin_fd, &in_fd) == -1)
+         return 1;
+      redirectedIn = 1;
+   }
+
+   if(outRed != 0)
+   {
+      int success = (outRed > 0) ? redirOutAppend(outfile, &stdout_fd, &out_fd)
+                                 : redirOut(outfile, &stdout_fd, &out_fd);
+      if(success == -1)
+      {
+         if(redirectedIn)
+            resIn(stdin_fd, in_fd);
+         return 1;
+      }
+      redirectedOut = 1;
+   }
+
+   int status = call_builtin(index, argv);
+
+   //restore the shell's own stdin and stdout
+   if(redirectedOut)
+      resOut(stdout_fd, out_fd);
+   if(redirectedIn)
+      resIn(stdin_fd, in_fd);
+
+   return status;
+}
+
+/*
+ * shellstat: prints the shell's counters and latency histograms
+ */
+int builtin_shellstat(char** argv)
+{
+   //the report is written with stdio after the shell's own output
+   out_flush();
+   metrics_print(stdout);
+   fflush(stdout);
+   return 0;
+}
+
+/*
+ * deadline [DURATION [GRACE] | off]: shows or sets the deadline
+ *    every command of the session runs under
+ */
+int builtin_deadline(char** argv)
+{
+   timeout_session_init();
+
+   if(argv[1] == NULL)
+   {
+      if(session_timeout > 0)
+         out_printf("deadline %.3fs grace %.3fs\n", session_timeout / 1e9, session_grace / 1e9);
+      else
+         out_str("deadline off\n");
+      out_end();
+      return 0;
+   }
+
+   if(strcmp(argv[1], "off") == 0)
+   {
+      session_timeout = 0;
+      return 0;
+   }
+
+   long long limit = parse_duration(argv[1]);
+   long long grace = (argv[2] != NULL) ? parse_duration(argv[2]) : session_grace;
+   if(limit <= 0 || grace < 0)
+   {
+      fprintf(stderr, "usage: deadline [DURATION [GRACE] | off]\n");
+      return 2;
+   }
+
+   session_timeout = limit;
+   session_grace = grace;
+   return 0;
+}
+
+/*
+ * export [NAME[=VALUE]...]: exports variables or lists the exported ones
+ */
+int builtin_export(char** argv)
+{
+   if(argv[1] == NULL)
+   {
+      var_init();
+      var_print(1);
+      return 0;
+   }
+
+   int status = 0;
+   int i;
+   for(i = 1; argv[i] != NULL; i++)
+   {
+      char* eq = strchr(argv[i], '=');
+      if(eq != NULL)
+         *eq = '\0';
+
+      char* value = (eq != NULL) ? eq + 1 : var_get(argv[i]);
+      if(var_set(argv[i], value, 1) == -1)
+      {
+         fprintf(stderr, "export: %s: not a valid name\n", argv[i]);
+         status = 1;
+      }
+
+      if(eq != NULL)
+         *eq = '=';
+   }
+
+   return status;
+}
+
+/*
+ * unset NAME...: removes variables
+ */
+int builtin_unset(char** argv)
+{
+   int status = 0;
+   int i;
+   for(i = 1; argv[i] != NULL; i++)
+   {
+      if(var_set(argv[i], NULL, 0) == -1)
+      {
+         fprintf(stderr, "unset: %s: not a valid name\n", argv[i]);
+         status = 1;
+      }
+   }
+
+   return status;
+}
+
+/*
+ * set: lists the variables
+ */
+int builtin_set(char** argv)
+{
+   var_init();
+   var_print(0);
+   return 0;
+}
+
+/*
+ * repeat N command: runs a command N times, stopping early on Ctrl-C.
+ *    The command is parsed once and its argv reused for every run.
+ */
+int builtin_repeat(char** argv)
+{
+   char* end = NULL;
+   long count = (argv[1] != NULL) ? strtol(argv[1], &end, 10) : -1;
+   if(argv[1] == NULL || *end != '\0' || count < 0 || argv[2] == NULL)
+   {
+      fprintf(stderr, "usage: repeat N command\n");
+      return 2;
+   }
+
+   char** cmd = argv + 2;
+   int builtin = find_builtin(cmd[0]);
+   int status = 0;
+   event_interrupted = 0;
+
+   long i;
+   for(i = 0; i < count; i++)
+   {
+      status = (builtin >= 0) ? call_builtin(builtin, cmd) : exec_cmd(cmd);
+      if(event_interrupted || status == 128 + SIGINT)
+         break;
+   }
+
+   return status;
+}
+
+/*
+ * Prints word with its backslash escapes replaced.
+ * Returns 1 if \c ended the output, 0 otherwise
+ */
+int echo_escaped(char* word)
+{
+   static const char from[] = "\\abefnrtv";
+   static const char to[] = "\\\a\b\033\f\n\r\t\v";
+
+   while(*word != '\0')
+   {
+      //the text up to the next backslash is added at once
+      size_t run = strcspn(word, "\\");
+      out_put(word, run);
+      word += run;
+      if(*word == '\0')
+         break;
+
+      char c = word[1];
+      char* esc = (c != '\0') ? strchr(from, c) : NULL;
+      if(c == 'c')
+         return 1;
+
+      if(esc != NULL)
+      {
+         out_put(&to[esc - from], 1);
+         word += 2;
+      }
+      else if(c == '0' || c == 'x')
+      {
+         //\0NNN in octal and \xHH in hex
+         int base = (c == '0') ? 8 : 16;
+         int max = (c == '0') ? 3 : 2;
+         int value = 0, digits = 0;
+         word += 2;
+         while(digits < max && *word != '\0')
+         {
+            char* digit = strchr("0123456789abcdef", tolower((unsigned char)*word));
+            if(digit == NULL || digit - "0123456789abcdef" >= base)
+               break;
+            value = value * base + (digit - "0123456789abcdef");
+            word++;
+            digits++;
+         }
+
+         char byte = value;
+         if(c == 'x' && digits == 0)
+            out_put("\\x", 2);
+         else
+            out_put(&byte, 1);
+      }
+      else
+      {
+         //anything else is printed as it is
+         out_put(word, 1);
+         word++;
+      }
+   }
+
+   return 0;
+}
+
+/*
+ * echo [-neE] [ARG...]: prints its arguments separated by spaces, as
+ *    /bin/echo does; -n leaves off the newline and -e replaces
+ *    backslash escapes
+ */
+int builtin_echo(char** argv)
+{
+   int newline = 1, escapes = 0;
+   int i = 1;
+
+   //a word is taken as options only if each of its letters is one
+   while(argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' &&
+         strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1))
+   {
+      char* flag;
+      for(flag = argv[i] + 1; *flag != '\0'; flag++)
+      {
+         if(*flag == 'n')
+            newline = 0;
+         else
+            escapes = (*flag == 'e');
+      }
+      i++;
+   }
+
+   for(; argv[i] != NULL; i++)
+   {
+      if(!escapes)
+         out_str(argv[i]);
+      else if(echo_escaped(argv[i]))
+      {
+         out_end();
+         return 0;
+      }
+
+      if(argv[i + 1] != NULL)
+         out_put(" ", 1);
+   }
+
+   if(newline)
+      out_put("\n", 1);
+   out_end();
+
+   return 0;
+}
+
+#endif //BUILTINS_C
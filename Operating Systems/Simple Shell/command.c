@@ -0,0 +1,439 @@
+/*
+ * File:   command.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  A command is parsed once into a struct command, holding its
+ *            prefixes, argvs, redirections and variable slots, and
+ *            can then be run any number of times. handleCommand runs
+ *            it once, a loop refreshes its slots before every run.
+ */
+
+#ifndef COMMAND_C
+#define COMMAND_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "execute.c"
+#include "builtins.c"
+#include "memo.c"
+
+//a line holds at most one word for every two characters
+#define CMD_SIZE (INPUT_MAX / 2 + 1)
+
+//size of the redirection file names, which fit any name on a line
+#define CMD_FILE_SIZE INPUT_MAX
+
+int parse_command(char* line,
+		  char** cmd1, char** cmd2, int* stages,
+		  char* infile, char* outfile, int file_size);
+
+void clear_prefixes(void);
+
+//implemented in main.c
+extern int last_status;
+
+struct command
+{
+   char* source;                 //the command as it was typed
+   char* text;                   //copy of it the words point into
+   int ret;                      //code returned by parse_command
+   char** cmd1;
+   char** cmd2;                  //the stages after the first
+   char*** argv;                 //start of each stage in cmd1 and cmd2
+   int stages;
+   char infile[CMD_FILE_SIZE];
+   char outfile[CMD_FILE_SIZE];
+   int assigns;                  //NAME=value words in front of cmd1
+
+   //prefixes
+   int timed;
+   long long timeout;
+   long long grace;
+   struct job_sched sched;
+   struct job_limits limits;
+   struct memo_req memo;
+   int profile;
+
+   //words which hold variables
+   struct var_slot* slots;
+   int nslots;
+};
+
+void command_free(struct command* c);
+
+/*
+ * Strips the prefixes from a command and parses the rest of it.
+ * Returns 0 or -1 if a prefix is not valid (last_status is set)
+ */
+int command_parse(char* line, struct command* c)
+{
+   memset(c, 0, sizeof(*c));
+
+   //   The time builtin prefixes a command and reports its resource
+   //usage, timeout gives it a deadline, sched places its stages on
+   //CPUs, limit restricts their resources, memo caches its output and
+   //profile measures the flow between its stages. They may be combined.
+   while(1)
+   {
+      while(*line == ' ')
+         line++;
+
+      int limited = timeout_prefix(&line);
+      if(limited == -1)
+      {
+         fprintf(stderr, "usage: timeout [-k GRACE] DURATION command\n");
+         last_status = 125;
+         clear_prefixes();
+         return -1;
+      }
+      if(limited == 1)
+         continue;
+
+      int placed = sched_prefix(&line);
+      if(placed == -1)
+      {
+         fprintf(stderr, "usage: sched [-c CPUS[:CPUS...]] [-s] [-n NICE] [-p batch|idle|other] command\n");
+         last_status = 2;
+         clear_prefixes();
+         return -1;
+      }
+      if(placed == 1)
+         continue;
+
+      int limits = limit_prefix(&line);
+      if(limits == -1)
+      {
+         fprintf(stderr, "usage: limit [-v SIZE] [-t SECS] [-n FILES] [-u PROCS] [-m SIZE] [-c PERCENT] command\n");
+         last_status = 2;
+         clear_prefixes();
+         return -1;
+      }
+      if(limits == 1)
+         continue;
+
+      int memo = memo_prefix(&line);
+      if(memo == -1)
+      {
+         fprintf(stderr, "usage: memo [-e NAME]... command\n");
+         last_status = 2;
+         clear_prefixes();
+         return -1;
+      }
+      if(memo == 1)
+         continue;
+
+      if(profile_prefix(&line))
+         continue;
+
+      if(strncmp(line, "time", 4) == 0 && (line[4] == ' ' || line[4] == '\0'))
+      {
+         c->timed = 1;
+         line += 4;
+         continue;
+      }
+
+      break;
+   }
+
+   //the prefixes are kept with the command and set again when it runs
+   c->timeout = next_timeout;
+   c->grace = next_grace;
+   c->sched = next_sched;
+   c->limits = next_limits;
+   c->memo = next_memo;
+   c->profile = next_profile;
+   clear_prefixes();
+
+   c->source = strdup(line);
+   c->text = strdup(line);
+   c->cmd1 = calloc(CMD_SIZE, sizeof(char*));
+   c->cmd2 = calloc(CMD_SIZE, sizeof(char*));
+
+   //parse the command line from the user, expanding its variables
+   long long parse_start = stats_clock();
+   c->ret = parse_command(c->text, c->cmd1, c->cmd2, &c->stages, c->infile, c->outfile, CMD_FILE_SIZE);
+   metrics_record(H_PARSE, stats_clock() - parse_start);
+   metrics_count(C_PARSES);
+
+   c->slots = var_take_slots(&c->nslots);
+   if(c->ret == -1)
+   {
+      fprintf(stderr, "syntax error: missing or too long redirection file name\n");
+      last_status = 2;
+      command_free(c);
+      return -1;
+   }
+   //each stage in cmd2 starts after the NULL ending the one before it
+   c->argv = malloc(c->stages * sizeof(char**));
+   if(c->argv == NULL)
+   {
+      fprintf(stderr, "Could not allocate the %d stages of the command\n", c->stages);
+      last_status = 2;
+      command_free(c);
+      return -1;
+   }
+   int i;
+   char** next = c->cmd2;
+   c->argv[0] = c->cmd1;
+   for(i = 1; i < c->stages; i++)
+   {
+      c->argv[i] = next;
+      while(*next != NULL)
+         next++;
+      next++;
+   }
+
+   char* files[] = { c->infile, c->outfile };
+   var_locate_slots(c->slots, c->nslots, c->argv, c->stages, files, 2, CMD_FILE_SIZE);
+
+   //   Leading NAME=value words set shell variables, or export them to
+   //the command alone when one follows
+   if(c->ret != 0)
+      c->assigns = var_count_assignments(c->cmd1, c->slots, c->nslots);
+
+   return 0;
+}
+
+/*
+ * Runs a parsed command.
+ * Returns the code from parse_command, 0 if the user quit
+ */
+int command_run(struct command* c)
+{
+   int ret = c->ret;
+   if(ret == 0)
+      return 0;
+
+   if(c->assigns > 0 && c->cmd1[c->assigns] == NULL && ret <= 4)
+   {
+      var_assign(c->cmd1, c->assigns, 0);
+      last_status = 0;
+      return 1;
+   }
+   if(c->assigns > 0)
+      var_assign(c->cmd1, c->assigns, 1);
+
+   log_event(EV_COMMAND, c->source);
+
+   //wildcards are expanded last, into argvs which grow to fit
+   struct glob_strings matches = { NULL, 0, 0 };
+   char*** cmds = calloc(c->stages, sizeof(char**));
+   if(cmds == NULL)
+   {
+      fprintf(stderr, "Could not allocate the %d stages of the command\n", c->stages);
+      last_status = 1;
+      var_restore();
+      return 1;
+   }
+   int empty = 0;
+   int i;
+   for(i = 0; i < c->stages; i++)
+   {
+      cmds[i] = glob_command(c->argv[i] + (i == 0 ? c->assigns : 0), &matches);
+      if(cmds[i][0] == NULL)
+         empty = 1;
+   }
+   char** cmd1 = cmds[0];
+   char** cmd2 = (c->stages > 1) ? cmds[1] : NULL;
+
+   next_timeout = c->timeout;
+   next_grace = c->grace;
+   next_sched = c->sched;
+   next_limits = c->limits;
+   next_profile = c->profile;
+
+   //there is nothing to execute without a command on each side of a pipe
+   if(empty)
+   {
+      ret = 1;
+   }
+   else
+   {
+      //builtins run inside the shell unless they are part of a pipe
+      int builtin = (ret >= 1 && ret <= 4) ? find_builtin(cmd1[0]) : -1;
+      if(builtin >= 0)
+      {
+         int outRed = (ret == 3) ? OUT_APPEND : ((ret == 4) ? OUT_WRITE : OUT_NONE);
+         last_status = run_builtin(builtin, cmd1, c->infile, c->outfile, outRed);
+      }
+      //a cached job's output is replayed instead of running it
+      else if(c->memo.set)
+      {
+         int outRed = (ret == 3 || ret == 7) ? OUT_APPEND : ((ret == 4 || ret == 8) ? OUT_WRITE : OUT_NONE);
+         last_status = memo_run(&c->memo, cmds, c->stages, c->infile, c->outfile, outRed);
+      }
+      //longer pipes have no wrapper of their own
+      else if(c->stages > 2)
+      {
+         int outRed = (ret == 7) ? OUT_APPEND : ((ret == 8) ? OUT_WRITE : OUT_NONE);
+         last_status = exec_pipes(cmds, c->stages, c->infile, c->outfile, outRed);
+      }
+      //   Use the return code from parse_command
+      //to determine which senerio should be performed
+      else switch(ret)
+      {
+         case 1:   //Simple command
+            last_status = exec_cmd(cmd1);
+            break;
+         case 2:   //Simple command with input redirection
+            last_status = exec_cmd_in(cmd1, c->infile);
+            break;
+         case 3:   //Simple command with output redirection (append)
+            last_status = exec_cmd_opt_in_append(cmd1, c->infile, c->outfile);
+            break;
+         case 4:   //Simple command with output redirection (overwrite)
+            last_status = exec_cmd_opt_in_write(cmd1, c->infile, c->outfile);
+            break;
+         case 5:   //Two commands piped
+            last_status = exec_pipe(cmd1, cmd2);
+            break;
+         case 6:   //Two commands piped with input redirection
+            last_status = exec_pipe_in(cmd1, cmd2, c->infile);
+            break;
+         case 7:   //Two commands piped with output redirection (append)
+            last_status = exec_pipe_opt_in_append(cmd1, cmd2, c->infile, c->outfile);
+            break;
+         case 8:   //Two commands piped with output redirection (overwrite)
+            last_status = exec_pipe_opt_in_write(cmd1, cmd2, c->infile, c->outfile);
+            break;
+         default:   //parse_command returned a bad code
+            out_str("Not handled at this time!\n");
+            out_end();
+      }
+
+      if(c->timed)
+      {
+         stats_print_job();
+         limit_print_job();
+      }
+   }
+
+   //the prefixes and NAME=value words only cover this command
+   var_restore();
+   clear_prefixes();
+
+   for(i = 0; i < c->stages; i++)
+      if(cmds[i] != c->argv[i] + (i == 0 ? c->assigns : 0))
+         free(cmds[i]);
+   free(cmds);
+   glob_release(&matches);
+
+   return ret;
+}
+
+/*
+ * Executes a parsed command in place of the shell, for the last
+ *    command of a one-shot invocation. Its redirections are applied
+ *    to the shell's own descriptors and nothing is forked or waited
+ *    for. Commands which need the shell afterwards (builtins, pipes,
+ *    prefixes, a session deadline or running coprocesses) are left
+ *    for command_run.
+ * Returns only if the command was not executed
+ */
+void command_exec(struct command* c)
+{
+   if(c->ret < 1 || c->ret > 4 || c->timed || c->timeout > 0 || c->sched.set ||
+      c->limits.set || c->memo.set || c->profile)
+      return;
+   if(c->assigns > 0 && c->cmd1[c->assigns] == NULL)
+      return;
+
+   timeout_session_init();
+   if(session_timeout > 0 || coproc_count() > 0)
+      return;
+
+   //PATH=... in front of the command is searched
+   if(c->assigns > 0)
+      var_assign(c->cmd1, c->assigns, 1);
+   var_sync_env();
+
+   struct glob_strings matches = { NULL, 0, 0 };
+   char** cmd = glob_command(c->cmd1 + c->assigns, &matches);
+
+   //a command which is not found is reported by command_run
+   char path[PATH_MAX];
+   if(cmd[0] == NULL || find_builtin(cmd[0]) >= 0 || strcmp(cmd[0], "parallel") == 0 ||
+      !find_command(cmd[0], path, sizeof(path)))
+   {
+      var_restore();
+      if(cmd != c->cmd1 + c->assigns)
+         free(cmd);
+      glob_release(&matches);
+      return;
+   }
+
+   //the files are opened before anything is replaced, and a child
+   //would exit with 1 when one cannot be
+   int in_fd = -1, out_fd = -1;
+   if(c->infile[0] != '\0' && (in_fd = openIn(c->infile)) == -1)
+   {
+      out_flush();
+      exit(1);
+   }
+   if(c->ret == 3 || c->ret == 4)
+   {
+      out_fd = openOut(c->outfile, c->ret == 3);
+      if(out_fd == -1)
+      {
+         out_flush();
+         exit(1);
+      }
+   }
+
+   log_event(EV_EXEC, cmd[0]);
+   out_flush();
+   fflush(stderr);
+
+   if(in_fd != -1)
+   {
+      dup2(in_fd, STDIN_FILENO);
+      close(in_fd);
+   }
+   if(out_fd != -1)
+   {
+      dup2(out_fd, STDOUT_FILENO);
+      close(out_fd);
+   }
+
+   //the log's batch is written and its mapped window trimmed while
+   //the shell still can
+   log_sync();
+   log_trim();
+
+   event_child_signals();
+   execv(path, cmd);
+
+   fprintf(stderr, "%s: %s\n", cmd[0], strerror(exec_errno(path, errno)));
+   exit(126);
+}
+
+/*
+ * Frees a parsed command
+ */
+void command_free(struct command* c)
+{
+   var_free_slots(c->slots, c->nslots);
+   free(c->cmd1);
+   free(c->cmd2);
+   free(c->argv);
+   free(c->text);
+   free(c->source);
+}
+
+/*
+ * Forgets the timeout, sched and limit prefixes of a command once it
+ *    has been handled
+ */
+void clear_prefixes(void)
+{
+   next_timeout = 0;
+   next_sched.set = 0;
+   next_limits.set = 0;
+   next_memo.set = 0;
+   next_profile = 0;
+}
+
+#endif //COMMAND_C
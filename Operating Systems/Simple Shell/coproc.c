@@ -0,0 +1,397 @@
+/*
+ * File:   coproc.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Coprocesses: long lived children with a pipe to their stdin
+ *            and one from their stdout, so a tool like bc can answer
+ *            many queries without being started for each one.
+ *
+ *               coproc NAME cmd args    starts cmd as NAME
+ *               coproc                  lists the coprocesses
+ *               cowrite NAME words      writes the words as a line
+ *               coread NAME [N]         prints the next N lines (1)
+ *               coclose NAME            closes stdin and waits for it
+ *
+ *            The pipes are close-on-exec so no other command holds
+ *            them open. Reads are buffered per coprocess and can be
+ *            interrupted with Ctrl-C. A coprocess runs in its own
+ *            process group so Ctrl-C does not reach it.
+ */
+
+#ifndef COPROC_C
+#define COPROC_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "log.c"
+#include "stats.c"
+#include "event.c"
+#include "vars.c"
+#include "out.c"
+
+#define COPROC_MAX 16
+#define COPROC_BUFF 65536
+
+struct coproc
+{
+   char name[32];
+   pid_t pid;              //-1 when the slot is free
+   int to_fd;              //write end of the child's stdin
+   int from_fd;            //read end of the child's stdout
+   char buff[COPROC_BUFF]; //output read but not yet printed
+   int len;
+   int eof;
+};
+
+struct coproc coprocs[COPROC_MAX];
+int coprocs_ready = 0;
+
+/*
+ * Returns the number of coprocesses running
+ */
+int coproc_count(void)
+{
+   int i, count = 0;
+   for(i = 0; i < COPROC_MAX && coprocs_ready; i++)
+      if(coprocs[i].pid != -1)
+         count++;
+
+   return count;
+}
+
+/*
+ * Returns the named coprocess or NULL if there is none
+ */
+struct coproc* find_coproc(char* name)
+{
+   int i;
+   for(i = 0; i < COPROC_MAX && coprocs_ready; i++)
+      if(coprocs[i].pid != -1 && strcmp(coprocs[i].name, name) == 0)
+         return &coprocs[i];
+
+   return NULL;
+}
+
+/*
+ * Starts a coprocess.
+ * Returns 0 or 1 if it could not be started
+ */
+int coproc_start(char* name, char** cmd)
+{
+   int i;
+   if(!coprocs_ready)
+   {
+      for(i = 0; i < COPROC_MAX; i++)
+         coprocs[i].pid = -1;
+      coprocs_ready = 1;
+   }
+
+   if(find_coproc(name) != NULL)
+   {
+      fprintf(stderr, "coproc: %s is already running\n", name);
+      return 1;
+   }
+
+   struct coproc* co = NULL;
+   for(i = 0; i < COPROC_MAX && co == NULL; i++)
+      if(coprocs[i].pid == -1)
+         co = &coprocs[i];
+   if(co == NULL)
+   {
+      fprintf(stderr, "coproc: too many coprocesses\n");
+      return 1;
+   }
+
+   int to[2], from[2];
+   if(pipe2(to, O_CLOEXEC) == -1)
+      return 1;
+   if(pipe2(from, O_CLOEXEC) == -1)
+   {
+      close(to[0]);
+      close(to[1]);
+      return 1;
+   }
+
+   var_sync_env();
+
+   pid_t pid = fork();
+   if(pid == 0)
+   {
+      event_child_signals();
+
+      //Ctrl-C is for the job in the foreground, not the workers
+      setpgid(0, 0);
+
+      dup2(to[0], STDIN_FILENO);
+      dup2(from[1], STDOUT_FILENO);
+
+      execvp(cmd[0], cmd);
+      fprintf(stderr, "%s: command not found\n", cmd[0]);
+      exit(127);
+   }
+
+   close(to[0]);
+   close(from[1]);
+
+   if(pid < 0)
+   {
+      close(to[1]);
+      close(from[0]);
+      return 1;
+   }
+
+   snprintf(co->name, sizeof(co->name), "%s", name);
+   co->pid = pid;
+   co->to_fd = to[1];
+   co->from_fd = from[0];
+   co->len = 0;
+   co->eof = 0;
+
+   char buff[128];
+   snprintf(buff, sizeof(buff), "Started coprocess %s PID=%d\n", co->name, pid);
+   log_line(buff);
+
+   return 0;
+}
+
+/*
+ * Waits until the coprocess has output or Ctrl-C is pressed.
+ * Returns 1 if there is output (or end of file) to read
+ *         0 if it was interrupted
+ */
+int coproc_wait_readable(struct coproc* co)
+{
+   struct pollfd fds[2];
+   fds[0].fd = co->from_fd;
+   fds[0].events = POLLIN;
+   fds[1].fd = event_sigfd;
+   fds[1].events = POLLIN;
+
+   //SIGINT only reaches the shell through the event loop's signalfd
+   int nfds = (event_sigfd != -1 && event_owner == getpid()) ? 2 : 1;
+
+   while(1)
+   {
+      if(poll(fds, nfds, -1) == -1)
+      {
+         if(errno == EINTR)
+            continue;
+         return 0;
+      }
+
+      if(nfds == 2 && (fds[1].revents & POLLIN))
+      {
+         event_interrupted = 0;
+         event_on_signal(NULL);
+         if(event_interrupted)
+         {
+            event_interrupted = 0;
+            return 0;
+         }
+      }
+
+      if(fds[0].revents != 0)
+         return 1;
+   }
+}
+
+/*
+ * Prints the next line a coprocess wrote.
+ * Returns 0, 1 at the end of its output or 130 if interrupted
+ */
+int coproc_read_line(struct coproc* co)
+{
+   while(1)
+   {
+      char* nl = memchr(co->buff, '\n', co->len);
+
+      //a line too long for the buffer is printed in pieces
+      if(nl != NULL || co->len == COPROC_BUFF || (co->eof && co->len > 0))
+      {
+         int len = (nl != NULL) ? nl - co->buff + 1 : co->len;
+         out_put(co->buff, len);
+         if(nl == NULL)
+            out_put("\n", 1);
+         out_end();
+
+         memmove(co->buff, co->buff + len, co->len - len);
+         co->len -= len;
+         return 0;
+      }
+
+      if(co->eof)
+         return 1;
+
+      if(!coproc_wait_readable(co))
+         return 130;
+
+      int n = read(co->from_fd, co->buff + co->len, COPROC_BUFF - co->len);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         co->eof = 1;
+      else
+         co->len += n;
+   }
+}
+
+/*
+ * Closes a coprocess's stdin and waits for it to exit.
+ * Returns its exit status
+ */
+int coproc_close(struct coproc* co)
+{
+   close(co->to_fd);
+   close(co->from_fd);
+
+   int status;
+   pid_t ret;
+   while((ret = waitpid(co->pid, &status, 0)) == -1 && errno == EINTR)
+      ;
+
+   co->pid = -1;
+   return (ret == -1) ? 1 : stats_exit_code(status);
+}
+
+/*
+ * coproc [NAME cmd args]: starts a coprocess or lists them
+ */
+int builtin_coproc(char** argv)
+{
+   if(argv[1] == NULL)
+   {
+      int i;
+      for(i = 0; i < COPROC_MAX && coprocs_ready; i++)
+         if(coprocs[i].pid != -1)
+            out_printf("%-16s pid %d\n", coprocs[i].name, (int)coprocs[i].pid);
+      out_end();
+      return 0;
+   }
+
+   if(argv[2] == NULL)
+   {
+      fprintf(stderr, "usage: coproc NAME command\n");
+      return 2;
+   }
+
+   return coproc_start(argv[1], argv + 2);
+}
+
+/*
+ * cowrite NAME words: writes the words to a coprocess as one line
+ */
+int builtin_cowrite(char** argv)
+{
+   if(argv[1] == NULL)
+   {
+      fprintf(stderr, "usage: cowrite NAME words\n");
+      return 2;
+   }
+
+   struct coproc* co = find_coproc(argv[1]);
+   if(co == NULL)
+   {
+      fprintf(stderr, "cowrite: no coprocess %s\n", argv[1]);
+      return 1;
+   }
+
+   char line[4096];
+   int len = 0;
+   int i;
+   for(i = 2; argv[i] != NULL && len < (int)sizeof(line) - 1; i++)
+      len += snprintf(line + len, sizeof(line) - len, i > 2 ? " %s" : "%s", argv[i]);
+   if(len > (int)sizeof(line) - 2)
+      len = sizeof(line) - 2;
+   line[len++] = '\n';
+
+   //a coprocess which has exited must not take the shell with it, so
+   //SIGPIPE is held back and discarded
+   sigset_t pipe_set, old_set;
+   sigemptyset(&pipe_set);
+   sigaddset(&pipe_set, SIGPIPE);
+   sigprocmask(SIG_BLOCK, &pipe_set, &old_set);
+
+   //one write keeps the line whole
+   int done = 0;
+   while(done < len)
+   {
+      int n = write(co->to_fd, line + done, len - done);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         break;
+      done += n;
+   }
+
+   if(done < len)
+   {
+      struct timespec none = { 0, 0 };
+      sigtimedwait(&pipe_set, NULL, &none);
+   }
+   sigprocmask(SIG_SETMASK, &old_set, NULL);
+
+   if(done < len)
+   {
+      fprintf(stderr, "cowrite: %s is not reading\n", co->name);
+      return 1;
+   }
+
+   return 0;
+}
+
+/*
+ * coread NAME [N]: prints the next N lines of a coprocess's output
+ */
+int builtin_coread(char** argv)
+{
+   if(argv[1] == NULL)
+   {
+      fprintf(stderr, "usage: coread NAME [N]\n");
+      return 2;
+   }
+
+   struct coproc* co = find_coproc(argv[1]);
+   if(co == NULL)
+   {
+      fprintf(stderr, "coread: no coprocess %s\n", argv[1]);
+      return 1;
+   }
+
+   int count = (argv[2] != NULL) ? atoi(argv[2]) : 1;
+   int i;
+   for(i = 0; i < count; i++)
+   {
+      int ret = coproc_read_line(co);
+      if(ret != 0)
+         return ret;
+   }
+
+   return 0;
+}
+
+/*
+ * coclose NAME: ends a coprocess
+ */
+int builtin_coclose(char** argv)
+{
+   struct coproc* co = (argv[1] != NULL) ? find_coproc(argv[1]) : NULL;
+   if(co == NULL)
+   {
+      fprintf(stderr, "usage: coclose NAME\n");
+      return 2;
+   }
+
+   return coproc_close(co);
+}
+
+#endif //COPROC_C
@@ -0,0 +1,884 @@
+/*
+ * File:   daemon.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Daemon mode (myshell -d socket). The shell listens on a UNIX
+ *            domain socket and serves many client sessions at once,
+ *            multiplexed with epoll. Every client gets a runner, a
+ *            shell forked when it connects, which runs its lines with
+ *            handleList one at a time so variables, the deadline and
+ *            the rest of the session carry over between them. The
+ *            runner's stdout and stderr are streamed back, followed by
+ *            each line's exit status. quit ends the session. SIGTERM or
+ *            SIGINT stop the runners and remove the socket.
+ *
+ *            Every message to the client is a frame:
+ *               1 byte type ('O' stdout, 'E' stderr, 'X' exit status)
+ *               4 byte payload length (network byte order)
+ *               payload (for 'X', the status as 4 bytes, network order)
+ *
+ *            myshell -C socket 'line' is a small client which runs one
+ *            line through a daemon and exits with its status.
+ */
+
+#ifndef DAEMON_C
+#define DAEMON_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "log.c"
+#include "zygote.c"
+
+#define FRAME_STDOUT 'O'
+#define FRAME_STDERR 'E'
+#define FRAME_EXIT   'X'
+
+//the longest line a client may send
+#define DAEMON_LINE_MAX 4096
+
+//what an epoll event refers to
+#define W_LISTEN 0
+#define W_SIGNAL 1
+#define W_CLIENT 2
+#define W_STDOUT 3
+#define W_STDERR 4
+#define W_STATUS 5
+
+struct dclient;
+
+struct dwatch
+{
+   int kind;
+   struct dclient* client;
+};
+
+//one client session
+struct dclient
+{
+   int fd;
+   struct dwatch w_sock, w_out, w_err, w_status;
+
+   //input not yet run, possibly ending in a partial line
+   char in[DAEMON_LINE_MAX];
+   int in_len;
+
+   //frames which could not be sent yet
+   char* out;
+   int out_len, out_cap;
+
+   //   The session's runner, -1 once it has been reaped. Lines are
+   //written to line_pipe one at a time and the runner answers each
+   //with its status on status_pipe.
+   pid_t runner;
+   int line_pipe, status_pipe;
+   int out_pipe, err_pipe;
+   int busy;                     //a line was sent and has not finished
+   int status, exited;
+
+   int hungup;
+   int closing;                  //the session is over, output is draining
+   int removed;                  //freed once the current events are handled
+   struct dclient* next;
+};
+
+//implemented in main.c
+int handleList(char* line);
+extern int last_status;
+
+int daemon_epoll = -1;
+int daemon_listen_fd = -1;
+int daemon_signal_fd = -1;
+struct dclient* daemon_clients = NULL;
+struct dclient* daemon_removed = NULL;
+
+/*
+ * Watches a client's socket for input while there is room for it and
+ *    for space while output is queued
+ */
+void daemon_events(struct dclient* c)
+{
+   struct epoll_event ev;
+   ev.events = ((c->in_len < DAEMON_LINE_MAX && !c->closing) ? EPOLLIN : 0) | ((c->out_len > 0) ? EPOLLOUT : 0);
+   ev.data.ptr = &c->w_sock;
+   epoll_ctl(daemon_epoll, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/*
+ * Queues bytes for a client and sends as much as the socket takes
+ */
+void daemon_send(struct dclient* c, const char* data, int len)
+{
+   if(c->hungup)
+      return;
+
+   //send directly when nothing is waiting ahead of this data
+   if(c->out_len == 0)
+   {
+      int n = send(c->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+         c->hungup = 1;
+         return;
+      }
+      if(n > 0)
+      {
+         data += n;
+         len -= n;
+      }
+      if(len == 0)
+         return;
+   }
+
+   if(c->out_len + len > c->out_cap)
+   {
+      int cap = c->out_cap > 0 ? c->out_cap : 4096;
+      while(cap < c->out_len + len)
+         cap *= 2;
+
+      char* grown = realloc(c->out, cap);
+      if(grown == NULL)
+      {
+         c->hungup = 1;
+         return;
+      }
+      c->out = grown;
+      c->out_cap = cap;
+   }
+
+   memcpy(c->out + c->out_len, data, len);
+   c->out_len += len;
+
+   //ask to be told when the client can take more
+   daemon_events(c);
+}
+
+/*
+ * Sends one frame to a client
+ */
+void daemon_frame(struct dclient* c, char type, const char* payload, int len)
+{
+   char header[5];
+   uint32_t nlen = htonl(len);
+
+   header[0] = type;
+   memcpy(header + 1, &nlen, 4);
+
+   daemon_send(c, header, sizeof(header));
+   daemon_send(c, payload, len);
+}
+
+/*
+ * Sends queued output once the client's socket is writable again
+ */
+void daemon_flush(struct dclient* c)
+{
+   while(c->out_len > 0)
+   {
+      int n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(n == -1)
+      {
+         if(errno != EAGAIN && errno != EWOULDBLOCK)
+            c->hungup = 1;
+         break;
+      }
+
+      memmove(c->out, c->out + n, c->out_len - n);
+      c->out_len -= n;
+   }
+
+   if(c->out_len == 0 && !c->hungup)
+      daemon_events(c);
+}
+
+/*
+ * Registers a descriptor with the daemon's epoll
+ */
+void daemon_watch(int fd, struct dwatch* w)
+{
+   struct epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = w;
+   epoll_ctl(daemon_epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+//stops watching one of a client's pipes and closes it
+void daemon_close_pipe(int* fd)
+{
+   if(*fd == -1)
+      return;
+
+   epoll_ctl(daemon_epoll, EPOLL_CTL_DEL, *fd, NULL);
+   close(*fd);
+   *fd = -1;
+}
+
+/*
+ * Runs the lines of a session in the runner until the daemon closes
+ *    line_fd or a line quits. Each line is answered with its status
+ *    on status_fd once everything it printed has been written.
+ */
+void daemon_session(int line_fd, int status_fd)
+{
+   char in[DAEMON_LINE_MAX + 1];
+   int in_len = 0;
+
+   while(1)
+   {
+      char* nl = memchr(in, '\n', in_len);
+      if(nl == NULL)
+      {
+         int n = read(line_fd, in + in_len, sizeof(in) - in_len);
+         if(n == -1 && errno == EINTR)
+            continue;
+         if(n <= 0 || in_len + n == (int)sizeof(in))
+            exit(last_status);
+
+         in_len += n;
+         continue;
+      }
+
+      char line[DAEMON_LINE_MAX + 1];
+      int len = nl - in;
+      memcpy(line, in, len);
+      line[len] = '\0';
+      memmove(in, nl + 1, in_len - len - 1);
+      in_len -= len + 1;
+
+      int ret = handleList(line);
+      out_flush();
+      fflush(stderr);
+
+      uint32_t status = htonl(last_status);
+      if(write(status_fd, &status, 4) != 4 || ret == 0)
+         exit(last_status);
+   }
+}
+
+/*
+ * Closes everything of the daemon a runner must not keep open: the
+ *    listening socket, the epoll and signalfd and every client's
+ *    socket and pipes
+ */
+void daemon_close_all(void)
+{
+   close(daemon_listen_fd);
+   close(daemon_signal_fd);
+   close(daemon_epoll);
+
+   struct dclient* c;
+   for(c = daemon_clients; c != NULL; c = c->next)
+   {
+      int* fds[] = { &c->fd, &c->line_pipe, &c->status_pipe, &c->out_pipe, &c->err_pipe };
+      int i;
+      for(i = 0; i < 5; i++)
+         if(*fds[i] != -1)
+            close(*fds[i]);
+   }
+}
+
+/*
+ * Forks the runner of a new client, a shell which runs the client's
+ *    lines one after the other so its variables, working directory
+ *    and deadline carry over between them.
+ * Returns 0 or -1 if it could not be started
+ */
+int daemon_start_runner(struct dclient* c)
+{
+   //line, status, stdout and stderr pipes
+   int p[4][2];
+   int i;
+   for(i = 0; i < 4; i++)
+   {
+      if(pipe2(p[i], O_CLOEXEC) == -1)
+      {
+         while(i-- > 0)
+         {
+            close(p[i][0]);
+            close(p[i][1]);
+         }
+         return -1;
+      }
+   }
+
+   //the child's lines follow the daemon's batched ones
+   log_flush();
+
+   pid_t pid = fork();
+   if(pid == 0)
+   {
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+      signal(SIGPIPE, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      setpgid(0, 0);
+
+      //the zygote's socket cannot be shared between runners
+      zygote_fd = -1;
+      daemon_close_all();
+      close(p[0][1]);
+      close(p[1][0]);
+      close(p[2][0]);
+      close(p[3][0]);
+
+      int devnull = open("/dev/null", O_RDONLY);
+      dup2(devnull, STDIN_FILENO);
+      dup2(p[2][1], STDOUT_FILENO);
+      dup2(p[3][1], STDERR_FILENO);
+      if(devnull > STDERR_FILENO)
+         close(devnull);
+
+      daemon_session(p[0][0], p[1][1]);
+   }
+
+   //   The parent sets the group too, so the runner can be killed as
+   //a group as soon as fork returns.
+   if(pid > 0)
+      setpgid(pid, pid);
+
+   close(p[0][0]);
+   close(p[1][1]);
+   close(p[2][1]);
+   close(p[3][1]);
+
+   if(pid < 0)
+   {
+      close(p[0][1]);
+      close(p[1][0]);
+      close(p[2][0]);
+      close(p[3][0]);
+      return -1;
+   }
+
+   char buff[64];
+   snprintf(buff, sizeof(buff), "Daemon runner PID=%d\n", pid);
+   log_line(buff);
+
+   c->runner = pid;
+   c->line_pipe = p[0][1];
+   c->status_pipe = p[1][0];
+   c->out_pipe = p[2][0];
+   c->err_pipe = p[3][0];
+
+   //the streams are drained until empty before a line's status is sent
+   fcntl(c->out_pipe, F_SETFL, O_NONBLOCK);
+   fcntl(c->err_pipe, F_SETFL, O_NONBLOCK);
+   fcntl(c->status_pipe, F_SETFL, O_NONBLOCK);
+
+   daemon_watch(c->status_pipe, &c->w_status);
+   daemon_watch(c->out_pipe, &c->w_out);
+   daemon_watch(c->err_pipe, &c->w_err);
+
+   return 0;
+}
+
+/*
+ * Hands the next complete line a client has sent to its runner
+ */
+void daemon_next_line(struct dclient* c)
+{
+   if(c->busy || c->hungup || c->closing || c->line_pipe == -1)
+      return;
+
+   char* nl = memchr(c->in, '\n', c->in_len);
+   if(nl == NULL)
+      return;
+
+   int len = nl - c->in;
+   char line[DAEMON_LINE_MAX + 1];
+   memcpy(line, c->in, len);
+   if(len > 0 && line[len-1] == '\r')
+      len--;
+   line[len] = '\n';
+
+   //a full buffer is read from again now that it has room
+   int was_full = (c->in_len == DAEMON_LINE_MAX);
+   memmove(c->in, nl + 1, c->in_len - (nl - c->in) - 1);
+   c->in_len -= (nl - c->in) + 1;
+   if(was_full)
+      daemon_events(c);
+
+   //   The pipe is empty since the runner has answered every line
+   //before, so the line fits without blocking.
+   if(write(c->line_pipe, line, len + 1) != len + 1)
+   {
+      uint32_t status = htonl(1);
+      daemon_frame(c, FRAME_EXIT, (char*)&status, 4);
+      return;
+   }
+   c->busy = 1;
+
+   char buff[DAEMON_LINE_MAX + 64];
+   snprintf(buff, sizeof(buff), "Daemon runner PID=%d: %.*s\n", c->runner, len, line);
+   log_line(buff);
+}
+
+/*
+ * Closes a client once it has hung up and its runner is gone. It is
+ *    freed by daemon_free_removed, since events already returned by
+ *    epoll may still refer to it.
+ */
+void daemon_remove(struct dclient* c)
+{
+   struct dclient** cur = &daemon_clients;
+   while(*cur != NULL && *cur != c)
+      cur = &(*cur)->next;
+   if(*cur != NULL)
+      *cur = c->next;
+
+   daemon_close_pipe(&c->line_pipe);
+   daemon_close_pipe(&c->status_pipe);
+   daemon_close_pipe(&c->out_pipe);
+   daemon_close_pipe(&c->err_pipe);
+
+   epoll_ctl(daemon_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+   close(c->fd);
+   c->fd = -1;
+
+   c->removed = 1;
+   c->next = daemon_removed;
+   daemon_removed = c;
+}
+
+//frees the clients removed while handling a batch of events
+void daemon_free_removed(void)
+{
+   while(daemon_removed != NULL)
+   {
+      struct dclient* c = daemon_removed;
+      daemon_removed = c->next;
+      free(c->out);
+      free(c);
+   }
+}
+
+/*
+ * Forwards whatever the runner wrote to one of its streams.
+ * Returns 1 if anything was forwarded, 0 if the stream is empty or
+ *    has ended
+ */
+int daemon_stream(struct dclient* c, int kind)
+{
+   int* fd = (kind == W_STDOUT) ? &c->out_pipe : &c->err_pipe;
+   char buff[16384];
+
+   if(*fd == -1)
+      return 0;
+
+   int n = read(*fd, buff, sizeof(buff));
+   if(n > 0)
+   {
+      daemon_frame(c, kind == W_STDOUT ? FRAME_STDOUT : FRAME_STDERR, buff, n);
+      return 1;
+   }
+   if(n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+      return 0;
+
+   //end of the stream
+   daemon_close_pipe(fd);
+   return 0;
+}
+
+/*
+ * Ends a session once its runner has exited and all of its pipes are
+ *    drained. A line the runner did not answer gets its exit status.
+ */
+void daemon_check_done(struct dclient* c)
+{
+   if(!c->exited || c->out_pipe != -1 || c->err_pipe != -1 || c->status_pipe != -1)
+      return;
+
+   if(c->busy)
+   {
+      uint32_t status = htonl(c->status);
+      daemon_frame(c, FRAME_EXIT, (char*)&status, 4);
+      c->busy = 0;
+   }
+
+   //the client is closed once it has everything it was sent
+   daemon_close_pipe(&c->line_pipe);
+   c->closing = 1;
+   if(c->hungup || c->out_len == 0)
+      daemon_remove(c);
+   else
+      daemon_events(c);
+}
+
+/*
+ * Finishes a line once the runner has answered it: what it printed
+ *    is forwarded first, then its status
+ */
+void daemon_status(struct dclient* c)
+{
+   uint32_t status;
+   int n = read(c->status_pipe, &status, sizeof(status));
+   if(n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+
+   if(n != sizeof(status))
+   {
+      //the runner has exited
+      daemon_close_pipe(&c->status_pipe);
+      daemon_check_done(c);
+      return;
+   }
+
+   while(daemon_stream(c, W_STDOUT))
+      ;
+   while(daemon_stream(c, W_STDERR))
+      ;
+
+   daemon_frame(c, FRAME_EXIT, (char*)&status, 4);
+   c->busy = 0;
+
+   daemon_next_line(c);
+}
+
+/*
+ * Handles input from a client, or its hanging up
+ */
+void daemon_client_input(struct dclient* c, unsigned int events)
+{
+   if(events & EPOLLOUT)
+      daemon_flush(c);
+
+   //a finished session goes once its output has been sent
+   if(c->closing)
+   {
+      if(c->out_len == 0 || c->hungup)
+         daemon_remove(c);
+      return;
+   }
+
+   if(events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+   {
+      //   A buffer full of queued lines is not read from until the
+      //runner has taken some (the socket is not watched for input).
+      if(c->in_len < DAEMON_LINE_MAX)
+      {
+         int n = recv(c->fd, c->in + c->in_len, DAEMON_LINE_MAX - c->in_len, MSG_DONTWAIT);
+         if(n > 0)
+            c->in_len += n;
+         else if(n == 0 || (errno != EAGAIN && errno != EINTR))
+            c->hungup = 1;
+
+         if(c->in_len == DAEMON_LINE_MAX)
+            daemon_events(c);
+      }
+      else if(events & (EPOLLHUP | EPOLLERR))
+         c->hungup = 1;
+
+      //a line which does not fit is not a line
+      if(c->in_len == DAEMON_LINE_MAX && memchr(c->in, '\n', c->in_len) == NULL)
+         c->hungup = 1;
+   }
+
+   if(c->hungup)
+   {
+      //stop the runner, the client is removed once it has been reaped
+      epoll_ctl(daemon_epoll, EPOLL_CTL_DEL, c->fd, NULL);
+      daemon_close_pipe(&c->line_pipe);
+      if(!c->exited)
+         kill(-c->runner, SIGTERM);
+      else
+         daemon_check_done(c);
+      return;
+   }
+
+   daemon_next_line(c);
+}
+
+/*
+ * Reaps runners and ends their sessions
+ */
+void daemon_reap(void)
+{
+   int status;
+   pid_t pid;
+
+   while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+   {
+      struct dclient* c;
+      for(c = daemon_clients; c != NULL; c = c->next)
+      {
+         if(c->runner == pid)
+         {
+            c->exited = 1;
+            c->status = stats_exit_code(status);
+            daemon_check_done(c);
+            break;
+         }
+      }
+   }
+}
+
+/*
+ * Accepts every pending connection and starts a runner for each
+ */
+void daemon_accept(int lfd)
+{
+   int fd;
+   while((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) != -1)
+   {
+      struct dclient* c = calloc(1, sizeof(struct dclient));
+      if(c == NULL)
+      {
+         close(fd);
+         continue;
+      }
+
+      c->fd = fd;
+      c->runner = -1;
+      c->line_pipe = -1;
+      c->status_pipe = -1;
+      c->out_pipe = -1;
+      c->err_pipe = -1;
+      c->w_sock.kind = W_CLIENT;
+      c->w_out.kind = W_STDOUT;
+      c->w_err.kind = W_STDERR;
+      c->w_status.kind = W_STATUS;
+      c->w_sock.client = c->w_out.client = c->w_err.client = c->w_status.client = c;
+
+      c->next = daemon_clients;
+      daemon_clients = c;
+
+      daemon_watch(fd, &c->w_sock);
+      if(daemon_start_runner(c) == -1)
+      {
+         log_line("Could not start a daemon runner\n");
+         daemon_remove(c);
+      }
+   }
+}
+
+/*
+ * Fills in the address of a UNIX domain socket.
+ * Returns 0 or -1 if the path is too long
+ */
+int daemon_address(char* path, struct sockaddr_un* addr)
+{
+   memset(addr, 0, sizeof(*addr));
+   addr->sun_family = AF_UNIX;
+
+   if(strlen(path) >= sizeof(addr->sun_path))
+      return -1;
+
+   strcpy(addr->sun_path, path);
+   return 0;
+}
+
+/*
+ * Runs the daemon on the given socket path until it receives SIGTERM
+ *    or SIGINT, which stop the runners and remove the socket.
+ * Returns 0 when it was stopped or 1 if it could not be started
+ */
+int daemon_run(char* path)
+{
+   struct sockaddr_un addr;
+   if(daemon_address(path, &addr) == -1)
+   {
+      fprintf(stderr, "Socket path is too long: %s\n", path);
+      return 1;
+   }
+
+   int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+   if(lfd == -1)
+      return 1;
+
+   //replace a socket left behind by a daemon which is no longer running
+   if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+   {
+      int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      int alive = (errno == EADDRINUSE && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+      close(probe);
+
+      if(alive || unlink(path) == -1 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+      {
+         fprintf(stderr, "Could not listen on %s\n", path);
+         close(lfd);
+         return 1;
+      }
+   }
+
+   if(listen(lfd, 128) == -1)
+   {
+      close(lfd);
+      unlink(path);
+      return 1;
+   }
+
+   //runners are reaped and the daemon stopped through a signalfd
+   sigset_t mask;
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGCHLD);
+   sigaddset(&mask, SIGTERM);
+   sigaddset(&mask, SIGINT);
+   sigprocmask(SIG_BLOCK, &mask, NULL);
+   signal(SIGPIPE, SIG_IGN);
+
+   int sfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+   daemon_epoll = epoll_create1(EPOLL_CLOEXEC);
+   if(sfd == -1 || daemon_epoll == -1)
+   {
+      close(lfd);
+      unlink(path);
+      return 1;
+   }
+   daemon_listen_fd = lfd;
+   daemon_signal_fd = sfd;
+
+   struct dwatch w_listen = { W_LISTEN, NULL };
+   struct dwatch w_signal = { W_SIGNAL, NULL };
+   daemon_watch(lfd, &w_listen);
+   daemon_watch(sfd, &w_signal);
+
+   char buff[600];
+   snprintf(buff, sizeof(buff), "Daemon listening on %s\n", path);
+   log_line(buff);
+
+   int stopped = 0;
+   struct epoll_event events[64];
+   while(!stopped)
+   {
+      int n = epoll_wait(daemon_epoll, events, 64, -1);
+      if(n == -1)
+      {
+         if(errno == EINTR)
+            continue;
+         break;
+      }
+
+      int i;
+      for(i = 0; i < n && !stopped; i++)
+      {
+         struct dwatch* w = events[i].data.ptr;
+
+         if(w->client != NULL && w->client->removed)
+            continue;
+         else if(w->kind == W_LISTEN)
+            daemon_accept(lfd);
+         else if(w->kind == W_SIGNAL)
+         {
+            struct signalfd_siginfo info;
+            while(read(sfd, &info, sizeof(info)) > 0)
+               if(info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT)
+                  stopped = 1;
+            daemon_reap();
+         }
+         else if(w->kind == W_CLIENT)
+            daemon_client_input(w->client, events[i].events);
+         else if(w->kind == W_STATUS)
+            daemon_status(w->client);
+         else if(daemon_stream(w->client, w->kind) == 0)
+            daemon_check_done(w->client);
+      }
+      daemon_free_removed();
+   }
+
+   //no new sessions, and the ones running are stopped
+   close(lfd);
+   unlink(path);
+   log_line("Daemon stopped\n");
+
+   struct dclient* c;
+   for(c = daemon_clients; c != NULL; c = c->next)
+      if(!c->exited)
+         kill(-c->runner, SIGTERM);
+   while(daemon_clients != NULL)
+      daemon_remove(daemon_clients);
+   daemon_free_removed();
+
+   close(sfd);
+   close(daemon_epoll);
+   return stopped ? 0 : 1;
+}
+
+/*
+ * Reads exactly len bytes from fd.
+ * Returns 1 if they were read, 0 at the end of the stream
+ */
+int read_full(int fd, char* buff, int len)
+{
+   while(len > 0)
+   {
+      int n = read(fd, buff, len);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         return 0;
+
+      buff += n;
+      len -= n;
+   }
+   return 1;
+}
+
+/*
+ * Runs one line through a daemon, copying its output to stdout and
+ *    stderr (the -C option).
+ * Returns the exit status of the line or 1 if the daemon failed
+ */
+int daemon_client(char* path, char* line)
+{
+   struct sockaddr_un addr;
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(fd == -1 || daemon_address(path, &addr) == -1 ||
+      connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+   {
+      fprintf(stderr, "Could not connect to %s\n", path);
+      return 1;
+   }
+
+   int len = strlen(line);
+   if(write(fd, line, len) != len || write(fd, "\n", 1) != 1)
+      return 1;
+
+   char buff[16384];
+   char header[5];
+   while(read_full(fd, header, sizeof(header)))
+   {
+      uint32_t nlen;
+      memcpy(&nlen, header + 1, 4);
+      uint32_t size = ntohl(nlen);
+
+      while(size > 0)
+      {
+         int chunk = size < sizeof(buff) ? size : sizeof(buff);
+         if(!read_full(fd, buff, chunk))
+            return 1;
+
+         if(header[0] == FRAME_STDOUT)
+            write(STDOUT_FILENO, buff, chunk);
+         else if(header[0] == FRAME_STDERR)
+            write(STDERR_FILENO, buff, chunk);
+         else if(header[0] == FRAME_EXIT && chunk == 4)
+         {
+            uint32_t status;
+            memcpy(&status, buff, 4);
+            close(fd);
+            return ntohl(status);
+         }
+
+         size -= chunk;
+      }
+   }
+
+   close(fd);
+   return 1;
+}
+
+#endif //DAEMON_C
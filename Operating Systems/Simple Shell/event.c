@@ -0,0 +1,528 @@
+/*
+ * File:   event.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  The shell's event loop. Everything the shell waits for is
+ *            a descriptor in one epoll: user input, SIGCHLD and SIGINT
+ *            through a signalfd, deadlines through a timerfd and exits
+ *            reported by the zygote. Reading a line and waiting for a
+ *            job both run the loop, so the shell can react to a
+ *            signal or a deadline while either is in progress.
+ *
+ *            SIGCHLD and SIGINT are blocked in the shell while the loop
+ *            exists; event_child_signals unblocks them in children.
+ *            Without the loop (if it cannot be created) the shell falls
+ *            back to blocking reads and waits.
+ */
+
+#ifndef EVENT_C
+#define EVENT_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "log.c"
+#include "stats.c"
+#include "metrics.c"
+#include "zygote.c"
+
+//the longest line of user input
+#define INPUT_MAX 1024
+
+#define EVENT_MAX_WATCHES 16
+#define EVENT_MAX_TIMERS  32
+
+//a descriptor in the loop and what to do when it is readable
+struct event_watch
+{
+   int fd;                                //-1 when the slot is free
+   void (*handler)(void* data);
+   void* data;
+};
+
+//a deadline on the monotonic clock
+struct event_timer
+{
+   int id;
+   long long deadline;                    //nanoseconds, as stats_clock
+   void (*fire)(void* data);
+   void* data;
+};
+
+int event_epoll = -1;
+int event_sigfd = -1;
+int event_timerfd = -1;
+
+//the process the loop belongs to, a forked child builds its own
+pid_t event_owner = -1;
+
+struct event_watch event_watches[EVENT_MAX_WATCHES];
+struct event_timer event_timers[EVENT_MAX_TIMERS];
+int event_num_timers = 0;
+int event_next_timer = 1;
+
+//set when SIGINT arrives, cleared by whoever handles it
+int event_interrupted = 0;
+
+//the job being waited for by event_wait_job
+struct cmd_stats** event_job = NULL;
+int* event_job_done = NULL;
+int event_job_size = 0;
+int event_job_count = 0;
+int event_job_left = 0;
+long long event_job_wait_start = 0;
+
+//user input read but not yet handed out as lines
+char event_input[INPUT_MAX];
+int event_input_len = 0;
+int event_input_eof = 0;
+
+/*
+ * Adds a descriptor to the loop.
+ * Returns 1 or 0 if it cannot be watched (e.g. a regular file)
+ */
+int event_watch(int fd, void (*handler)(void* data), void* data)
+{
+   int i;
+   for(i = 0; i < EVENT_MAX_WATCHES; i++)
+   {
+      if(event_watches[i].fd != -1)
+         continue;
+
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.ptr = &event_watches[i];
+      if(epoll_ctl(event_epoll, EPOLL_CTL_ADD, fd, &ev) == -1)
+         return 0;
+
+      event_watches[i].fd = fd;
+      event_watches[i].handler = handler;
+      event_watches[i].data = data;
+      return 1;
+   }
+
+   return 0;
+}
+
+//removes a descriptor from the loop
+void event_unwatch(int fd)
+{
+   int i;
+   for(i = 0; i < EVENT_MAX_WATCHES; i++)
+   {
+      if(event_watches[i].fd == fd)
+      {
+         epoll_ctl(event_epoll, EPOLL_CTL_DEL, fd, NULL);
+         event_watches[i].fd = -1;
+      }
+   }
+}
+
+/*
+ * Arms the timerfd for the earliest deadline, or disarms it
+ */
+void event_arm(void)
+{
+   struct itimerspec its;
+   memset(&its, 0, sizeof(its));
+
+   int i;
+   long long first = 0;
+   for(i = 0; i < event_num_timers; i++)
+      if(first == 0 || event_timers[i].deadline < first)
+         first = event_timers[i].deadline;
+
+   //a zero it_value disarms, so a deadline already past is moved to 1ns
+   if(first > 0)
+   {
+      its.it_value.tv_sec = first / 1000000000LL;
+      its.it_value.tv_nsec = first % 1000000000LL;
+      if(its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+         its.it_value.tv_nsec = 1;
+   }
+
+   timerfd_settime(event_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * Calls fire(data) from the loop once the monotonic clock reaches
+ *    deadline (in nanoseconds, as returned by metrics_clock).
+ * Returns the id of the timer or -1 if there is no room
+ */
+int event_timer_add(long long deadline, void (*fire)(void* data), void* data)
+{
+   if(event_timerfd == -1 || event_num_timers == EVENT_MAX_TIMERS)
+      return -1;
+
+   struct event_timer* t = &event_timers[event_num_timers++];
+   t->id = event_next_timer++;
+   t->deadline = deadline;
+   t->fire = fire;
+   t->data = data;
+
+   event_arm();
+   return t->id;
+}
+
+//cancels a timer which has not fired yet
+void event_timer_cancel(int id)
+{
+   int i;
+   for(i = 0; i < event_num_timers; i++)
+   {
+      if(event_timers[i].id == id)
+      {
+         event_timers[i] = event_timers[--event_num_timers];
+         event_arm();
+         return;
+      }
+   }
+}
+
+/*
+ * Fires every timer whose deadline has passed
+ */
+void event_on_timer(void* data)
+{
+   uint64_t expirations;
+   while(read(event_timerfd, &expirations, sizeof(expirations)) > 0)
+      ;
+
+   long long now = stats_clock();
+
+   int i = 0;
+   while(i < event_num_timers)
+   {
+      if(event_timers[i].deadline > now)
+      {
+         i++;
+         continue;
+      }
+
+      //remove the timer first, it may add new ones when it fires
+      struct event_timer t = event_timers[i];
+      event_timers[i] = event_timers[--event_num_timers];
+      t.fire(t.data);
+      i = 0;
+   }
+
+   event_arm();
+}
+
+/*
+ * Records a stage of the current job as finished
+ */
+void event_stage_done(int i)
+{
+   event_job_done[i] = 1;
+   event_job_left--;
+
+   log_event(EV_WAIT_END, event_job[i]->name);
+   metrics_record(H_WAIT, stats_clock() - event_job_wait_start);
+   metrics_count(C_WAITS);
+}
+
+/*
+ * Reaps every stage of the current job which has finished
+ */
+void event_check_job(void)
+{
+   int i;
+   for(i = 0; i < event_job_count; i++)
+   {
+      if(event_job_done[i])
+         continue;
+
+      struct cmd_stats* st = event_job[i];
+      if(st->zygote)
+      {
+         if(zygote_exited(st->pid))
+         {
+            zygote_reap(st);
+            event_stage_done(i);
+         }
+      }
+      else if(stats_try_reap(st))
+         event_stage_done(i);
+   }
+}
+
+/*
+ * Handles SIGCHLD and SIGINT
+ */
+void event_on_signal(void* data)
+{
+   struct signalfd_siginfo info;
+   int chld = 0;
+
+   while(read(event_sigfd, &info, sizeof(info)) == sizeof(info))
+   {
+      if(info.ssi_signo == SIGCHLD)
+         chld = 1;
+      else if(info.ssi_signo == SIGINT)
+      {
+         event_interrupted = 1;
+
+         //the terminal interrupts the job itself, kill(1) only the shell
+         int i;
+         if(info.ssi_code == SI_USER)
+            for(i = 0; i < event_job_count; i++)
+               if(!event_job_done[i] && event_job[i]->pid > 0)
+                  kill(event_job[i]->pid, SIGINT);
+      }
+   }
+
+   if(chld)
+      event_check_job();
+}
+
+/*
+ * Collects the exits the zygote has sent
+ */
+void event_on_zygote(void* data)
+{
+   int fd = zygote_fd;
+   if(!zygote_drain())
+      event_unwatch(fd);
+
+   event_check_job();
+}
+
+/*
+ * Creates the loop for this process if it does not exist yet.
+ * Returns 1 if the loop can be used
+ */
+int event_init(void)
+{
+   if(event_owner == getpid())
+      return event_epoll != -1;
+
+   //a forked child must not share its parent's epoll
+   if(event_epoll != -1)
+   {
+      close(event_epoll);
+      close(event_sigfd);
+      close(event_timerfd);
+   }
+
+   event_owner = getpid();
+   event_num_timers = 0;
+
+   int i;
+   for(i = 0; i < EVENT_MAX_WATCHES; i++)
+      event_watches[i].fd = -1;
+
+   sigset_t mask;
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGCHLD);
+   sigaddset(&mask, SIGINT);
+
+   event_epoll = epoll_create1(EPOLL_CLOEXEC);
+   event_sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+   event_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+   if(event_epoll == -1 || event_sigfd == -1 || event_timerfd == -1)
+   {
+      log_line("Could not create the event loop\n");
+
+      if(event_epoll != -1)
+         close(event_epoll);
+      if(event_sigfd != -1)
+         close(event_sigfd);
+      if(event_timerfd != -1)
+         close(event_timerfd);
+      event_epoll = event_sigfd = event_timerfd = -1;
+      return 0;
+   }
+
+   sigprocmask(SIG_BLOCK, &mask, NULL);
+
+   event_watch(event_sigfd, event_on_signal, NULL);
+   event_watch(event_timerfd, event_on_timer, NULL);
+
+   return 1;
+}
+
+/*
+ * Unblocks the signals the loop reads. Called in children before
+ *    they execute a command.
+ */
+void event_child_signals(void)
+{
+   sigset_t mask;
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGCHLD);
+   sigaddset(&mask, SIGINT);
+   sigprocmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+/*
+ * Waits for one round of events and handles them
+ */
+void event_run_once(void)
+{
+   struct epoll_event events[EVENT_MAX_WATCHES];
+
+   int n = epoll_wait(event_epoll, events, EVENT_MAX_WATCHES, -1);
+
+   int i;
+   for(i = 0; i < n; i++)
+   {
+      struct event_watch* w = events[i].data.ptr;
+      if(w->fd != -1)
+         w->handler(w->data);
+   }
+}
+
+/*
+ * Waits for every stage of a job, handling other events meanwhile.
+ * Returns the exit status of the last stage
+ */
+int event_wait_job(struct cmd_stats** stages, int count)
+{
+   int i;
+
+   //the loop marks the stages it has reaped
+   int* grown = NULL;
+   if(event_init())
+      grown = stats_grow(event_job_done, &event_job_size, count, sizeof(int));
+   if(grown != NULL)
+      event_job_done = grown;
+
+   //without the loop wait for each stage in turn
+   if(grown == NULL)
+   {
+      int status = 1;
+      for(i = 0; i < count; i++)
+      {
+         log_event(EV_WAIT_BEGIN, stages[i]->name);
+         long long wait_start = stats_clock();
+         status = stages[i]->zygote ? zygote_reap(stages[i]) : stats_reap(stages[i]);
+         log_event(EV_WAIT_END, stages[i]->name);
+
+         metrics_record(H_WAIT, stats_clock() - wait_start);
+         metrics_count(C_WAITS);
+      }
+      return status;
+   }
+
+   event_job = stages;
+   event_job_count = count;
+   event_job_left = count;
+   event_job_wait_start = stats_clock();
+
+   int zygote = 0;
+   for(i = 0; i < count; i++)
+   {
+      event_job_done[i] = 0;
+      log_event(EV_WAIT_BEGIN, stages[i]->name);
+      zygote |= stages[i]->zygote;
+   }
+
+   int watched = zygote && zygote_fd != -1 && event_watch(zygote_fd, event_on_zygote, NULL);
+   int fd = zygote_fd;
+
+   //stages may have finished before the loop looks at SIGCHLD
+   event_check_job();
+   while(event_job_left > 0)
+      event_run_once();
+
+   if(watched)
+      event_unwatch(fd);
+
+   event_job = NULL;
+   event_job_count = 0;
+
+   return count > 0 ? stages[count - 1]->status : 1;
+}
+
+/*
+ * Reads whatever input is available into the input buffer
+ */
+void event_on_input(void* data)
+{
+   int n = read(STDIN_FILENO, event_input + event_input_len, INPUT_MAX - event_input_len);
+
+   if(n > 0)
+      event_input_len += n;
+   else if(n == 0 || (errno != EAGAIN && errno != EINTR))
+      event_input_eof = 1;
+}
+
+/*
+ * Reads the next line of user input, running the loop until it has
+ *    arrived. Input is only watched here so it is never taken from a
+ *    running command.
+ * Returns 1 if a line was stored
+ *         0 at the end of the input
+ *        -1 if SIGINT interrupted the read
+ */
+int event_read_line(char* line, int size)
+{
+   int loop = event_init();
+   int watched = 0;
+   int ret = 0;
+
+   event_interrupted = 0;
+
+   while(1)
+   {
+      char* nl = memchr(event_input, '\n', event_input_len);
+
+      //an overlong line is cut where the buffer ends
+      if(nl != NULL || event_input_len == INPUT_MAX || (event_input_eof && event_input_len > 0))
+      {
+         int len = (nl != NULL) ? nl - event_input : event_input_len;
+         int used = (nl != NULL) ? len + 1 : len;
+
+         if(len > size - 1)
+            len = size - 1;
+         memcpy(line, event_input, len);
+         line[len] = '\0';
+
+         memmove(event_input, event_input + used, event_input_len - used);
+         event_input_len -= used;
+
+         ret = 1;
+         break;
+      }
+
+      if(event_input_eof)
+         break;
+
+      if(loop && !watched)
+         watched = event_watch(STDIN_FILENO, event_on_input, NULL) ? 1 : -1;
+
+      //stdin cannot be watched (a regular file), so just read it
+      if(!loop || watched == -1)
+      {
+         event_on_input(NULL);
+         continue;
+      }
+
+      event_run_once();
+
+      if(event_interrupted)
+      {
+         event_interrupted = 0;
+         ret = -1;
+         break;
+      }
+   }
+
+   if(watched == 1)
+      event_unwatch(STDIN_FILENO);
+
+   return ret;
+}
+
+#endif //EVENT_C
@@ -0,0 +1,43 @@
+/*
+ * File:   example.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  A small program linked against libmyshell.a. It runs the
+ *            pipeline given as its argument (or a default one) with
+ *            the library and prints how each stage did:
+ *
+ *               ./example "seq 1 100000 | sort -r | head -3"
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "myshell.h"
+
+int main(int argc, char** argv)
+{
+   const char* line = (argc > 1) ? argv[1] : "seq 1 100000 | sort -r | head -3";
+   char err[128];
+
+   myshell_cmd* cmd = myshell_parse(line, err, sizeof(err));
+   if(cmd == NULL)
+   {
+      fprintf(stderr, "example: %s\n", err);
+      return 2;
+   }
+
+   struct myshell_job job;
+   int status = myshell_run(cmd, -1, -1, -1, &job);
+
+   int i;
+   for(i = 0; i < job.count; i++)
+   {
+      struct myshell_stage* st = &job.stages[i];
+      fprintf(stderr, "%-12s pid %-7d status %-3d wall %8.3f ms  maxrss %ld KiB\n",
+              myshell_stage_argv(cmd, i)[0], (int)st->pid, st->status,
+              st->wall / 1e6, st->usage.ru_maxrss);
+   }
+
+   myshell_free(cmd);
+   return status;
+}
@@ -6,820 +6,571 @@
  *          given command(s).
  */
 
+#ifndef EXECUTE_C
+#define EXECUTE_C
+
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
 
 #include "redirections.c"
 #include "log.c"
+#include "stats.c"
+#include "metrics.c"
+#include "zygote.c"
+#include "event.c"
+#include "timeout.c"
+#include "affinity.c"
+#include "limits.c"
+#include "parallel.c"
+#include "profile.c"
+#include "vars.c"
+#include "glob.c"
+
+//output redirection modes for exec_pipeline
+#define OUT_NONE   0
+#define OUT_WRITE -1	// >
+#define OUT_APPEND 1	// >>
 
 //executes a single command
-void exec_cmd(char** cmd1);
+int exec_cmd(char** cmd1);
 //single command with <
-void exec_cmd_in(char** cmd1, char* infile);
+int exec_cmd_in(char** cmd1, char* infile);
 //single command with >> and possibly <
-void exec_cmd_opt_in_append(char** cmd1, char* infile, char* outfile);
+int exec_cmd_opt_in_append(char** cmd1, char* infile, char* outfile);
 //single command with > and possibly <
-void exec_cmd_opt_in_write(char** cmd1, char* infile, char* outfile);
+int exec_cmd_opt_in_write(char** cmd1, char* infile, char* outfile);
 //two commands piped
-void exec_pipe(char** cmd1, char** cmd2);
+int exec_pipe(char** cmd1, char** cmd2);
 //pipe with <
-void exec_pipe_in(char** cmd1, char** cmd2, char* infile);
+int exec_pipe_in(char** cmd1, char** cmd2, char* infile);
 //pipe with >> and possibly <
-void exec_pipe_opt_in_append(char** cmd1, char** cmd2, char* infile, char* outfile);
+int exec_pipe_opt_in_append(char** cmd1, char** cmd2, char* infile, char* outfile);
 //pipe with > and possibly <
-void exec_pipe_opt_in_write(char** cmd1, char** cmd2, char* infile, char* outfile);
+int exec_pipe_opt_in_write(char** cmd1, char** cmd2, char* infile, char* outfile);
+//more than two commands piped, with optional redirections
+int exec_pipes(char** cmds[], int count, char* infile, char* outfile, int outRed);
+//executes the stages of a pipeline with optional redirections
+int exec_pipeline(char** cmds[], int count, char* infile, char* outfile, int outRed);
+//sets up and executes one stage of a pipeline in a child process
+void exec_stage(char** cmd, int index, int count, int in_fd, int* pipefd,
+                char* infile, char* outfile, int outRed);
+//starts one stage in a child, directly or through the zygote
+pid_t spawn_stage(struct cmd_stats* st, char** cmd, int index, int count, int in_fd, int* pipefd,
+                  char* infile, char* outfile, int outRed);
+//searches PATH for a command like execvp does
+int find_command(char* name, char* path, int size);
+//the reason exec gave for not running a path
+int exec_errno(char* path, int err);
+
+//implemented in builtins.c
+int find_builtin(char* name);
+int call_builtin(int index, char** argv);
 
 /*
  * Executes a single command
  */
-void exec_cmd(char** cmd1)
+int exec_cmd(char** cmd1)
 {
-   log_line("Attempting to execute single command\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
-   {
-      log_line("Fork Faild\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
-   {
-      sprintf(buff, "Child is attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-      log_line(buff);
-
-      //execute cmd1
-      execvp(cmd1[0], cmd1);
+   log_line("Attempting to execute single command\n");
 
-      sprintf(buff, "Child could not find a command or program \"%s\"\n", cmd1[0]);
-      log_line(buff);
-
-      log_line("Child is terminating\n");
-      exit(0);   //quit child process
-   }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
-
-      wait(NULL);
-
-      log_line("Parent process has finished waiting\n");
-   }
+   char** cmds[] = { cmd1 };
+   return exec_pipeline(cmds, 1, "", "", OUT_NONE);
 }
 
 /*
  * Executes a single command with input redirection
  */
-void exec_cmd_in(char** cmd1, char* infile)
+int exec_cmd_in(char** cmd1, char* infile)
 {
-   log_line("Attempting to execute single command with <\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
-   {
-      log_line("Fork Faild\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
-   {
-      sprintf(buff, "Child is applying input redirection from %s\n", infile);
-      log_line(buff);
-
-      //input redirection
-      int t1, t2;
-      redirIn(infile, &t1, &t2);
-
-      sprintf(buff, "Child is attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-      log_line(buff);
-
-      //execute cmd1
-      execvp(cmd1[0], cmd1);
-
-      sprintf(buff, "Child could not find a command or program \"%s\"\n", cmd1[0]);
-      log_line(buff);
-      log_line("Child is restoring stdin\n");
-
-      //restore from redirection
-      resIn(t1, t2);
-
-      log_line("Child is terminating\n");
-      exit(0);	//terminate child process
-   }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
+   log_line("Attempting to execute single command with <\n");
 
-      wait(NULL);
-
-      log_line("Parent process has finished waiting\n");
-   }
+   char** cmds[] = { cmd1 };
+   return exec_pipeline(cmds, 1, infile, "", OUT_NONE);
 }
 
 /*
  * Executes single command with output redirection (append)
  *    and possibly input redirection.
  */
-void exec_cmd_opt_in_append(char** cmd1, char* infile, char* outfile)
+int exec_cmd_opt_in_append(char** cmd1, char* infile, char* outfile)
 {
-   log_line("Attempting to execute single command with >> and possibly <\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
-   {
-      printf("Fork Faild\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
-   {
-      int stdin_fd, in_fd, stdout_fd, out_fd;
-      if(infile[0] != '\0')
-      {
-         sprintf(buff, "Child is applying input redirection from %s\n", infile);
-         log_line(buff);
-
-         //input redirection
-         redirIn(infile, &stdin_fd, &in_fd);
-      }
-
-      sprintf(buff, "Child is applying output redirection (append) to %s\n", outfile);
-      log_line(buff);
-
-      //output redirection (append)
-      redirOutAppend(outfile, &stdout_fd, &out_fd);
-
-      sprintf(buff, "Child is attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-      log_line(buff);
-
-      //execute cmd1
-      execvp(cmd1[0], cmd1);
-
-      sprintf(buff, "Child could not find a command or program \"%s\"\n", cmd1[0]);
-      log_line(buff);
+   log_line("Attempting to execute single command with >> and possibly <\n");
 
-      if(infile[0] != '\0')
-      {
-         log_line("Child is restoring stdin\n");
-         //restore input redirection
-         resIn(stdin_fd, in_fd);
-      }
-
-      log_line("Child is restoring stdout\n");
-      //restore output redirection
-      resOut(stdout_fd, out_fd);
-
-      log_line("Child is terminating\n");
-      exit(0); //terminate child process
-   }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
-
-      wait(NULL);
-
-      log_line("Parent process has finished waiting\n");
-   }
+   char** cmds[] = { cmd1 };
+   return exec_pipeline(cmds, 1, infile, outfile, OUT_APPEND);
 }
 
 /*
  * Executes a single command with output redirection (overwrite)
  *    and possibly input redirection.
  */
-void exec_cmd_opt_in_write(char** cmd1, char* infile, char* outfile)
+int exec_cmd_opt_in_write(char** cmd1, char* infile, char* outfile)
 {
-   log_line("Attempting to execute single command with > and possibly <\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
-   {
-      log_line("Fork Faild\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
-   {
-      int stdin_fd, in_fd, stdout_fd, out_fd;
-      if(infile[0] != '\0')
-      {
-         sprintf(buff, "Child is applying input redirection from %s\n", infile);
-         log_line(buff);
+   log_line("Attempting to execute single command with > and possibly <\n");
 
-         //input redirection
-         redirIn(infile, &stdin_fd, &in_fd);
-      }
+   char** cmds[] = { cmd1 };
+   return exec_pipeline(cmds, 1, infile, outfile, OUT_WRITE);
+}
 
-      sprintf(buff, "Child is applying output redirection (overwrite) to %s\n", outfile);
-      log_line(buff);
+/*
+ * Executes two commands pipe together
+ */
+int exec_pipe(char** cmd1, char** cmd2)
+{
+   log_line("Attempting to execute two piped commands\n");
 
-      //output redirection (overwrite)
-      redirOut(outfile, &stdout_fd, &out_fd);
+   char** cmds[] = { cmd1, cmd2 };
+   return exec_pipeline(cmds, 2, "", "", OUT_NONE);
+}
 
-      sprintf(buff, "Child is attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-      log_line(buff);
+/*
+ * Executes two commands piped together with input redirection
+ */
+int exec_pipe_in(char** cmd1, char** cmd2, char* infile)
+{
+   log_line("Attempting to execute two piped commands with <\n");
 
-      //execute cmd1
-      execvp(cmd1[0], cmd1);
+   char** cmds[] = { cmd1, cmd2 };
+   return exec_pipeline(cmds, 2, infile, "", OUT_NONE);
+}
 
-      sprintf(buff, "Child could not find a command or program \"%s\"\n", cmd1[0]);
-      log_line(buff);
+/*
+ * Executes two commands piped together with output redirection (append)
+ *    and possibly input redirection
+ */
+int exec_pipe_opt_in_append(char** cmd1, char** cmd2, char* infile, char* outfile)
+{
+   log_line("Attempting to execute two pipe commands with >> and possibly <\n");
 
-      if(infile[0] != '\0')
-      {
-         log_line("Child is restoring stdin\n");
-         //restore input redirection
-         resIn(stdin_fd, in_fd);
-      }
+   char** cmds[] = { cmd1, cmd2 };
+   return exec_pipeline(cmds, 2, infile, outfile, OUT_APPEND);
+}
 
-      log_line("Child is restoring stdout\n");
-      //restore output redirection
-      resOut(stdout_fd, out_fd);
+/*
+ * Executes two commands piped together with output redirection (overwrite)
+ *    and possibly input redirection
+ */
+int exec_pipe_opt_in_write(char** cmd1, char** cmd2, char* infile, char* outfile)
+{
+   log_line("Attempting to executed two piped commands with > and possibly <\n");
 
-      log_line("Child is terminating\n");
-      exit(0); //Terminate child process
-   }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
+   char** cmds[] = { cmd1, cmd2 };
+   return exec_pipeline(cmds, 2, infile, outfile, OUT_WRITE);
+}
 
-      wait(NULL);
+/*
+ * Executes more than two commands piped together with optional
+ *    redirections
+ */
+int exec_pipes(char** cmds[], int count, char* infile, char* outfile, int outRed)
+{
+   log_line("Attempting to execute more than two piped commands\n");
 
-      log_line("Parent has finished waiting.\n");
-   }
+   return exec_pipeline(cmds, count, infile, outfile, outRed);
 }
 
 /*
- * Executes two commands pipe together
+ * Executes the stages of a pipeline. Every stage is forked directly
+ *    by the shell so each one can be reaped with wait4 and accounted
+ *    for. Input redirection is applied to the first stage and output
+ *    redirection (outRed) to the last.
+ * Returns the exit status of the last stage
  */
-void exec_pipe(char** cmd1, char** cmd2)
+int exec_pipeline(char** cmds[], int count, char* infile, char* outfile, int outRed)
 {
-   log_line("Attempting to execute two piped commands\nAttempting fork()");
-   char buff[256];
+   char buff[INPUT_MAX + 128];
+   int started = 0;
 
-   //fork
-   pid_t pid = fork();
+   //read end of the pipe feeding the next stage
+   int in_fd = -1;
 
-   if(pid < 0)
+   //the stages inherit the exported variables
+   var_sync_env();
+
+   struct cmd_stats** stages = malloc(count * sizeof(struct cmd_stats*));
+   if(stages == NULL || stats_begin_job(count) == -1)
    {
-      log_line("Fork Faild\n");
-      return;
+      fprintf(stderr, "Could not allocate the %d stages of the job\n", count);
+      free(stages);
+      return 1;
    }
-   //if this is the child process
-   if(pid == 0)
+
+   //a job whose limits cannot be applied is not started at all
+   limit_begin_job();
+   if(limit_failed)
    {
-      log_line("Child is saving stdin and stdout descriptors and creating pipe\n");
+      stats_end_job();
+      log_line("Job not started without its limits\n");
+      free(stages);
+      return 1;
+   }
 
-      //create pipe:	pipe[0] is read, pipe[1] is write
-      int pipefd[2];
-      int stdout_fd = dup(STDOUT_FILENO);
-      int stdin_fd = dup(STDIN_FILENO);
+   timeout_begin_job();
+   sched_begin_job(count);
+   profile_begin_job(count);
 
-      if(pipe(pipefd) == -1)
+   int i;
+   for(i = 0; i < count; i++)
+   {
+      //create pipe:	pipe[0] is read, pipe[1] is write
+      int pipefd[2] = { -1, -1 };
+      if(i + 1 < count)
       {
-         log_line("Child could not create pipe\nChild is treminating\n");
-         exit(0);
+         if(pipe(pipefd) == -1)
+         {
+            log_line("Could not create pipe\n");
+            break;
+         }
+         log_line("Created pipe\n");
       }
-      else
-         log_line("Child created pipe\n");
+
+      struct cmd_stats* st = stats_stage(cmds[i][0]);
+
+      snprintf(buff, sizeof(buff), "Attempting fork() for cmd%d\n", i + 1);
+      log_line(buff);
 
       //fork
-      pid_t pid = fork();
+      log_event(EV_FORK_BEGIN, cmds[i][0]);
+      long long fork_start = stats_clock();
+      pid_t pid = spawn_stage(st, cmds[i], i, count, in_fd, pipefd, infile, outfile, outRed);
 
+      //error occurred
       if(pid < 0)
       {
-         log_line("Child fork failed\nChild is terminating\n");
-         exit(0);
-      }
-      //if this is the child process
-      if(pid == 0)
-      {
-         sprintf(buff, "cmd1(PID=%d): Attempting to connect to write end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[0]);
-         //put write end of pipe on stdout of cmd1
-         if(dup2(pipefd[1], STDOUT_FILENO) == -1)
-            sprintf(buff, "cmd1: \"%s\" could not connect the write end of the pipe\n", cmd1[0]);
-         else
-            sprintf(buff, "cmd1: \"%s\" connected to the write end of the pipe\n", cmd1[0]);
+         metrics_count(C_FORK_FAILURES);
+         log_event(EV_FORK_END, cmds[i][0]);
+         log_line("Fork Failed\n");
+         last_job_count--;
 
-         log_line(buff);
+         if(pipefd[0] != -1)
+         {
+            close(pipefd[0]);
+            close(pipefd[1]);
+         }
+         break;
+      }
 
-         sprintf(buff, "cmd1: Attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-         log_line(buff);
+      //parent process
+      metrics_record(H_FORK, stats_clock() - fork_start);
+      metrics_count(C_FORKS);
+      metrics_count(C_COMMANDS);
+      log_event(EV_FORK_END, cmds[i][0]);
 
-         //execute cmd1
-         execvp(cmd1[0], cmd1);
+      st->pid = pid;
+      stages[started++] = st;
+      timeout_spawned(pid);
 
-         sprintf(buff, "cmd1: Could not find a command or program \"%s\"\n", cmd1[0]);
-         log_line(buff);
+      snprintf(buff, sizeof(buff), "Parent process started cmd%d. Child's PID=%d\n", i + 1, pid);
+      log_line(buff);
 
-         log_line("cmd1: Closing write end of pipe and restoring stdout\n");
-         resOut(stdout_fd, pipefd[1]);
+      //the parent keeps neither end of the pipes it hands out
+      if(in_fd != -1)
+         close(in_fd);
+      if(pipefd[1] != -1)
+         close(pipefd[1]);
 
-         log_line("cmd1: Terminating.\n");
-         exit(0);
-      }
-      //if this is the parent process
-      else
-      {
-         sprintf(buff, "cmd2(PID=%d): Attempting to connect to read end of pipe\n", getpid());
-         log_line(buff);
+      in_fd = pipefd[0];
 
-         close(pipefd[1]);
-         //put read end of pipe on stdin of cmd2
-         if(dup2(pipefd[0], STDIN_FILENO) == -1)
-            sprintf(buff, "cmd2: \"%s\" could not connect the read end of the pipe\n", cmd2[0]);
-         else
-            sprintf(buff, "cmd2: \"%s\" connected to the read end of the pipe\n", cmd2[0]);
+      //a profiled job has a relay counting what flows to the next stage
+      if(next_profile && in_fd != -1)
+         in_fd = profile_relay(in_fd);
+   }
 
-         log_line(buff);
+   if(in_fd != -1)
+      close(in_fd);
 
-         sprintf(buff, "cmd2: Attempting to execute \"%s\" with execvp()\n", cmd2[0]);
-         log_line(buff);
+   log_line("Parent process is waiting\n");
 
-         //execute cmd2
-         execvp(cmd2[0], cmd2);
+   timeout_arm();
 
-         sprintf(buff, "cmd2: Could not find a command or program \"%s\"\n", cmd2[0]);
-         log_line(buff);
+   //reap every stage, the job's status is that of the last one
+   int status = event_wait_job(stages, started);
+   status = timeout_end_job(status);
+   limit_end_job();
 
-         log_line("cmd2: Closing read end of pipe and restoring stdin\n");
-         resIn(stdin_fd, pipefd[0]);
+   stats_end_job();
+   profile_end_job(stages, started);
+   free(stages);
 
-         log_line("cmd2: Terminating\n");
-         exit(0);
-      }
-   }
-   //if this is the parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
+   //a pipeline which could not be started completely failed
+   if(started < count)
+      status = 1;
 
-      wait(NULL);
+   log_line("Parent process has finished waiting\n");
 
-      log_line("Parent has finished waiting.\n");
-   }
+   return status;
 }
 
 /*
- * Executes two commands piped together with input redirection
+ * Starts one stage of a pipeline. When the zygote is running it
+ *    spawns the command, with the redirection files opened here and
+ *    passed to it along with the pipes. Builtins always fork from the
+ *    shell since they need its state.
+ * Returns the PID of the stage or -1 if it could not be started
  */
-void exec_pipe_in(char** cmd1, char** cmd2, char* infile)
+pid_t spawn_stage(struct cmd_stats* st, char** cmd, int index, int count, int in_fd, int* pipefd,
+                  char* infile, char* outfile, int outRed)
 {
-   log_line("Attempting to execute two piped commands with <\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
-   {
-      log_line("Fork Failed\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
+   //   A job with a deadline needs its stages in its own process group
+   //and the sched and limit prefixes are applied by the shell's own
+   //children.
+   if(zygote_fd != -1 && timeout_pgid == -1 && !next_sched.set && !next_limits.set &&
+      find_builtin(cmd[0]) < 0)
    {
-      log_line("Child is saving stdin and stdout descriptors and creating pipe\n");
+      //a fork writes out the shell's output first, a zygote's cannot
+      out_flush();
 
-      //create pipe:	pipe[0] is read, pipe[1] is write
-      int pipefd[2];
-      int stdout_fd = dup(STDOUT_FILENO);
-      int stdin_fd = dup(STDIN_FILENO);
+      int stdin_fd = in_fd;
+      int stdout_fd = pipefd[1];
+      int opened_in = 0, opened_out = 0;
 
-      if(pipe(pipefd) == -1)
+      if(index == 0 && infile[0] != '\0')
       {
-         //error occurred
-         log_line("Child could not create pipe\nChild is treminating\n");
-         exit(0);
+         stdin_fd = openIn(infile);
+         if(stdin_fd == -1)
+            return -1;
+         opened_in = 1;
       }
-      else
-         log_line("Child created pipe\n");
 
-      //fork
-      pid_t pid1 = fork();
-
-      //error occurred
-      if(pid1 < 0)
+      if(index == count - 1 && outRed != OUT_NONE)
       {
-         log_line("Child fork failed\nChild terminating\n");
-         exit(0);
+         stdout_fd = openOut(outfile, outRed == OUT_APPEND);
+         if(stdout_fd == -1)
+         {
+            if(opened_in)
+               close(stdin_fd);
+            return -1;
+         }
+         opened_out = 1;
       }
-      //cmd1 process
-      else if(pid1 == 0)
-      {
-         sprintf(buff, "cmd1(PID=%d): Attempting to connect to write end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[0]);   //close unneeded end of pipe
-
-         //connect to pipe
-         if(dup2(pipefd[1], STDOUT_FILENO) == -1)
-            sprintf(buff, "cmd1: \"%s\" could not connect the write end of the pipe\n", cmd1[0]);
-         else
-            sprintf(buff, "cmd1: \"%s\" connected to the write end of the pipe\n", cmd1[0]);
-
-         log_line(buff);
-
-         sprintf(buff, "cmd1: Applying input redirection from %s\n", infile);
-         log_line(buff);
-
-         //input redirection
-         int t1, t2;
-         redirIn(infile, &t1, &t2);
-
-         sprintf(buff, "cmd1: Attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-         log_line(buff);
 
-         //execute cmd1
-         execvp(cmd1[0], cmd1);
+      pid_t pid = zygote_spawn(cmd, index, count, stdin_fd, stdout_fd);
 
-         sprintf(buff, "cmd1: Could not find a command or program \"%s\"\n", cmd1[0]);
-         log_line(buff);
-
-         log_line("cmd1: Restoring stdin\n");
-         //restore input redirection
-         resIn(t1, t2);
-
-         log_line("cmd1: Closing write end of pipe and restoring stdout\n");
-         resOut(stdout_fd, pipefd[1]);
+      //the zygote has its own copies of the files now
+      if(opened_in)
+         close(stdin_fd);
+      if(opened_out)
+         close(stdout_fd);
 
-         log_line("cmd1: Terminating\n");
-         exit(0);   //terminate cmd1
-      }
-      //cmd2 process
-      else
+      //fall back to forking directly if the zygote has gone away or
+      //the request was too large to send to it
+      if(zygote_fd != -1 && pid > 0)
       {
-         sprintf(buff, "cmd2(PID=%d): Attempting to connect to read end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[1]);   //close unneeded end of pipe
-
-         //connect to pipe
-         if(dup2(pipefd[0], STDIN_FILENO) == -1)
-            sprintf(buff, "cmd2: \"%s\" could not connect the read end of the pipe\n", cmd2[0]);
-         else
-            sprintf(buff, "cmd2: \"%s\" connected to the read end of the pipe\n", cmd2[0]);
-
-         log_line(buff);
-
-         sprintf(buff, "cmd2: Attempting to execute \"%s\" with execvp()\n", cmd2[0]);
-         log_line(buff);
-
-         //execute cmd2
-         execvp(cmd2[0], cmd2);
-
-         sprintf(buff, "cmd2: Could not find a command or program \"%s\"\n", cmd2[0]);
-         log_line(buff);
-
-         log_line("cmd2: Closing read end of pipe and restoring stdin\n");
-         //close pipe and restore stdin
-         resIn(stdin_fd, pipefd[0]);
-
-         log_line("cmd2: Terminating\n");
-         exit(0);   //terminate cmd2
+         st->zygote = 1;
+         return pid;
       }
    }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
 
-      wait(NULL);
+   //the child's lines follow the shell's batched ones
+   log_flush();
 
-      log_line("Parent has finished waiting\n");
+   //fork
+   pid_t pid = fork();
+
+   //child process
+   if(pid == 0)
+   {
+      timeout_child();
+      sched_child(index);
+      limit_child();
+      exec_stage(cmd, index, count, in_fd, pipefd, infile, outfile, outRed);
    }
+
+   return pid;
 }
 
 /*
- * Executes two commands piped together with output redirection (append)
- *    and possibly input redirection
+ * Connects a child to its neighbouring pipes, applies the requested
+ *    redirections and executes the command. Never returns.
  */
-void exec_pipe_opt_in_append(char** cmd1, char** cmd2, char* infile, char* outfile)
+void exec_stage(char** cmd, int index, int count, int in_fd, int* pipefd,
+                char* infile, char* outfile, int outRed)
 {
-   log_line("Attempting to execute two pipe commands with >> and possibly <\nAttempting fork()");
-   char buff[256];
+   char buff[INPUT_MAX + 128];
 
-   //fork
-   pid_t pid = fork();
+   event_child_signals();
 
-   //error occurred
-   if(pid < 0)
-   {
-      log_line("Fork Failed\n");
-      return;
-   }
-   //child process
-   else if(pid == 0)
+   //put read end of the previous pipe on stdin
+   if(in_fd != -1)
    {
-      log_line("Child is saving stdin and stdout descriptors and creating pipe\n");
-
-      //create pipe:	pipe[0] is read, pipe[1] is write
-      int pipefd[2];
-      int stdout_fd = dup(STDOUT_FILENO);
-      int stdin_fd = dup(STDIN_FILENO);
-
-      //create pipe
-      if(pipe(pipefd) == -1)
-      {
-         log_line("Child could not create pipe\nChild is terminating\n");
-         exit(0);
-      }
+      if(dup2(in_fd, STDIN_FILENO) == -1)
+         snprintf(buff, sizeof(buff), "cmd%d: \"%s\" could not connect the read end of the pipe\n", index + 1, cmd[0]);
       else
-         log_line("Child created pipe\n");
+         snprintf(buff, sizeof(buff), "cmd%d: \"%s\" connected to the read end of the pipe\n", index + 1, cmd[0]);
 
-      //fork
-      pid_t pid1 = fork();
-
-      //error occurred
-      if(pid1 < 0)
-      {
-         log_line("Child fork failed\nChild terminating\n");
-         exit(0);
-      }
-      //cmd1 process
-      else if(pid1 == 0)
-      {
-         sprintf(buff, "cmd1(PID=%d): Attempting to connect to write end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[0]);   //close unneeded end of pipe
+      log_line(buff);
+      log_event(EV_DUP2, buff);
+      close(in_fd);
+   }
 
-         //connect to pipe
-         if(dup2(pipefd[1], STDOUT_FILENO) == -1)
-            sprintf(buff, "cmd1: \"%s\" could not connect the write end of the pipe\n", cmd1[0]);
-         else
-            sprintf(buff, "cmd1: \"%s\" connected to the write end of the pipe\n", cmd1[0]);
+   //put write end of the next pipe on stdout
+   if(pipefd[1] != -1)
+   {
+      close(pipefd[0]);   //close unneeded end of pipe
 
-         log_line(buff);
+      if(dup2(pipefd[1], STDOUT_FILENO) == -1)
+         snprintf(buff, sizeof(buff), "cmd%d: \"%s\" could not connect the write end of the pipe\n", index + 1, cmd[0]);
+      else
+         snprintf(buff, sizeof(buff), "cmd%d: \"%s\" connected to the write end of the pipe\n", index + 1, cmd[0]);
 
-         int t1, t2;
-         if(infile[0] != '\0')
-         {
-            sprintf(buff, "cmd1: Applying input redirection from %s\n", infile);
-            log_line(buff);
+      log_line(buff);
+      log_event(EV_DUP2, buff);
+      close(pipefd[1]);
+   }
 
-            //apply input redirection
-            redirIn(infile, &t1, &t2);
-         }
+   int saved_fd, file_fd;
+   if(index == 0 && infile[0] != '\0')
+   {
+      snprintf(buff, sizeof(buff), "cmd%d: Applying input redirection from %s\n", index + 1, infile);
+      log_line(buff);
 
-         sprintf(buff, "cmd1: Attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-         log_line(buff);
+      //input redirection
+      if(redirIn(infile, &saved_fd, &file_fd) == -1)
+         exit(1);
+      log_event(EV_DUP2, buff);
 
-         //execute cmd1
-         execvp(cmd1[0], cmd1);
+      //the command only needs the redirected stdin
+      close(saved_fd);
+      close(file_fd);
+   }
 
-         sprintf(buff, "cmd1: Could not find a command or program \"%s\"\n", cmd1[0]);
+   if(index == count - 1 && outRed != OUT_NONE)
+   {
+      int success;
+      if(outRed == OUT_APPEND)
+      {
+         snprintf(buff, sizeof(buff), "cmd%d: Applying output redirection (append) to %s\n", index + 1, outfile);
          log_line(buff);
 
-         if(infile[0] != '\0')
-         {
-            log_line("cmd1: Restoring stdin\n");
-            //restore input redirection
-            resIn(t1, t2);
-         }
-
-         log_line("cmd1: Closing write end of pipe and restoring stdout\n");
-         //close pipe and restore stdout
-         resOut(stdout_fd, pipefd[1]);
-
-         log_line("cmd1: Terminating\n");
-         exit(0);   //terminate cmd1
+         //output redirection (append)
+         success = redirOutAppend(outfile, &saved_fd, &file_fd);
       }
-      //cmd2 process
       else
       {
-         sprintf(buff, "cmd2(PID=%d): Attempting to connect to read end of pipe\n", getpid());
+         snprintf(buff, sizeof(buff), "cmd%d: Applying output redirection (overwrite) to %s\n", index + 1, outfile);
          log_line(buff);
 
-         close(pipefd[1]);   //close unneeded end of pipe
+         //output redirection (overwrite)
+         success = redirOut(outfile, &saved_fd, &file_fd);
+      }
 
-         //connect to pipe
-         if(dup2(pipefd[0], STDIN_FILENO) == -1)
-            sprintf(buff, "cmd2: \"%s\" could not connect the read end of the pipe\n", cmd2[0]);
-         else
-            sprintf(buff, "cmd2: \"%s\" connected to the read end of the pipe\n", cmd2[0]);
+      if(success == -1)
+         exit(1);
+      log_event(EV_DUP2, buff);
 
-         log_line(buff);
+      close(saved_fd);
+      close(file_fd);
+   }
 
-         sprintf(buff, "cmd2: Applying output redirection (append) to %s\n", outfile);
-         log_line(buff);
+   //a parallel stage coordinates its workers from this child
+   if(strcmp(cmd[0], "parallel") == 0)
+      exit(parallel_stage(cmd));
 
-         //output redirection (append)
-         int t1, t2;
-         redirOutAppend(outfile, &t1, &t2);
-
-         sprintf(buff, "cmd2: Attempting to execute \"%s\" with execvp()\n", cmd2[0]);
-         log_line(buff);
+   //builtins in a pipe run in the child, which must not share the
+   //shell's zygote
+   int builtin = find_builtin(cmd[0]);
+   if(builtin >= 0)
+   {
+      zygote_fd = -1;
+      exit(call_builtin(builtin, cmd));
+   }
 
-         //execute cmd2
-         execvp(cmd2[0], cmd2);
+   snprintf(buff, sizeof(buff), "cmd%d(PID=%d): Attempting to execute \"%s\" with execv()\n", index + 1, getpid(), cmd[0]);
+   log_line(buff);
 
-         sprintf(buff, "cmd2: Could not find a command or program \"%s\"\n", cmd2[0]);
-         log_line(buff);
+   //search PATH here so the lookup can be timed separately from exec
+   char path[PATH_MAX];
+   long long lookup_start = stats_clock();
+   int found = find_command(cmd[0], path, sizeof(path));
+   metrics_record(H_LOOKUP, stats_clock() - lookup_start);
 
-         log_line("cmd2: Restoring stdout\n");
-         //restore output redirection
-         resOut(t1, t2);
+   //execute the command, the path is already resolved
+   log_event(EV_EXEC, cmd[0]);
+   if(found)
+      execv(path, cmd);
+   else
+      metrics_count(C_LOOKUP_MISSES);
 
-         log_line("cmd2: Closing read end of pipe and restoring stdin\n");
-         //close pipe and restore stdin
-         resIn(stdin_fd, pipefd[0]);
+   int err = exec_errno(path, errno);
+   metrics_count(C_EXEC_FAILURES);
+   log_event(EV_EXEC_FAIL, cmd[0]);
 
-         log_line("cmd2: Terminating\n");
-         exit(0);   //terminate cmd2
-      }
-   }
-   //parent process
-   else
+   //a command which was found but could not be executed is 126
+   if(found)
    {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
+      fprintf(stderr, "%s: %s\n", cmd[0], strerror(err));
+      snprintf(buff, sizeof(buff), "cmd%d: Could not execute \"%s\"\n", index + 1, cmd[0]);
       log_line(buff);
+      log_line("Child is terminating\n");
+      exit(126);
+   }
 
-      wait(NULL);
+   fprintf(stderr, "%s: command not found\n", cmd[0]);
+   snprintf(buff, sizeof(buff), "cmd%d: Could not find a command or program \"%s\"\n", index + 1, cmd[0]);
+   log_line(buff);
 
-      log_line("Parent is finished waiting\n");
-   }
+   log_line("Child is terminating\n");
+   exit(127);   //terminate child process
 }
 
 /*
- * Executes two commands piped together with output redirection (overwrite)
- *    and possibly input redirection
+ * Searches the directories in PATH for an executable file named name,
+ *    skipping directories. Names containing a '/' are used as they
+ *    are if they exist, so exec can say why one cannot be run.
+ * Returns 1 and stores the full path in path if the command was found
+ *         0 if it was not
  */
-void exec_pipe_opt_in_write(char** cmd1, char** cmd2, char* infile, char* outfile)
+int find_command(char* name, char* path, int size)
 {
-   log_line("Attempting to executed two piped commands with > and possibly <\nAttempting fork()\n");
-   char buff[256];
-
-   //fork
-   pid_t pid = fork();
-
-   //error occurred
-   if(pid < 0)
+   struct stat sb;
+   if(strchr(name, '/') != NULL)
    {
-      log_line("Fork failed\n");
-      return;
+      snprintf(path, size, "%s", name);
+      return stat(path, &sb) == 0;
    }
-   //child process
-   else if(pid == 0)
-   {
-      log_line("Child is saving stdin and stdout descriptors and creating pipe\n");
-
-      //create pipe:	pipe[0] is read, pipe[1] is write
-      int pipefd[2];
-      int stdout_fd = dup(STDOUT_FILENO);
-      int stdin_fd = dup(STDIN_FILENO);
-
-      //create pipe
-      if(pipe(pipefd) == -1)
-      {
-         log_line("Child could not create pipe\nChild is terminating\n");
-         exit(0);
-      }
-      else
-         log_line("Child created pipe\n");
-
-      //fork
-      pid_t pid1 = fork();
-
-      //error occurred
-      if(pid1 < 0)
-      {
-         log_line("Child fork failed\nChild terminating\n");
-         exit(0);
-      }
-      //cmd1 process
-      else if(pid1 == 0)
-      {
-         sprintf(buff, "cmd1(PID=%d): Attempting to connect to write end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[0]);   //close unneeded end of pipe
 
-         //connect to pipe
-         if(dup2(pipefd[1], STDOUT_FILENO) == -1)
-            sprintf(buff, "cmd1: \"%s\" could not connect the write end of the pipe\n", cmd1[0]);
-         else
-            sprintf(buff, "cmd1: \"%s\" connected to the write end of the pipe\n", cmd1[0]);
+   char* dirs = getenv("PATH");
+   if(dirs == NULL)
+      dirs = "/bin:/usr/bin";
 
-         log_line(buff);
-
-         int t1, t2;
-         if(infile[0] != '\0')
-         {
-            sprintf(buff, "cmd1: Applying input redirection from %s\n", infile);
-            log_line(buff);
-
-            //input redirection
-            redirIn(infile, &t1, &t2);
-         }
-
-         sprintf(buff, "cmd1: Attempting to execute \"%s\" with execvp()\n", cmd1[0]);
-         log_line(buff);
-
-         //execute cmd1
-         execvp(cmd1[0], cmd1);
-
-         sprintf(buff, "cmd2: Could not find a command or program \"%s\"\n", cmd2[0]);
-         log_line(buff);
-
-         if(infile[0] != '\0')
-         {
-            log_line("cmd1: Restoring stdin\n");
-            //restore input redirection
-            resIn(t1, t2);
-         }
-
-         log_line("cmd1: Closing write end of pipe and restoring stdout\n");
-         //close pipe and restore stdout
-         resOut(stdout_fd, pipefd[1]);
+   while(1)
+   {
+      //an empty entry means the current directory
+      char* end = strchr(dirs, ':');
+      int len = (end != NULL) ? end - dirs : (int)strlen(dirs);
 
-         log_line("cmd1: Terminating\n");
-         exit(0);   //terminate cmd1
-      }
-      //cmd2 process
+      if(len == 0)
+         snprintf(path, size, "%s", name);
       else
-      {
-         sprintf(buff, "cmd2(PID=%d): Attempting to connect to read end of pipe\n", getpid());
-         log_line(buff);
-
-         close(pipefd[1]);   //close unneeded end of pipe
+         snprintf(path, size, "%.*s/%s", len, dirs, name);
 
-         //connect to pipe
-         if(dup2(pipefd[0], STDIN_FILENO) == -1)
-            sprintf(buff, "cmd2: \"%s\" could not connect the read end of the pipe\n", cmd2[0]);
-         else
-            sprintf(buff, "cmd2: \"%s\" connected to the read end of the pipe\n", cmd2[0]);
+      if(stat(path, &sb) == 0 && S_ISREG(sb.st_mode) && access(path, X_OK) == 0)
+         return 1;
 
-         log_line(buff);
-
-         sprintf(buff, "cmd2: Applying output redirection (overwrite) to %s\n", outfile);
-         log_line(buff);
-
-         //output redirection (overwrite)
-         int t1, t2;
-         redirOut(outfile, &t1, &t2);
-
-         sprintf(buff, "cmd2: Attempting to execute \"%s\" with execvp()\n", cmd2[0]);
-         log_line(buff);
-
-         //execute cmd2
-         execvp(cmd2[0], cmd2);
-
-         sprintf(buff, "cmd2: Could not find a command or program \"%s\"\n", cmd2[0]);
-         log_line(buff);
-
-         log_line("cmd2: Restoring stdout\n");
-         //restore output redirection
-         resOut(t1, t2);
-
-         log_line("cmd2: Closing read end of pipe and restoring stdin\n");
-         //close pipe and restore stdin
-         resIn(stdin_fd, pipefd[0]);
-
-         log_line("cmd2: Terminating\n");
-         exit(0);   //terminate cmd2
-      }
+      if(end == NULL)
+         break;
+      dirs = end + 1;
    }
-   //parent process
-   else
-   {
-      sprintf(buff, "Parent process is waiting. Child's PID=%d\n", pid);
-      log_line(buff);
 
-      wait(NULL);
+   return 0;
+}
 
-      log_line("Parent is finished waiting\n");
-   }
+/*
+ * Returns the reason exec failed for a path, EISDIR for a directory
+ *    which exec only reports as EACCES
+ */
+int exec_errno(char* path, int err)
+{
+   struct stat sb;
+   if(err == EACCES && stat(path, &sb) == 0 && S_ISDIR(sb.st_mode))
+      return EISDIR;
+
+   return err;
 }
+
+#endif //EXECUTE_C
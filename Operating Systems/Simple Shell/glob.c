@@ -0,0 +1,456 @@
+/*
+ * File:   glob.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Filename expansion of the words of a command holding *, ?
+ *            or [...]. Each component of a pattern is matched against
+ *            a listing of its directory read with getdents64, whose
+ *            d_type says which entries are directories without a stat
+ *            per entry. A word which matches nothing is left as it is
+ *            and * does not match a leading dot.
+ *
+ *            Listings are cached for a few seconds and dropped as soon
+ *            as the directory's mtime changes, so a script globbing the
+ *            same large directory over and over reads it once. A
+ *            directory changed just before it was read is not cached
+ *            since a change in the same mtime tick could go unseen.
+ *
+ *            The expanded argv is allocated for the command and grows
+ *            as needed, the matches are kept until it is released.
+ */
+
+#ifndef GLOB_C
+#define GLOB_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "stats.c"
+
+//directories whose listings are kept and for how long
+#define GLOB_CACHE 32
+#define GLOB_CACHE_TTL (5 * 1000000000LL)
+
+//a listing taken this soon after the directory changed is not kept
+#define GLOB_RACY (20 * 1000000LL)
+
+//an entry as returned by getdents64
+struct glob_dirent64
+{
+   unsigned long long d_ino;
+   long long d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[];
+};
+
+//the names in a directory, one after another with their types
+struct glob_listing
+{
+   char* path;             //NULL when the entry is free
+   long long mtime;        //of the directory, in nanoseconds
+   dev_t dev;
+   ino_t ino;
+   long long taken;        //when it was read, CLOCK_MONOTONIC
+   char* names;            //nul terminated names back to back
+   unsigned char* types;   //d_type of each name
+   int count;
+   long long used;         //for evicting the oldest
+};
+
+struct glob_listing glob_cache[GLOB_CACHE];
+long long glob_tick = 0;
+
+//matched strings owned by the command whose argv holds them
+struct glob_strings
+{
+   char** strings;
+   int count;
+   int size;
+};
+
+//the pathnames matched by the word being expanded
+struct glob_matches
+{
+   char** paths;
+   int count;
+   int size;
+};
+
+//returns 1 if a word has glob characters, a [ only with a ] after it
+//so the [ builtin is not looked for in the directory
+int glob_has_magic(const char* word)
+{
+   if(strpbrk(word, "*?") != NULL)
+      return 1;
+
+   const char* open = strchr(word, '[');
+   return open != NULL && strchr(open + 1, ']') != NULL;
+}
+
+//frees a cached listing
+void glob_drop(struct glob_listing* listing)
+{
+   free(listing->path);
+   free(listing->names);
+   free(listing->types);
+   memset(listing, 0, sizeof(*listing));
+}
+
+/*
+ * Reads a directory with getdents64 into a listing
+ * Returns 0 or -1 if it could not be read
+ */
+int glob_read_dir(const char* path, struct glob_listing* listing)
+{
+   int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if(fd == -1)
+      return -1;
+
+   int size = 4096, used = 0;
+   int types_size = 64;
+   listing->names = malloc(size);
+   listing->types = malloc(types_size);
+   listing->count = 0;
+
+   char buff[32768];
+   int n;
+   while(listing->names != NULL && listing->types != NULL &&
+         (n = syscall(SYS_getdents64, fd, buff, sizeof(buff))) > 0)
+   {
+      int pos = 0;
+      while(pos < n)
+      {
+         struct glob_dirent64* d = (struct glob_dirent64*)(buff + pos);
+         pos += d->d_reclen;
+
+         if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+
+         int len = strlen(d->d_name) + 1;
+         if(used + len > size)
+         {
+            while(used + len > size)
+               size *= 2;
+            char* grown = realloc(listing->names, size);
+            if(grown == NULL)
+               break;
+            listing->names = grown;
+         }
+         if(listing->count == types_size)
+         {
+            types_size *= 2;
+            unsigned char* grown = realloc(listing->types, types_size);
+            if(grown == NULL)
+               break;
+            listing->types = grown;
+         }
+
+         memcpy(listing->names + used, d->d_name, len);
+         used += len;
+         listing->types[listing->count++] = d->d_type;
+      }
+   }
+
+   close(fd);
+
+   if(listing->names == NULL || listing->types == NULL)
+   {
+      free(listing->names);
+      free(listing->types);
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Returns the listing of a directory, from the cache when it is still
+ *    current. A listing which cannot be kept is returned in temp.
+ */
+struct glob_listing* glob_listing(const char* path, struct glob_listing* temp)
+{
+   struct stat sb;
+   if(stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode))
+      return NULL;
+
+   long long mtime = (long long)sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+   long long now = stats_clock();
+
+   int i;
+   struct glob_listing* slot = &glob_cache[0];
+   for(i = 0; i < GLOB_CACHE; i++)
+   {
+      struct glob_listing* listing = &glob_cache[i];
+      if(listing->path != NULL && strcmp(listing->path, path) == 0)
+      {
+         if(listing->mtime == mtime && listing->dev == sb.st_dev &&
+            listing->ino == sb.st_ino && now - listing->taken < GLOB_CACHE_TTL)
+         {
+            listing->used = ++glob_tick;
+            return listing;
+         }
+
+         glob_drop(listing);
+         slot = listing;
+         break;
+      }
+
+      //otherwise replace a free entry or the least recently used one
+      if(slot->path != NULL && (listing->path == NULL || listing->used < slot->used))
+         slot = listing;
+   }
+
+   struct timespec wall;
+   clock_gettime(CLOCK_REALTIME, &wall);
+   long long read_at = (long long)wall.tv_sec * 1000000000LL + wall.tv_nsec;
+
+   //a directory changed in the last moment may change again unseen
+   int keep = (read_at - mtime > GLOB_RACY);
+
+   struct glob_listing* listing = keep ? slot : temp;
+   if(keep)
+      glob_drop(listing);
+   memset(listing, 0, sizeof(*listing));
+
+   if(glob_read_dir(path, listing) == -1)
+      return NULL;
+
+   if(keep)
+   {
+      listing->path = strdup(path);
+      listing->mtime = mtime;
+      listing->dev = sb.st_dev;
+      listing->ino = sb.st_ino;
+      listing->taken = now;
+      listing->used = ++glob_tick;
+   }
+
+   return listing;
+}
+
+//adds a pathname to the matches
+void glob_add(struct glob_matches* m, const char* path)
+{
+   if(m->count == m->size)
+   {
+      int size = (m->size > 0) ? m->size * 2 : 16;
+      char** grown = realloc(m->paths, size * sizeof(char*));
+      if(grown == NULL)
+         return;
+      m->paths = grown;
+      m->size = size;
+   }
+
+   char* copy = strdup(path);
+   if(copy != NULL)
+      m->paths[m->count++] = copy;
+}
+
+/*
+ * Matches the rest of a pattern, one component at a time, below the
+ *    directory prefix (which ends with / unless it is empty)
+ */
+void glob_walk(char* prefix, const char* pattern, struct glob_matches* m)
+{
+   //the next component, and whether more follow it
+   const char* slash = strchr(pattern, '/');
+   int len = (slash != NULL) ? slash - pattern : (int)strlen(pattern);
+   const char* rest = (slash != NULL) ? slash + 1 : NULL;
+
+   char component[NAME_MAX + 1];
+   if(len > NAME_MAX)
+      return;
+   memcpy(component, pattern, len);
+   component[len] = '\0';
+
+   int base = strlen(prefix);
+   char path[PATH_MAX];
+
+   //a plain component is added to the path without reading anything
+   if(!glob_has_magic(component))
+   {
+      if(base + len + 2 > PATH_MAX)
+         return;
+      snprintf(path, sizeof(path), "%s%s%s", prefix, component, rest != NULL ? "/" : "");
+
+      if(rest != NULL && rest[0] != '\0')
+         glob_walk(path, rest, m);
+      else if(access(path, F_OK) == 0)
+         glob_add(m, path);
+      return;
+   }
+
+   struct glob_listing temp;
+   struct glob_listing* listing = glob_listing(base > 0 ? prefix : ".", &temp);
+   if(listing == NULL)
+      return;
+
+   //directories to descend into once the listing is no longer needed,
+   //since reading them may evict it from the cache
+   struct glob_matches dirs = { NULL, 0, 0 };
+
+   char* name = listing->names;
+   int i;
+   for(i = 0; i < listing->count; i++, name += strlen(name) + 1)
+   {
+      if(fnmatch(component, name, FNM_PERIOD) != 0)
+         continue;
+      if(base + strlen(name) + 2 > PATH_MAX)
+         continue;
+
+      snprintf(path, sizeof(path), "%s%s", prefix, name);
+
+      if(rest == NULL)
+      {
+         glob_add(m, path);
+         continue;
+      }
+
+      //only directories can match the components which follow, d_type
+      //says which entries are without a stat unless the filesystem
+      //does not fill it in or the entry is a link
+      unsigned char type = listing->types[i];
+      struct stat sb;
+      if(type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN)
+         continue;
+      if(type != DT_DIR && (stat(path, &sb) == -1 || !S_ISDIR(sb.st_mode)))
+         continue;
+
+      strcat(path, "/");
+      glob_add(&dirs, path);
+   }
+
+   if(listing == &temp)
+   {
+      free(temp.names);
+      free(temp.types);
+   }
+
+   for(i = 0; i < dirs.count; i++)
+   {
+      if(rest[0] == '\0')
+         glob_add(m, dirs.paths[i]);
+      else
+         glob_walk(dirs.paths[i], rest, m);
+      free(dirs.paths[i]);
+   }
+   free(dirs.paths);
+}
+
+//orders matches like ls
+int glob_compare(const void* a, const void* b)
+{
+   return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+//keeps a matched string until the argv holding it is released
+void glob_own(struct glob_strings* owned, char* text)
+{
+   if(owned->count == owned->size)
+   {
+      int size = (owned->size > 0) ? owned->size * 2 : 64;
+      char** grown = realloc(owned->strings, size * sizeof(char*));
+      if(grown == NULL)
+         return;
+      owned->strings = grown;
+      owned->size = size;
+   }
+
+   owned->strings[owned->count++] = text;
+}
+
+/*
+ * Expands the glob patterns among the words of a command, adding the
+ *    matches to owned.
+ * Returns cmd itself when nothing was expanded, otherwise a new argv
+ *    which has grown to hold every match and must be freed
+ */
+char** glob_command(char** cmd, struct glob_strings* owned)
+{
+   int i;
+   int magic = 0;
+   for(i = 0; cmd[i] != NULL; i++)
+      magic |= glob_has_magic(cmd[i]);
+   if(!magic)
+      return cmd;
+
+   int size = i + 1, argc = 0;
+   char** argv = malloc(size * sizeof(char*));
+   if(argv == NULL)
+      return cmd;
+
+   for(i = 0; cmd[i] != NULL; i++)
+   {
+      struct glob_matches m = { NULL, 0, 0 };
+      if(glob_has_magic(cmd[i]))
+      {
+         if(cmd[i][0] == '/')
+            glob_walk("/", cmd[i] + 1, &m);
+         else
+            glob_walk("", cmd[i], &m);
+      }
+
+      //the word itself when there are no matches
+      int count = (m.count > 0) ? m.count : 1;
+      if(argc + count + 1 > size)
+      {
+         while(argc + count + 1 > size)
+            size *= 2;
+         char** grown = realloc(argv, size * sizeof(char*));
+         if(grown == NULL)
+         {
+            int j;
+            for(j = 0; j < m.count; j++)
+               free(m.paths[j]);
+            free(m.paths);
+            break;
+         }
+         argv = grown;
+      }
+
+      if(m.count == 0)
+         argv[argc++] = cmd[i];
+      else
+      {
+         qsort(m.paths, m.count, sizeof(char*), glob_compare);
+
+         int j;
+         for(j = 0; j < m.count; j++)
+         {
+            glob_own(owned, m.paths[j]);
+            argv[argc++] = m.paths[j];
+         }
+      }
+      free(m.paths);
+   }
+   argv[argc] = NULL;
+
+   return argv;
+}
+
+/*
+ * Frees the matches of the argvs a command was expanded into
+ */
+void glob_release(struct glob_strings* owned)
+{
+   int i;
+   for(i = 0; i < owned->count; i++)
+      free(owned->strings[i]);
+   free(owned->strings);
+
+   owned->strings = NULL;
+   owned->count = 0;
+   owned->size = 0;
+}
+
+#endif //GLOB_C
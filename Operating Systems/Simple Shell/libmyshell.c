@@ -0,0 +1,399 @@
+/*
+ * File:   libmyshell.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Implements the library interface in myshell.h. Unlike the
+ *            shell, which keeps its state in globals, everything here
+ *            lives in the command and job passed in, so the library
+ *            is safe to use from many threads. Lines are parsed by the
+ *            shell's own parse_command, without its variables. Stages
+ *            are started with posix_spawnp so a large caller does not
+ *            pay for copying its page tables the way fork would.
+ */
+
+//pipe2
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "myshell.h"
+
+#define PARSE_NO_VARS
+#include "parse.c"
+
+extern char** environ;
+
+struct myshell_cmd
+{
+   char* text;                         //copy of the line the words point into
+   char** words;                       //the first stage, then the others
+   int count;
+   char** argv[MYSHELL_MAX_STAGES];
+   char* files;                        //room for both file names
+   char* infile;                       //NULL without <
+   char* outfile;                      //NULL without > or >>
+   int append;
+};
+
+//returns the monotonic clock in nanoseconds
+static long long lib_clock(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//stores a parse error for the caller
+static myshell_cmd* parse_error(myshell_cmd* cmd, char* err, size_t err_size, const char* msg)
+{
+   if(err != NULL && err_size > 0)
+      snprintf(err, err_size, "%s", msg);
+
+   myshell_free(cmd);
+   return NULL;
+}
+
+/*
+ * Parses a line into a command with parse_command, which splits it
+ *    the same way as the shell does.
+ * Returns the command or NULL if the line is not a valid pipeline
+ */
+myshell_cmd* myshell_parse(const char* line, char* err, size_t err_size)
+{
+   myshell_cmd* cmd = calloc(1, sizeof(myshell_cmd));
+   if(cmd == NULL)
+      return parse_error(NULL, err, err_size, "out of memory");
+
+   int len = strlen(line);
+   cmd->text = malloc(len + 1);
+
+   //   Each word takes a slot and so does the NULL ending each stage,
+   //which replaces its |. The stages after the first get their own
+   //half.
+   int half = len / 2 + 2;
+   cmd->words = malloc(2 * half * sizeof(char*));
+   cmd->files = malloc(2 * (len + 1));
+   if(cmd->text == NULL || cmd->words == NULL || cmd->files == NULL)
+      return parse_error(cmd, err, err_size, "out of memory");
+   memcpy(cmd->text, line, len + 1);
+
+   char* infile = cmd->files;
+   char* outfile = cmd->files + len + 1;
+   infile[0] = '\0';
+   outfile[0] = '\0';
+
+   int ret = parse_command(cmd->text, cmd->words, cmd->words + half, &cmd->count, infile, outfile, len + 1);
+   if(ret == -1)
+      return parse_error(cmd, err, err_size, "missing file name after redirection");
+   if(ret == 0)
+      return parse_error(cmd, err, err_size, "quit is not a command");
+   if(cmd->count > MYSHELL_MAX_STAGES)
+      return parse_error(cmd, err, err_size, "too many stages");
+
+   //each later stage starts after the NULL ending the one before it
+   char** next = cmd->words + half;
+   int i;
+   cmd->argv[0] = cmd->words;
+   for(i = 1; i < cmd->count; i++)
+   {
+      cmd->argv[i] = next;
+      while(*next != NULL)
+         next++;
+      next++;
+   }
+
+   for(i = 0; i < cmd->count; i++)
+   {
+      if(cmd->argv[i][0] != NULL)
+         continue;
+
+      if(cmd->count == 1)
+         return parse_error(cmd, err, err_size, "empty command");
+      return parse_error(cmd, err, err_size, (i < cmd->count - 1) ? "missing command before |" :
+                                                                     "missing command after |");
+   }
+
+   if(infile[0] != '\0')
+      cmd->infile = infile;
+   if(outfile[0] != '\0')
+   {
+      cmd->outfile = outfile;
+      cmd->append = (ret == 3 || ret == 7);
+   }
+
+   return cmd;
+}
+
+//returns the number of stages in a command
+int myshell_stage_count(const myshell_cmd* cmd)
+{
+   return cmd->count;
+}
+
+//returns the argument vector of a stage
+char* const* myshell_stage_argv(const myshell_cmd* cmd, int index)
+{
+   if(index < 0 || index >= cmd->count)
+      return NULL;
+
+   return cmd->argv[index];
+}
+
+//frees a command returned by myshell_parse
+void myshell_free(myshell_cmd* cmd)
+{
+   if(cmd == NULL)
+      return;
+
+   free(cmd->text);
+   free(cmd->words);
+   free(cmd->files);
+   free(cmd);
+}
+
+/*
+ * Starts one stage with its standard descriptors replaced by the
+ *    given ones (-1 keeps the caller's).
+ * Returns 0 or an errno value
+ */
+static int spawn_stage(char* const* argv, int in_fd, int out_fd, int err_fd, pid_t* pid)
+{
+   posix_spawn_file_actions_t actions;
+   posix_spawnattr_t attr;
+   int fds[3] = { in_fd, out_fd, err_fd };
+
+   posix_spawn_file_actions_init(&actions);
+   posix_spawnattr_init(&attr);
+
+   //a descriptor already in place is simply inherited
+   int i;
+   for(i = 0; i < 3; i++)
+      if(fds[i] != -1 && fds[i] != i)
+         posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+
+   //the caller may ignore SIGPIPE or block signals, the command should not
+   sigset_t mask, defaults;
+   sigemptyset(&mask);
+   sigemptyset(&defaults);
+   sigaddset(&defaults, SIGPIPE);
+   posix_spawnattr_setsigmask(&attr, &mask);
+   posix_spawnattr_setsigdefault(&attr, &defaults);
+   posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+   int err = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+
+   posix_spawn_file_actions_destroy(&actions);
+   posix_spawnattr_destroy(&attr);
+
+   return err;
+}
+
+/*
+ * Starts every stage of a command connected by pipes. A stage which
+ *    cannot be started gets status 127 (1 for a redirection which
+ *    fails) like in the shell, and the rest of the pipeline still runs.
+ * Returns 0 or -1 with errno set if a stage could not be started
+ */
+int myshell_spawn(const myshell_cmd* cmd, int in_fd, int out_fd, int err_fd, struct myshell_job* job)
+{
+   int failed = 0;
+
+   memset(job, 0, sizeof(*job));
+   job->count = cmd->count;
+   job->status = 1;
+   job->start = lib_clock();
+
+   int i;
+   for(i = 0; i < cmd->count; i++)
+   {
+      job->stages[i].pid = -1;
+      job->stages[i].status = 1;
+   }
+
+   //read end of the pipe feeding the next stage
+   int prev = -1;
+
+   for(i = 0; i < cmd->count; i++)
+   {
+      struct myshell_stage* st = &job->stages[i];
+
+      int stdin_fd = (i == 0) ? in_fd : prev;
+      int stdout_fd = (i == cmd->count - 1) ? out_fd : -1;
+      int opened_in = -1, opened_out = -1;
+
+      //descriptors are close-on-exec so spawns in other threads never
+      //inherit another pipeline's pipes
+      int pipefd[2] = { -1, -1 };
+      if(i + 1 < cmd->count)
+      {
+         if(pipe2(pipefd, O_CLOEXEC) == -1)
+         {
+            failed = errno;
+            break;
+         }
+         stdout_fd = pipefd[1];
+      }
+
+      int err = 0;
+      if(i == 0 && cmd->infile != NULL)
+      {
+         opened_in = open(cmd->infile, O_RDONLY | O_CLOEXEC);
+         if(opened_in == -1)
+            err = errno;
+         stdin_fd = opened_in;
+      }
+      if(err == 0 && i == cmd->count - 1 && cmd->outfile != NULL)
+      {
+         int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (cmd->append ? O_APPEND : O_TRUNC);
+         opened_out = open(cmd->outfile, flags, 0644);
+         if(opened_out == -1)
+            err = errno;
+         stdout_fd = opened_out;
+      }
+
+      if(err == 0)
+      {
+         err = spawn_stage(cmd->argv[i], stdin_fd, stdout_fd, err_fd, &st->pid);
+         if(err != 0)
+         {
+            st->pid = -1;
+            st->status = 127;
+         }
+      }
+
+      if(err != 0)
+         failed = err;
+
+      if(opened_in != -1)
+         close(opened_in);
+      if(opened_out != -1)
+         close(opened_out);
+      if(prev != -1)
+         close(prev);
+      if(pipefd[1] != -1)
+         close(pipefd[1]);
+
+      prev = pipefd[0];
+   }
+
+   if(prev != -1)
+      close(prev);
+
+   if(failed != 0)
+   {
+      errno = failed;
+      return -1;
+   }
+
+   return 0;
+}
+
+//reaps a stage with wait4 and records when it was reaped
+static void reap_stage(struct myshell_job* job, struct myshell_stage* st)
+{
+   int status;
+   pid_t ret;
+   while((ret = wait4(st->pid, &status, 0, &st->usage)) == -1 && errno == EINTR)
+      ;
+
+   st->wall = lib_clock() - job->start;
+   if(ret == -1)
+      st->status = 1;
+   else if(WIFEXITED(status))
+      st->status = WEXITSTATUS(status);
+   else if(WIFSIGNALED(status))
+      st->status = 128 + WTERMSIG(status);
+   else
+      st->status = 1;
+}
+
+/*
+ * Waits for every started stage with wait4, reaping each one as it
+ *    exits so its wall time ends there. A pidfd of each stage says
+ *    which have exited without reaping any of the caller's other
+ *    children. Without pidfds they are reaped in order.
+ * Returns the exit status of the last stage
+ */
+int myshell_wait(struct myshell_job* job)
+{
+   struct pollfd fds[MYSHELL_MAX_STAGES];
+   int which[MYSHELL_MAX_STAGES];
+   int count = 0;
+   int i;
+
+   for(i = 0; i < job->count && count != -1; i++)
+   {
+      if(job->stages[i].pid <= 0)
+         continue;
+
+      fds[count].fd = syscall(SYS_pidfd_open, job->stages[i].pid, 0);
+      fds[count].events = POLLIN;
+      which[count] = i;
+      if(fds[count].fd == -1)
+      {
+         while(count > 0)
+            close(fds[--count].fd);
+         count = -1;
+      }
+      else
+         count++;
+   }
+
+   if(count == -1)
+   {
+      for(i = 0; i < job->count; i++)
+         if(job->stages[i].pid > 0)
+            reap_stage(job, &job->stages[i]);
+   }
+
+   //a pidfd becomes readable once its process has exited
+   int left = count;
+   while(left > 0)
+   {
+      if(poll(fds, count, -1) == -1)
+      {
+         if(errno == EINTR)
+            continue;
+
+         //wait for the rest in order
+         for(i = 0; i < count; i++)
+            fds[i].revents = (fds[i].fd != -1) ? POLLIN : 0;
+      }
+
+      for(i = 0; i < count; i++)
+      {
+         if(fds[i].fd == -1 || fds[i].revents == 0)
+            continue;
+
+         reap_stage(job, &job->stages[which[i]]);
+         close(fds[i].fd);
+         fds[i].fd = -1;
+         left--;
+      }
+   }
+
+   job->status = (job->count > 0) ? job->stages[job->count - 1].status : 1;
+   return job->status;
+}
+
+/*
+ * Spawns a command and waits for it.
+ * Returns the exit status of the job
+ */
+int myshell_run(const myshell_cmd* cmd, int in_fd, int out_fd, int err_fd, struct myshell_job* job)
+{
+   myshell_spawn(cmd, in_fd, out_fd, err_fd, job);
+   return myshell_wait(job);
+}
@@ -0,0 +1,493 @@
+/*
+ * File:   limits.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Resource limits for the stages of a job, set with the limit
+ *            prefix:
+ *
+ *               limit [-v SIZE] [-t SECS] [-n FILES] [-u PROCS]
+ *                     [-m SIZE] [-c PERCENT] cmd
+ *
+ *            -v, -t, -n and -u set RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE
+ *            and RLIMIT_NPROC in every child before it executes its
+ *            command. -m and -c put the whole job in a cgroup v2 leaf
+ *            of its own with memory.max and cpu.max set, removed once
+ *            the job has been reaped. The leaves are kept in a
+ *            myshell-PID cgroup made under MYSHELL_CGROUP, or next to
+ *            the shell's own cgroup since one with processes in it
+ *            cannot hand controllers down. A job is not run if its
+ *            cgroup cannot be set up. Sizes take a K, M or G suffix.
+ *            The time builtin reports the limits along with the job's
+ *            peak memory and OOM kills from the cgroup.
+ */
+
+#ifndef LIMITS_C
+#define LIMITS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "log.c"
+#include "timeout.c"
+
+//a limit which is not set
+#define LIMIT_NONE -1
+
+//limits requested for a job
+struct job_limits
+{
+   int set;                      //the limit prefix was given
+   long long as;                 //bytes of address space
+   long long cpu;                //seconds of CPU time
+   long long nofile;
+   long long nproc;
+   long long memory_max;         //bytes, through the cgroup
+   int cpu_percent;              //of one CPU, through the cgroup
+};
+
+//set by the limit prefix for the next job only
+struct job_limits next_limits;
+
+//the cgroup of the running job and its cgroup.procs, -1 when none
+char limit_cgroup[600];
+int limit_procs_fd = -1;
+int limit_jobs = 0;
+
+//set when the running job's cgroup could not be set up
+int limit_failed = 0;
+
+//the cgroup the jobs' cgroups are kept in and the shell which made it
+char limit_root[560];
+pid_t limit_root_owner = -1;
+
+//what the most recent job ran under, for the time builtin
+struct job_limits last_job_limits;
+int last_job_cgroup = 0;
+long long last_job_memory_peak = -1;
+long long last_job_oom_kills = -1;
+
+/*
+ * Converts a size like 512, 64K, 100M or 2G to bytes.
+ * Returns the size or -1 if it is not valid
+ */
+long long parse_size(char* text)
+{
+   char* end;
+   long long value = strtoll(text, &end, 10);
+
+   if(end == text || value < 0)
+      return -1;
+
+   if(strcmp(end, "") == 0)
+      return value;
+   if(strcmp(end, "K") == 0 || strcmp(end, "k") == 0)
+      return value << 10;
+   if(strcmp(end, "M") == 0 || strcmp(end, "m") == 0)
+      return value << 20;
+   if(strcmp(end, "G") == 0 || strcmp(end, "g") == 0)
+      return value << 30;
+
+   return -1;
+}
+
+/*
+ * Strips a limit prefix from the front of a line.
+ * Returns 1 if a prefix was stripped
+ *         0 if there was none
+ *        -1 if it is not valid
+ */
+int limit_prefix(char** line)
+{
+   char* cur = *line;
+   char word[64];
+
+   if(next_word(&cur, word, sizeof(word)) == NULL || strcmp(word, "limit") != 0)
+      return 0;
+
+   struct job_limits req;
+   req.set = 1;
+   req.as = req.cpu = req.nofile = req.nproc = req.memory_max = LIMIT_NONE;
+   req.cpu_percent = LIMIT_NONE;
+
+   while(1)
+   {
+      char* start = cur;
+      if(next_word(&cur, word, sizeof(word)) == NULL)
+         return -1;
+
+      //the command starts at the first word which is not an option
+      if(word[0] != '-')
+      {
+         cur = start;
+         break;
+      }
+      if(strlen(word) != 2 || strchr("vtnumc", word[1]) == NULL)
+         return -1;
+
+      char value[64];
+      if(next_word(&cur, value, sizeof(value)) == NULL)
+         return -1;
+
+      long long n = (word[1] == 'v' || word[1] == 'm') ? parse_size(value) : strtoll(value, NULL, 10);
+      if(n <= 0)
+         return -1;
+
+      switch(word[1])
+      {
+         case 'v': req.as = n; break;
+         case 't': req.cpu = n; break;
+         case 'n': req.nofile = n; break;
+         case 'u': req.nproc = n; break;
+         case 'm': req.memory_max = n; break;
+         case 'c': req.cpu_percent = n; break;
+      }
+   }
+
+   next_limits = req;
+   *line = cur;
+
+   return 1;
+}
+
+/*
+ * Writes a value to a file of a cgroup.
+ * Returns 0 or -1 if it could not be written
+ */
+int cgroup_write(char* dir, char* file, char* value)
+{
+   char path[600];
+   snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+   int fd = open(path, O_WRONLY | O_CLOEXEC);
+   if(fd == -1)
+      return -1;
+
+   int len = strlen(value);
+   int ret = (write(fd, value, len) == len) ? 0 : -1;
+   close(fd);
+
+   return ret;
+}
+
+/*
+ * Reads a number from a file of a cgroup, or the number after key
+ *    when the file holds key value lines (like memory.events).
+ * Returns the number or -1 if it is not available
+ */
+long long cgroup_read(char* dir, char* file, char* key)
+{
+   char path[600];
+   snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+   FILE* in = fopen(path, "r");
+   if(in == NULL)
+      return -1;
+
+   long long value = -1;
+   char name[64];
+   long long n;
+   if(key == NULL)
+   {
+      if(fscanf(in, "%lld", &n) == 1)
+         value = n;
+   }
+   else
+   {
+      while(fscanf(in, "%63s %lld", name, &n) == 2)
+         if(strcmp(name, key) == 0)
+            value = n;
+   }
+
+   fclose(in);
+   return value;
+}
+
+/*
+ * Finds the directory the shell's cgroup of jobs is made in:
+ *    MYSHELL_CGROUP, or the parent of the shell's own cgroup in the
+ *    cgroup v2 hierarchy (the root if the shell is in the root).
+ * Returns 0 or -1 if there is no cgroup v2 hierarchy
+ */
+int cgroup_base(char* base, int size)
+{
+   char* env = getenv("MYSHELL_CGROUP");
+   if(env != NULL && env[0] != '\0')
+   {
+      snprintf(base, size, "%s", env);
+      return 0;
+   }
+
+   //the cgroup2 mount point (fifth field of mountinfo)
+   char mount[256] = "";
+   char buff[1024];
+   FILE* in = fopen("/proc/self/mountinfo", "r");
+   if(in == NULL)
+      return -1;
+   while(mount[0] == '\0' && fgets(buff, sizeof(buff), in) != NULL)
+   {
+      char point[256];
+      char* sep = strstr(buff, " - cgroup2 ");
+      if(sep != NULL && sscanf(buff, "%*s %*s %*s %*s %255s", point) == 1)
+         strcpy(mount, point);
+   }
+   fclose(in);
+
+   //the shell's own path within it
+   char path[1024] = "";
+   in = fopen("/proc/self/cgroup", "r");
+   if(in == NULL)
+      return -1;
+   while(fgets(buff, sizeof(buff), in) != NULL)
+   {
+      if(strncmp(buff, "0::", 3) == 0)
+      {
+         buff[strcspn(buff, "\n")] = '\0';
+         snprintf(path, sizeof(path), "%s", buff + 3);
+      }
+   }
+   fclose(in);
+
+   if(mount[0] == '\0')
+      return -1;
+
+   //the root may have processes of its own, any other cgroup may not
+   char* slash = strrchr(path, '/');
+   if(slash != NULL)
+      *slash = '\0';
+
+   snprintf(base, size, "%s%s", mount, path);
+   return 0;
+}
+
+//removes the shell's cgroup of jobs when the shell exits
+void limit_at_exit(void)
+{
+   if(getpid() == limit_root_owner)
+      rmdir(limit_root);
+}
+
+/*
+ * Makes the cgroup the jobs' cgroups are kept in, with the controllers
+ *    a job asked for handed down to them.
+ * Returns 0 or -1 with the reason printed
+ */
+int limit_cgroup_root(struct job_limits* req)
+{
+   char base[512];
+   if(cgroup_base(base, sizeof(base)) == -1)
+   {
+      fprintf(stderr, "limit: no cgroup v2 hierarchy\n");
+      return -1;
+   }
+
+   snprintf(limit_root, sizeof(limit_root), "%s/myshell-%d", base, (int)getpid());
+   if(mkdir(limit_root, 0755) == -1 && errno != EEXIST)
+   {
+      fprintf(stderr, "limit: could not create cgroup %s: %s\n", limit_root, strerror(errno));
+      return -1;
+   }
+   if(limit_root_owner != getpid())
+   {
+      limit_root_owner = getpid();
+      atexit(limit_at_exit);
+   }
+
+   char* controllers = (req->memory_max == LIMIT_NONE) ? "+cpu" :
+                       (req->cpu_percent == LIMIT_NONE) ? "+memory" : "+memory +cpu";
+
+   //the controllers may already be enabled above the shell's cgroup
+   cgroup_write(base, "cgroup.subtree_control", controllers);
+   if(cgroup_write(limit_root, "cgroup.subtree_control", controllers) == -1)
+   {
+      fprintf(stderr, "limit: could not enable %s in %s: %s\n", controllers, limit_root, strerror(errno));
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Creates the cgroup of a job which asked for -m or -c and opens its
+ *    cgroup.procs for the children to join.
+ * Returns 0 or -1 with the reason printed
+ */
+int limit_cgroup_create(struct job_limits* req)
+{
+   if(limit_cgroup_root(req) == -1)
+      return -1;
+
+   snprintf(limit_cgroup, sizeof(limit_cgroup), "%s/job-%d", limit_root, ++limit_jobs);
+   if(mkdir(limit_cgroup, 0755) == -1)
+   {
+      fprintf(stderr, "limit: could not create cgroup %s: %s\n", limit_cgroup, strerror(errno));
+      limit_cgroup[0] = '\0';
+      return -1;
+   }
+
+   char value[64];
+   char* failed = NULL;
+   if(req->memory_max != LIMIT_NONE)
+   {
+      snprintf(value, sizeof(value), "%lld", req->memory_max);
+      if(cgroup_write(limit_cgroup, "memory.max", value) == -1)
+         failed = "memory.max";
+   }
+   if(req->cpu_percent != LIMIT_NONE && failed == NULL)
+   {
+      snprintf(value, sizeof(value), "%d 100000", req->cpu_percent * 1000);
+      if(cgroup_write(limit_cgroup, "cpu.max", value) == -1)
+         failed = "cpu.max";
+   }
+
+   char procs[640];
+   snprintf(procs, sizeof(procs), "%s/cgroup.procs", limit_cgroup);
+   if(failed == NULL && (limit_procs_fd = open(procs, O_WRONLY | O_CLOEXEC)) == -1)
+      failed = "cgroup.procs";
+
+   if(failed != NULL)
+   {
+      fprintf(stderr, "limit: could not set %s in %s: %s\n", failed, limit_cgroup, strerror(errno));
+      rmdir(limit_cgroup);
+      limit_cgroup[0] = '\0';
+      return -1;
+   }
+
+   char buff[700];
+   snprintf(buff, sizeof(buff), "Created cgroup %s\n", limit_cgroup);
+   log_line(buff);
+   return 0;
+}
+
+/*
+ * Prepares the limits of a job. Called in the parent before its
+ *    first stage is forked.
+ */
+void limit_begin_job(void)
+{
+   last_job_limits = next_limits;
+   last_job_cgroup = 0;
+   last_job_memory_peak = -1;
+   last_job_oom_kills = -1;
+
+   limit_cgroup[0] = '\0';
+   limit_failed = 0;
+   if(next_limits.set && (next_limits.memory_max != LIMIT_NONE || next_limits.cpu_percent != LIMIT_NONE) &&
+      limit_cgroup_create(&next_limits) == -1)
+   {
+      fprintf(stderr, "limit: the job is not run without its -m and -c limits\n");
+      limit_failed = 1;
+   }
+}
+
+//sets one rlimit (soft and hard) if it was requested
+int limit_set(int resource, long long value, char* name)
+{
+   if(value == LIMIT_NONE)
+      return 0;
+
+   //   The hard CPU limit is a second later so the command gets SIGXCPU
+   //rather than going straight to SIGKILL.
+   struct rlimit rl;
+   rl.rlim_cur = (rlim_t)value;
+   rl.rlim_max = (resource == RLIMIT_CPU) ? (rlim_t)value + 1 : (rlim_t)value;
+   if(setrlimit(resource, &rl) == -1)
+   {
+      fprintf(stderr, "limit: could not set %s: %s\n", name, strerror(errno));
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Applies the job's limits to this child. A command is not run
+ *    without the limits it asked for.
+ */
+void limit_child(void)
+{
+   if(!next_limits.set)
+      return;
+
+   if(limit_procs_fd != -1 && write(limit_procs_fd, "0", 1) != 1)
+   {
+      fprintf(stderr, "limit: could not join cgroup %s: %s\n", limit_cgroup, strerror(errno));
+      exit(1);
+   }
+
+   if(limit_set(RLIMIT_AS, next_limits.as, "address space") == -1 ||
+      limit_set(RLIMIT_CPU, next_limits.cpu, "CPU time") == -1 ||
+      limit_set(RLIMIT_NOFILE, next_limits.nofile, "open files") == -1 ||
+      limit_set(RLIMIT_NPROC, next_limits.nproc, "processes") == -1)
+      exit(1);
+}
+
+/*
+ * Collects what the job's cgroup saw and removes it once the job
+ *    has been reaped.
+ */
+void limit_end_job(void)
+{
+   if(limit_procs_fd != -1)
+   {
+      close(limit_procs_fd);
+      limit_procs_fd = -1;
+   }
+
+   if(limit_cgroup[0] == '\0')
+      return;
+
+   last_job_cgroup = 1;
+   last_job_memory_peak = cgroup_read(limit_cgroup, "memory.peak", NULL);
+   last_job_oom_kills = cgroup_read(limit_cgroup, "memory.events", "oom_kill");
+
+   //a process the job left behind keeps the cgroup alive
+   if(rmdir(limit_cgroup) == -1)
+   {
+      char buff[700];
+      snprintf(buff, sizeof(buff), "Could not remove cgroup %s\n", limit_cgroup);
+      log_line(buff);
+   }
+
+   limit_cgroup[0] = '\0';
+}
+
+//prints one limit for limit_print_job, scaled down by shift bits
+void limit_print(char* name, long long value, int shift, char* unit)
+{
+   if(value != LIMIT_NONE)
+      fprintf(stderr, " %s %lld%s", name, value >> shift, unit);
+}
+
+/*
+ * Prints the limits of the most recent job after its resource usage
+ */
+void limit_print_job(void)
+{
+   if(!last_job_limits.set)
+      return;
+
+   fprintf(stderr, "limits:");
+   limit_print("as", last_job_limits.as, 10, "KB");
+   limit_print("cpu", last_job_limits.cpu, 0, "s");
+   limit_print("nofile", last_job_limits.nofile, 0, "");
+   limit_print("nproc", last_job_limits.nproc, 0, "");
+   limit_print("memory.max", last_job_limits.memory_max, 10, "KB");
+   limit_print("cpu.max", last_job_limits.cpu_percent, 0, "%");
+
+   if(last_job_cgroup)
+   {
+      limit_print("memory.peak", last_job_memory_peak, 10, "KB");
+      limit_print("oom_kills", last_job_oom_kills, 0, "");
+   }
+
+   fprintf(stderr, "\n");
+}
+
+#endif //LIMITS_C
@@ -2,54 +2,640 @@
  * File:   log.c
  * Author: Alex Anderson
  * Date:   10-26-14
- * Notes:  Logs c-strings into a log file.
+ * Notes:  Logs c-strings into a log file (MYSHELL_LOG, default
+ *            foo.txt) which is appended to and rotated by size, and
+ *            records structured trace events when MYSHELL_TRACE is
+ *            set. Lines go through a shared mapping of the file with
+ *            MYSHELL_LOG_MMAP, or are batched and written with
+ *            io_uring where it is available.
  */
 
 #ifndef LOG_C
 #define LOG_C
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "stats.c"
+#include "uring.c"
 
 int log_fd = -1;
 const char nl = '\n';
 char* log_filename = "foo.txt";
 
-//logs a single c-string
-void log_info(char* info)
+//log size limit, rotated logs kept and space reserved ahead of writes
+#define LOG_MAX_SIZE (8LL << 20)
+#define LOG_KEEP 3
+#define LOG_PREALLOC (1LL << 20)
+
+//size of the mapped window of the log
+#define LOG_WINDOW (1LL << 20)
+
+//the settings, read when the log is first opened
+char log_path[PATH_MAX];
+long long log_max_size = LOG_MAX_SIZE;
+int log_keep = LOG_KEEP;
+int log_mapped = 0;
+
+//bytes in the log as far as this process knows and the end of the
+//space reserved for it
+long long log_size = 0;
+long long log_allocated = 0;
+
+//   The mapped window: the next offset to write at is shared with the
+//children, only the process which opened the log moves the window.
+long long* log_offset = NULL;
+char* log_map = NULL;
+long long log_map_start = 0;
+pid_t log_owner = -1;
+
+//lines gathered for the ring, and the time of the last fsync
+#define LOG_BATCH 16384
+#define LOG_SYNC_INTERVAL (100 * 1000000LL)
+
+//   Two buffers: one is filled while the other may still be written.
+//Every batch waits in the kernel for the ones before it (IO_DRAIN).
+char log_batch[2][LOG_BATCH];
+int log_batch_cur = 0;
+int log_batch_len = 0;
+int log_batch_sent[2];           //length of the batch in flight from each
+long long log_synced = 0;
+int log_ring = 1;                //cleared if the ring fails
+int log_exit_set = 0;
+
+void log_at_exit(void);
+
+//trace event types
+#define EV_COMMAND    0	//a command line is about to be executed
+#define EV_FORK_BEGIN 1
+#define EV_FORK_END   2
+#define EV_DUP2       3
+#define EV_EXEC       4	//a child is calling execvp
+#define EV_EXEC_FAIL  5
+#define EV_WAIT_BEGIN 6
+#define EV_WAIT_END   7
+#define NUM_EVENTS    8
+
+//   Name and Chrome trace phase of each event type. Forks and waits
+//are B/E pairs on the shell's track, the rest are instant events.
+const char* event_names[NUM_EVENTS] = {
+   "command", "fork", "fork", "dup2", "execvp", "exec_failed", "wait", "wait"
+};
+const char event_phases[NUM_EVENTS] = {
+   'i', 'B', 'E', 'i', 'i', 'i', 'B', 'E'
+};
+
+//trace formats
+#define TRACE_OFF    0
+#define TRACE_JSON   1
+#define TRACE_BINARY 2
+
+//header of a binary trace file
+#define TRACE_MAGIC "MSHTRACE"
+#define TRACE_VERSION 1
+
+//   A binary record is this header followed by len bytes of command
+//text (not terminated).
+struct trace_record
+{
+   uint64_t ts;      //monotonic nanoseconds
+   uint32_t pid;
+   uint16_t type;
+   uint16_t len;
+};
+
+//the most command text stored with one event
+#define TRACE_TEXT_MAX 200
+
+//-2 until MYSHELL_TRACE has been checked
+int trace_fd = -2;
+int trace_mode = TRACE_OFF;
+
+/*
+ * Reads the log's settings from the environment. Once the log reaches
+ *    MYSHELL_LOG_SIZE bytes (default 8M, 0 for no limit) it is renamed
+ *    to .1, the older ones to .2 and so on up to MYSHELL_LOG_KEEP
+ *    (default 3).
+ */
+void log_settings(void)
+{
+   char* env = getenv("MYSHELL_LOG");
+   snprintf(log_path, sizeof(log_path), "%s", (env != NULL && env[0] != '\0') ? env : log_filename);
+
+   env = getenv("MYSHELL_LOG_SIZE");
+   if(env != NULL && env[0] != '\0')
+   {
+      //a size like 512K, 64M or 1G
+      char* end;
+      long long size = strtoll(env, &end, 10);
+      if(*end == 'K' || *end == 'k')
+         size <<= 10;
+      else if(*end == 'M' || *end == 'm')
+         size <<= 20;
+      else if(*end == 'G' || *end == 'g')
+         size <<= 30;
+      if(size >= 0)
+         log_max_size = size;
+   }
+
+   env = getenv("MYSHELL_LOG_KEEP");
+   if(env != NULL && env[0] != '\0' && atoi(env) >= 0)
+      log_keep = atoi(env);
+
+   env = getenv("MYSHELL_LOG_MMAP");
+   log_mapped = (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0);
+}
+
+//removes the part of the mapped window which was never written
+void log_trim(void)
+{
+   if(log_map != NULL && getpid() == log_owner)
+   {
+      munmap(log_map, LOG_WINDOW);
+      log_map = NULL;
+      ftruncate(log_fd, *log_offset);
+   }
+}
+
+/*
+ * Maps the window of the log holding offset.
+ * Returns 0 or -1 if it could not be mapped
+ */
+int log_map_window(long long offset)
+{
+   if(log_map != NULL)
+      munmap(log_map, LOG_WINDOW);
+   log_map = NULL;
+
+   long long start = offset & ~((long long)sysconf(_SC_PAGESIZE) - 1);
+
+   //the file must reach the end of the window before it is mapped
+   struct stat sb;
+   if(fstat(log_fd, &sb) == -1)
+      return -1;
+   if(sb.st_size < start + LOG_WINDOW)
+   {
+      fallocate(log_fd, 0, sb.st_size, start + LOG_WINDOW - sb.st_size);
+      if(ftruncate(log_fd, start + LOG_WINDOW) == -1)
+         return -1;
+   }
+
+   void* map = mmap(NULL, LOG_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, log_fd, start);
+   if(map == MAP_FAILED)
+      return -1;
+
+   log_map = map;
+   log_map_start = start;
+   return 0;
+}
+
+/*
+ * Checks a finished request. A batch which the ring failed to write,
+ *    or wrote only part of, is written directly.
+ */
+void log_complete(unsigned long long data, int res)
+{
+   //fsyncs have no data
+   if(data == 0)
+      return;
+
+   int index = data - 1;
+   int written = (res > 0) ? res : 0;
+   if(written < log_batch_sent[index])
+   {
+      write(log_fd, log_batch[index] + written, log_batch_sent[index] - written);
+      io_syscalls++;
+   }
+   log_batch_sent[index] = 0;
+}
+
+//returns 1 if this process's lines are batched for the ring
+int log_batching(void)
+{
+   if(log_mapped || !log_ring || !uring_ready())
+      return 0;
+
+   if(!log_exit_set)
+   {
+      atexit(log_at_exit);
+      shell_uring.complete = log_complete;
+      log_exit_set = 1;
+   }
+   return 1;
+}
+
+/*
+ * Sends the batched lines to the log with an fsync linked after them
+ *    if sync is set or the last one is old enough, and waits for them
+ *    if wait is set
+ */
+void log_submit(int wait, int sync)
+{
+   if(log_fd == -1 || !log_batching())
+      return;
+
+   unsigned count = 0;
+   int sent = -1;
+   if(log_batch_len > 0)
+   {
+      struct io_uring_sqe* write_sqe = uring_queue(IORING_OP_WRITE, log_fd, log_batch[log_batch_cur], log_batch_len, -1);
+      if(write_sqe == NULL && uring_submit(0) == 0)
+         write_sqe = uring_queue(IORING_OP_WRITE, log_fd, log_batch[log_batch_cur], log_batch_len, -1);
+
+      //without room in the ring the batch is written directly, and so
+      //is every line after it
+      if(write_sqe == NULL)
+      {
+         write(log_fd, log_batch[log_batch_cur], log_batch_len);
+         io_syscalls++;
+         log_batch_len = 0;
+         log_ring = 0;
+         return;
+      }
+
+      write_sqe->flags |= IOSQE_IO_DRAIN;
+      write_sqe->user_data = log_batch_cur + 1;
+      log_batch_sent[log_batch_cur] = log_batch_len;
+      count++;
+
+      sent = log_batch_cur;
+      log_batch_cur ^= 1;
+      log_batch_len = 0;
+   }
+
+   long long now = stats_clock();
+   if(sync || (count > 0 && now - log_synced >= LOG_SYNC_INTERVAL))
+   {
+      struct io_uring_sqe* sync_sqe = uring_queue(IORING_OP_FSYNC, log_fd, NULL, 0, 0);
+      if(sync_sqe != NULL)
+      {
+         sync_sqe->flags |= IOSQE_IO_DRAIN;
+         count++;
+         log_synced = now;
+      }
+   }
+
+   //   The batch just sent may still be in flight, but the one before
+   //it is done so its buffer can be filled again.
+   if(uring_submit(wait ? 0 : count) == -1)
+   {
+      //the ring did not take the batch, so it is written directly
+      if(sent != -1 && shell_uring.queued == count)
+      {
+         write(log_fd, log_batch[sent], log_batch_sent[sent]);
+         io_syscalls++;
+         log_batch_sent[sent] = 0;
+      }
+      log_ring = 0;
+   }
+   else if(uring_error() != 0)
+   {
+      //failed writes were written directly as they completed
+      uring_submit(0);
+      log_ring = 0;
+   }
+}
+
+/*
+ * Writes out the batched lines and waits for them, before a fork
+ */
+void log_flush(void)
+{
+   log_submit(1, 0);
+}
+
+/*
+ * Writes out the batched lines, fsyncs the log and waits for both
+ */
+void log_sync(void)
+{
+   log_submit(1, 1);
+}
+
+//the log was written out and trimmed before the shell exits
+void log_at_exit(void)
+{
+   log_sync();
+   log_trim();
+}
+
+//opens the log, or a new one after it has been rotated
+void log_open(void)
+{
+   if(log_path[0] == '\0')
+      log_settings();
+
+   //a writable mapping needs the file opened for reading too, and
+   //its lines are placed at their own offsets rather than appended
+   int flags = log_mapped ? O_RDWR : (O_APPEND | O_WRONLY);
+   log_fd = open(log_path, O_CREAT | flags, S_IRUSR | S_IWUSR);
+   if(log_fd == -1)
+      return;
+
+   struct stat sb;
+   log_size = (fstat(log_fd, &sb) == 0) ? sb.st_size : 0;
+   log_allocated = log_size;
+
+   if(!log_mapped)
+      return;
+
+   //the offset is shared with the children the shell forks
+   if(log_offset == NULL)
+   {
+      void* mem = mmap(NULL, sizeof(long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if(mem == MAP_FAILED)
+      {
+         log_mapped = 0;
+         return;
+      }
+      log_offset = mem;
+      atexit(log_at_exit);
+   }
+
+   *log_offset = log_size;
+   log_owner = getpid();
+   if(log_map_window(log_size) == 0)
+      return;
+
+   //fall back to appending
+   ftruncate(log_fd, log_size);
+   close(log_fd);
+   log_mapped = 0;
+   log_open();
+}
+
+/*
+ * Renames the log once it has reached its size limit and opens a new
+ *    one, unless another shell has already done so.
+ */
+void log_rotate(void)
+{
+   //the batched lines belong in the old log
+   log_flush();
+
+   struct stat fsb, psb;
+   if(fstat(log_fd, &fsb) == -1)
+      return;
+
+   int moved = (stat(log_path, &psb) == -1 || psb.st_ino != fsb.st_ino || psb.st_dev != fsb.st_dev);
+   if(!moved)
+   {
+      //other shells may have written to it too
+      log_size = log_mapped ? *log_offset : fsb.st_size;
+      if(log_size < log_max_size)
+         return;
+
+      char from[PATH_MAX + 16], to[PATH_MAX + 16];
+      int i;
+      for(i = log_keep - 1; i >= 1; i--)
+      {
+         snprintf(from, sizeof(from), "%s.%d", log_path, i);
+         snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+         rename(from, to);
+      }
+
+      if(log_keep > 0)
+      {
+         snprintf(to, sizeof(to), "%s.1", log_path);
+         rename(log_path, to);
+      }
+      else
+         unlink(log_path);
+   }
+
+   //the space reserved past the end is given back
+   log_trim();
+   ftruncate(log_fd, log_mapped ? *log_offset : fsb.st_size);
+   close(log_fd);
+   log_open();
+}
+
+//writes to the log, rotating it when it is full
+void log_write(const char* text, int len)
 {
    //if the log file has not been initialized
    if(log_fd == -1)
-      log_fd = open(log_filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+      log_open();
+
+   //the log could not be opened
+   if(log_fd == -1)
+      return;
+
+   if(log_mapped)
+   {
+      long long offset = __atomic_fetch_add(log_offset, len, __ATOMIC_RELAXED);
+
+      //only the shell moves the window, its children write past it
+      if((offset < log_map_start || offset + len > log_map_start + LOG_WINDOW) &&
+         getpid() == log_owner)
+         log_map_window(offset);
+
+      if(log_map != NULL && offset >= log_map_start && offset + len <= log_map_start + LOG_WINDOW)
+         memcpy(log_map + (offset - log_map_start), text, len);
+      else
+         pwrite(log_fd, text, len, offset);
+
+      log_size = offset + len;
+   }
+   else if(log_batching() && len <= LOG_BATCH)
+   {
+      if(log_batch_len + len > LOG_BATCH)
+         log_submit(0, 0);
 
-   //if the log file has been initialized
-   if(log_fd != -1)
+      memcpy(log_batch[log_batch_cur] + log_batch_len, text, len);
+      log_batch_len += len;
+      log_size += len;
+   }
+   else
+   {
+      log_flush();
+      write(log_fd, text, len);
+      io_syscalls += 2;
+
+      //the children share the file offset, so it counts their lines too
+      log_size = lseek(log_fd, 0, SEEK_CUR);
+
+      if(log_size > log_allocated)
+      {
+         fallocate(log_fd, FALLOC_FL_KEEP_SIZE, log_size, LOG_PREALLOC);
+         log_allocated = log_size + LOG_PREALLOC;
+      }
+   }
+
+   if(log_max_size > 0 && log_size >= log_max_size && (!log_mapped || getpid() == log_owner))
+      log_rotate();
+}
+
+//logs a single c-string
+void log_info(char* info)
+{
+   log_write(info, strlen(info));
+
+   //a batched line is fsynced along with the batch
+   if(log_fd != -1 && !log_batching())
    {
-      write(log_fd, info, strlen(info)); //write
       fsync(log_fd); //flush buffer
+      io_syscalls++;
    }
 }
 
 //logs single c-string and ensures a newline after the information
 void log_line(char* info)
 {
-   //if the log file has not been initialized
-   if(log_fd == -1)
-      log_fd = open(log_filename, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+   int len = strlen(info);
+   log_write(info, len);
+
+   //ensure a new line is started
+   if(len > 0 && info[len-1] != '\n')
+      log_write(&nl, 1);
+
+   //a batched line is fsynced along with the batch
+   if(log_fd != -1 && !log_batching())
+   {
+      fsync(log_fd); //flush buffer
+      io_syscalls++;
+   }
+}
+
+/*
+ * Opens the trace file requested through MYSHELL_TRACE and writes
+ *    the header for its format
+ */
+void trace_open(void)
+{
+   trace_fd = -1;
+
+   char* mode = getenv("MYSHELL_TRACE");
+   if(mode == NULL)
+      return;
+
+   if(strcmp(mode, "json") == 0)
+      trace_mode = TRACE_JSON;
+   else if(strcmp(mode, "binary") == 0 || strcmp(mode, "bin") == 0)
+      trace_mode = TRACE_BINARY;
+   else
+      return;
+
+   char* path = getenv("MYSHELL_TRACE_FILE");
+   if(path == NULL || path[0] == '\0')
+      path = (trace_mode == TRACE_JSON) ? "trace.json" : "trace.bin";
 
-   //if the log file has benn initialized
-   if(log_fd != -1)
+   trace_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+   if(trace_fd == -1)
    {
-      int len = strlen(info);
-      write(log_fd, info, len); //write
+      trace_mode = TRACE_OFF;
+      return;
+   }
 
-      //ensure a new line is started
-      if(info[len-1] != '\n')
-         write(log_fd, &nl, 1);
+   //   The JSON array is left open: the trace viewer accepts that and
+   //it lets every process append events without coordination.
+   if(trace_mode == TRACE_JSON)
+      write(trace_fd, "[\n", 2);
+   else
+   {
+      uint32_t version = TRACE_VERSION;
+      char header[12];
+      memcpy(header, TRACE_MAGIC, 8);
+      memcpy(header + 8, &version, 4);
+      write(trace_fd, header, sizeof(header));
+   }
+}
 
-      fsync(log_fd); //flush buffer
+/*
+ * Formats one event as a Chrome trace-event JSON object followed
+ *    by a comma and newline.
+ * Returns the length of the text stored in buff
+ */
+int trace_format_json(char* buff, int size, uint64_t ts, uint32_t pid,
+                      int type, const char* text, int len)
+{
+   int n = snprintf(buff, size,
+                    "{\"name\":\"%s\",\"cat\":\"shell\",\"ph\":\"%c\",%s\"ts\":%llu.%03llu,"
+                    "\"pid\":%u,\"tid\":%u,\"args\":{\"cmd\":\"",
+                    event_names[type], event_phases[type],
+                    event_phases[type] == 'i' ? "\"s\":\"t\"," : "",
+                    (unsigned long long)(ts / 1000), (unsigned long long)(ts % 1000),
+                    pid, pid);
+
+   //escape the command text, leaving room for the closing characters
+   int i;
+   for(i = 0; i < len && n < size - 16; i++)
+   {
+      unsigned char c = text[i];
+      if(c == '"' || c == '\\')
+      {
+         buff[n++] = '\\';
+         buff[n++] = c;
+      }
+      else if(c == '\n')
+      {
+         buff[n++] = '\\';
+         buff[n++] = 'n';
+      }
+      else if(c < 0x20)
+         n += snprintf(buff + n, size - n, "\\u%04x", c);
+      else
+         buff[n++] = c;
    }
+
+   n += snprintf(buff + n, size - n, "\"}},\n");
+   return n;
 }
 
+/*
+ * Records a structured trace event if tracing was requested.
+ *    Each event is written with a single write() so events from the
+ *    shell and its children are never interleaved.
+ */
+void log_event(int type, const char* cmd)
+{
+   if(trace_fd == -2)
+      trace_open();
+
+   if(trace_fd == -1)
+      return;
+
+   uint64_t ts = (uint64_t)stats_clock();
+
+   if(cmd == NULL)
+      cmd = "";
+
+   int len = strlen(cmd);
+   if(len > TRACE_TEXT_MAX)
+      len = TRACE_TEXT_MAX;
+
+   //drop the newline which ends most log messages
+   while(len > 0 && cmd[len-1] == '\n')
+      len--;
+
+   char buff[sizeof(struct trace_record) + TRACE_TEXT_MAX * 6 + 256];
+
+   if(trace_mode == TRACE_JSON)
+   {
+      int n = trace_format_json(buff, sizeof(buff), ts, getpid(), type, cmd, len);
+      write(trace_fd, buff, n);
+   }
+   else
+   {
+      struct trace_record rec;
+      rec.ts = ts;
+      rec.pid = getpid();
+      rec.type = type;
+      rec.len = len;
+
+      memcpy(buff, &rec, sizeof(rec));
+      memcpy(buff + sizeof(rec), cmd, len);
+      write(trace_fd, buff, sizeof(rec) + len);
+   }
+}
 
 #endif //LOG_C
@@ -0,0 +1,348 @@
+/*
+ * File:   loop.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Loops written on one line, with the body's commands joined
+ *            by ;, && or || like any list:
+ *
+ *               for NAME in WORDS; do COMMANDS; done
+ *               while COMMAND; do COMMANDS; done
+ *
+ *            Loops may be nested. The whole loop is parsed before it
+ *            starts and each command of its body only once, so an
+ *            iteration just sets the loop variable, refreshes the
+ *            variable slots of the body and runs it. Ctrl-C ends the
+ *            loop along with the command it interrupts.
+ */
+
+#ifndef LOOP_C
+#define LOOP_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "command.c"
+
+#define LOOP_FOR   0
+#define LOOP_WHILE 1
+
+//connectors returned by parse_list (must match parse.c)
+#define LIST_SEQ 0	// ;
+#define LIST_AND 1	// &&
+#define LIST_OR  2	// ||
+
+struct loop;
+
+//one command of a loop's body, or a loop nested in it
+struct loop_item
+{
+   int connector;
+   struct command cmd;
+   struct loop* loop;            //NULL for a command
+};
+
+struct loop
+{
+   int kind;
+
+   //for: the variable and the words it takes, which are expanded
+   //every time the loop starts
+   struct var_cell* var;
+   char* text;
+   char** words;
+   struct var_slot* slots;
+   int nslots;
+
+   //while: the condition
+   struct command cond;
+
+   struct loop_item* items;
+   int count;
+};
+
+int loop_run(struct loop* loop);
+void loop_free(struct loop* loop);
+
+//returns 1 if text starts with the keyword followed by a space or the end
+int loop_keyword(char* text, char* keyword)
+{
+   while(*text == ' ')
+      text++;
+
+   int len = strlen(keyword);
+   return strncmp(text, keyword, len) == 0 && (text[len] == ' ' || text[len] == '\0');
+}
+
+/*
+ * Returns 1 if a command of a list starts a loop
+ */
+int loop_starts(char* text)
+{
+   return loop_keyword(text, "for") || loop_keyword(text, "while");
+}
+
+/*
+ * Parses the words a for loop takes. Each one is expanded like the
+ *    word of a command and its slot kept.
+ * Returns 0 or -1 if they are not valid
+ */
+int loop_parse_words(struct loop* loop, char* header)
+{
+   char name[256], word[8];
+
+   next_word(&header, word, sizeof(word));
+   if(next_word(&header, name, sizeof(name)) == NULL || var_name_len(name) != (int)strlen(name))
+      return -1;
+   if(next_word(&header, word, sizeof(word)) == NULL || strcmp(word, "in") != 0)
+      return -1;
+
+   loop->var = var_find(name, strlen(name), 1);
+   loop->text = strdup(header);
+   loop->words = calloc(CMD_SIZE, sizeof(char*));
+   if(loop->var == NULL || loop->text == NULL || loop->words == NULL)
+      return -1;
+
+   int count = 0;
+   char* save = NULL;
+   char* token = strtok_r(loop->text, " ", &save);
+   while(token != NULL && count < CMD_SIZE - 1)
+   {
+      loop->words[count++] = expand_word(token);
+      token = strtok_r(NULL, " ", &save);
+   }
+
+   loop->slots = var_take_slots(&loop->nslots);
+   char** argvs[] = { loop->words };
+   var_locate_slots(loop->slots, loop->nslots, argvs, 1, NULL, 0, 0);
+
+   return 0;
+}
+
+//adds an item to a loop's body
+struct loop_item* loop_add(struct loop* loop, int connector)
+{
+   struct loop_item* grown = realloc(loop->items, (loop->count + 1) * sizeof(struct loop_item));
+   if(grown == NULL)
+      return NULL;
+   loop->items = grown;
+
+   struct loop_item* item = &loop->items[loop->count++];
+   memset(item, 0, sizeof(*item));
+   item->connector = connector;
+
+   return item;
+}
+
+/*
+ * Parses a loop from the commands of a list. header is the text of
+ *    the loop's first command and *pos the index of the one after it,
+ *    it is left after the loop's done.
+ * Returns 0 or -1 if it is not valid (the error has been printed)
+ */
+int loop_parse(char* header, char** cmds, int* connectors, int count, int* pos, struct loop* loop)
+{
+   memset(loop, 0, sizeof(*loop));
+
+   while(*header == ' ')
+      header++;
+
+   if(loop_keyword(header, "for"))
+   {
+      loop->kind = LOOP_FOR;
+      if(loop_parse_words(loop, header) == -1)
+      {
+         fprintf(stderr, "usage: for NAME in WORDS; do COMMANDS; done\n");
+         return -1;
+      }
+   }
+   else
+   {
+      loop->kind = LOOP_WHILE;
+      if(command_parse(header + 5, &loop->cond) == -1)
+         return -1;
+   }
+
+   if(*pos >= count || !loop_keyword(cmds[*pos], "do"))
+   {
+      fprintf(stderr, "syntax error: expected do\n");
+      return -1;
+   }
+
+   //the first command of the body follows do
+   char* text = cmds[*pos];
+   while(*text == ' ')
+      text++;
+   text += 2;
+   int connector = LIST_SEQ;
+
+   while(1)
+   {
+      (*pos)++;
+      while(*text == ' ')
+         text++;
+
+      if(loop_keyword(text, "done"))
+      {
+         if(text[4 + strspn(text + 4, " ")] != '\0')
+         {
+            fprintf(stderr, "syntax error: unexpected words after done\n");
+            return -1;
+         }
+         return 0;
+      }
+
+      if(*text != '\0')
+      {
+         struct loop_item* item = loop_add(loop, connector);
+         if(item == NULL)
+            return -1;
+
+         if(loop_starts(text))
+         {
+            //a nested loop takes the commands up to its own done
+            item->loop = calloc(1, sizeof(struct loop));
+            if(item->loop == NULL || loop_parse(text, cmds, connectors, count, pos, item->loop) == -1)
+               return -1;
+         }
+         else if(command_parse(text, &item->cmd) == -1)
+         {
+            loop->count--;
+            return -1;
+         }
+      }
+
+      if(*pos >= count)
+      {
+         fprintf(stderr, "syntax error: expected done\n");
+         return -1;
+      }
+
+      text = cmds[*pos];
+      connector = connectors[*pos];
+   }
+}
+
+/*
+ * Runs the commands of a loop's body once.
+ * Returns 1, 0 if the user quit or -1 if Ctrl-C interrupted it
+ */
+int loop_body(struct loop* loop)
+{
+   int i;
+   for(i = 0; i < loop->count; i++)
+   {
+      struct loop_item* item = &loop->items[i];
+
+      //short-circuit && and || based on the previous status
+      if(item->connector == LIST_AND && last_status != 0)
+         continue;
+      if(item->connector == LIST_OR && last_status == 0)
+         continue;
+
+      int ret;
+      if(item->loop != NULL)
+         ret = loop_run(item->loop);
+      else
+      {
+         var_refresh(item->cmd.slots, item->cmd.nslots);
+         ret = command_run(&item->cmd);
+      }
+
+      if(ret == 0)
+         return 0;
+      if(ret == -1 || event_interrupted || last_status == 128 + SIGINT)
+         return -1;
+   }
+
+   return 1;
+}
+
+/*
+ * Runs a loop.
+ * Returns 1, 0 if the user quit or -1 if Ctrl-C interrupted it
+ */
+int loop_run(struct loop* loop)
+{
+   int ret = 1;
+   int status = 0;
+   event_interrupted = 0;
+
+   if(loop->kind == LOOP_FOR)
+   {
+      var_refresh(loop->slots, loop->nslots);
+
+      struct glob_strings matches = { NULL, 0, 0 };
+      char** words = glob_command(loop->words, &matches);
+
+      int i;
+      for(i = 0; words[i] != NULL && ret == 1; i++)
+      {
+         var_set_cell(loop->var, words[i], -1);
+         ret = loop_body(loop);
+         status = last_status;
+      }
+
+      if(words != loop->words)
+         free(words);
+      glob_release(&matches);
+   }
+   else
+   {
+      while(ret == 1)
+      {
+         var_refresh(loop->cond.slots, loop->cond.nslots);
+         ret = command_run(&loop->cond);
+         if(ret == 0)
+            break;
+         if(event_interrupted || last_status == 128 + SIGINT)
+         {
+            ret = -1;
+            break;
+         }
+         if(last_status != 0)
+            break;
+
+         ret = loop_body(loop);
+         status = last_status;
+      }
+   }
+
+   //the status of the last command of the body, 0 if it never ran
+   last_status = status;
+   if(ret == -1)
+      last_status = 128 + SIGINT;
+
+   return ret;
+}
+
+/*
+ * Frees a parsed loop
+ */
+void loop_free(struct loop* loop)
+{
+   int i;
+   for(i = 0; i < loop->count; i++)
+   {
+      if(loop->items[i].loop != NULL)
+      {
+         loop_free(loop->items[i].loop);
+         free(loop->items[i].loop);
+      }
+      else
+         command_free(&loop->items[i].cmd);
+   }
+   free(loop->items);
+
+   if(loop->kind == LOOP_FOR)
+   {
+      var_free_slots(loop->slots, loop->nslots);
+      free(loop->words);
+      free(loop->text);
+   }
+   else
+      command_free(&loop->cond);
+}
+
+#endif //LOOP_C
@@ -6,118 +6,236 @@
  *           input.
  */
 
+//pipe2, accept4 and the CPU affinity calls are GNU extensions
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "execute.c"
 #include "log.c"
+#include "builtins.c"
+#include "record.c"
+#include "daemon.c"
+#include "command.c"
+#include "loop.c"
 
-int parse_command(char* line,
-		  char** cmd1, char** cmd2,
-		  char* infile, char* outfile);
+int parse_list(char* line, char** cmds, int* connectors, int max);
 
 int handleCommand(char* line);
 
+int handleList(char* line);
+
+int handleRecorded(char* line);
+
+int handleLast(char* line);
+
+//the most commands which may be joined in a single list
+#define LIST_SIZE 100
+
+//exit status of the most recently executed command
+int last_status = 0;
+
+//set for a one-shot invocation, whose last command replaces the shell
+int exec_last = 0;
+
+//   The replay harness includes this file to drive handleList
+//directly, so it defines MYSHELL_NO_MAIN to supply its own main.
+#ifndef MYSHELL_NO_MAIN
 int main(int argc, char* argv[])
 {
    char buff[256];
 
-   sprintf(buff, "Main process PID=%d\n", getpid());
-   log_line(buff);
+   //myshell -C socket 'line' runs the line through a daemon
+   if(argc > 3 && strcmp(argv[1], "-C") == 0)
+      return daemon_client(argv[2], argv[3]);
 
-   if(argc > 1)
-      handleCommand(argv[1]);
-   else
+   metrics_init();
+   record_open();
+
+   //   myshell 'line' or myshell -c 'line' runs a single line. Nothing
+   //is started or logged up front, and its last command is executed
+   //in place of the shell unless the line is being recorded.
+   char* oneshot = NULL;
+   if(argc > 2 && strcmp(argv[1], "-c") == 0)
+      oneshot = argv[2];
+   else if(argc > 1 && strcmp(argv[1], "-d") != 0)
+      oneshot = argv[1];
+
+   if(oneshot != NULL)
    {
-      int retCode = 1;
+      exec_last = (record_file == NULL);
+      handleRecorded(oneshot);
+      return last_status;
+   }
 
-      //continue to process while the return code is in the valid range
-      while(retCode > 0 && retCode < 9)
-      {
-         log_info("\nWaiting for user input...\t");
+   snprintf(buff, sizeof(buff), "Main process PID=%d\n", getpid());
+   log_line(buff);
+
+   //the zygote is forked while the shell is still small
+   zygote_start();
 
-         //get user input
-         char line[100];
-         printf("myshell-%% ");
-         gets(line);
+   //myshell -d socket serves lines sent by clients
+   if(argc > 2 && strcmp(argv[1], "-d") == 0)
+      return daemon_run(argv[2]);
 
-         log_line(line);
+   int retCode = 1;
 
-         //handle user input
-         retCode = handleCommand(line);
+   //someone typing at the shell sees its prompt wherever stdout goes
+   int interactive = isatty(STDIN_FILENO);
+
+   //continue to process while the return code is in the valid range
+   while(retCode > 0 && retCode < 9)
+   {
+      log_info("\nWaiting for user input...\t");
+
+      //the log is on disk while the shell sits idle
+      log_sync();
+
+      //get user input
+      char line[INPUT_MAX];
+      out_str("myshell-% ");
+      if(interactive)
+         out_flush();
+      else
+         out_end();
+
+      //Ctrl-C discards the line, the end of the input quits
+      int got = event_read_line(line, sizeof(line));
+      if(got == -1)
+      {
+         out_put("\n", 1);
+         out_end();
+         continue;
       }
+      if(got == 0)
+         break;
+
+      log_line(line);
+
+      //handle user input
+      retCode = handleRecorded(line);
    }
 
-   return 0;
+   return last_status;
 }
+#endif //MYSHELL_NO_MAIN
 
 /*
- * Handles user input and begin executing commands as needed
+ * Handles a line of input and adds it to the session recording
+ *    (MYSHELL_RECORD) with its timing and exit status
  */
-int handleCommand(char* line)
+int handleRecorded(char* line)
 {
-   //set aside and initialize memory for the commands
-   const int CMD_SIZE = 100;
-   char** cmd1 = malloc(CMD_SIZE * sizeof(char*));
-   char** cmd2 = malloc(CMD_SIZE * sizeof(char*));
+   //handleList splits the line in place so keep the original
+   char original[INPUT_MAX];
+   snprintf(original, sizeof(original), "%s", line);
 
-   int i = 0;
-   for(i = 0; i < CMD_SIZE; i++)
-   {
-      cmd1[i] = NULL;
-      cmd2[i] = NULL;
-   }
+   long long start = stats_clock();
+   int ret = handleList(line);
+   long long end = stats_clock();
 
-   //initialize memory for the in and out files
-   char infile[100];
-   char outfile[100];
+   record_line(original, start, end, last_status);
 
-   infile[0] = '\0';
-   outfile[0] = '\0';
+   return ret;
+}
 
-   //parse the command line from the user
-   int ret = parse_command(line, cmd1, cmd2, infile, outfile);
+/*
+ * Handles a list of commands joined by ;, && or ||. The whole line
+ *    is split once and a command is skipped (without forking) when
+ *    the status of the previous command does not satisfy its
+ *    connector. A loop takes the commands up to its done.
+ * Returns the code of the last handled command, or 0 if the user quit
+ */
+int handleList(char* line)
+{
+   char* cmds[LIST_SIZE];
+   int connectors[LIST_SIZE];
 
-   //   Use the return code from parse_command
-   //to determine which senerio should be performed
-   switch(ret)
+   int count = parse_list(line, cmds, connectors, LIST_SIZE);
+   if(count == -1)
    {
-      case 0:   //Quit terminal
-         break;
-      case 1:   //Simple command
-         exec_cmd(cmd1);
-         break;
-      case 2:   //Simple command with input redirection
-         exec_cmd_in(cmd1, infile);
-         break;
-      case 3:   //Simple command with output redirection (append)
-         exec_cmd_opt_in_append(cmd1, infile, outfile);
-         break;
-      case 4:   //Simple command with output redirection (overwrite)
-         exec_cmd_opt_in_write(cmd1, infile, outfile);
-         break;
-      case 5:   //Two commands piped
-         exec_pipe(cmd1, cmd2);
-         break;
-      case 6:   //Two commands piped with input redirection
-         exec_pipe_in(cmd1, cmd2, infile);
-         break;
-      case 7:   //Two commands piped with output redirection (append)
-         exec_pipe_opt_in_append(cmd1, cmd2, infile, outfile);
-         break;
-      case 8:   //Two commands piped with output redirection (overwrite)
-         exec_pipe_opt_in_write(cmd1, cmd2, infile, outfile);
+      fprintf(stderr, "syntax error: more than %d commands in a list\n", LIST_SIZE);
+      last_status = 2;
+      return 1;
+   }
+
+   //an empty line keeps the shell running
+   int ret = 1;
+
+   int i;
+   for(i = 0; i < count; i++)
+   {
+      //short-circuit && and || based on the previous status
+      int skip = (connectors[i] == LIST_AND && last_status != 0) ||
+                 (connectors[i] == LIST_OR && last_status == 0);
+
+      if(loop_starts(cmds[i]))
+      {
+         struct loop loop;
+         int next = i + 1;
+         int parsed = loop_parse(cmds[i], cmds, connectors, count, &next, &loop);
+         if(parsed == 0 && !skip)
+            ret = (loop_run(&loop) == 0) ? 0 : 1;
+         loop_free(&loop);
+
+         //the rest of the line cannot be matched up with the loop
+         if(parsed == -1)
+         {
+            last_status = 2;
+            break;
+         }
+
+         i = next - 1;
+      }
+      else if(!skip && exec_last && i == count - 1)
+         ret = handleLast(cmds[i]);
+      else if(!skip)
+         ret = handleCommand(cmds[i]);
+      else
+         continue;
+
+      //stop processing the list when the user quits
+      if(ret == 0)
          break;
-      default:   //parse_command returned a bad code
-         printf("Not handled at this time!\n");
    }
 
-   //free the allocated memory
-   free(cmd1);
-   free(cmd2);
+   return ret;
+}
+
+/*
+ * Handles user input and begin executing commands as needed
+ */
+int handleCommand(char* line)
+{
+   struct command c;
+   if(command_parse(line, &c) == -1)
+      return 1;
+
+   int ret = command_run(&c);
+   command_free(&c);
+
+   return ret;
+}
+
+/*
+ * Handles the last command of a one-shot invocation, which replaces
+ *    the shell when nothing has to be done after it
+ */
+int handleLast(char* line)
+{
+   struct command c;
+   if(command_parse(line, &c) == -1)
+      return 1;
+
+   command_exec(&c);
+
+   int ret = command_run(&c);
+   command_free(&c);
 
    return ret;
 }
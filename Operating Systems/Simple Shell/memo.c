@@ -0,0 +1,505 @@
+/*
+ * File:   memo.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  The memo prefix caches the output of commands which only
+ *            depend on their arguments and input:
+ *
+ *               memo [-e NAME]... cmd
+ *
+ *            A job is keyed on its argvs, the working directory, the
+ *            identity (device, inode, size and mtime) of the programs
+ *            it runs and of its < file, and the values of LANG, LC_ALL
+ *            and every variable named with -e. On a miss the job's
+ *            stdout is written to a file in the cache and kept if it
+ *            exits with status 0, on a hit it is sent again with
+ *            sendfile and the job is not run at all. Standard error is
+ *            never cached.
+ *
+ *            The cache lives in MYSHELL_MEMO (by default
+ *            ~/.cache/myshell/memo). Outputs are stored once under the
+ *            hash of their contents in objects/ and each key names one
+ *            of them in keys/, along with the whole key so a collision
+ *            of the hashes is a miss. The hits and misses are counted
+ *            by shellstat.
+ */
+
+#ifndef MEMO_C
+#define MEMO_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "execute.c"
+#include "metrics.c"
+#include "redirections.c"
+#include "timeout.c"
+#include "vars.c"
+
+//variables which may be named with -e
+#define MEMO_ENV 8
+
+//an input changed this soon before the job ran may change again in
+//the same mtime tick, so the output is not kept
+#define MEMO_RACY (20 * 1000000LL)
+
+//largest key, the rest of a longer one is not cached
+#define MEMO_KEY_SIZE 16384
+
+//requested by the memo prefix
+struct memo_req
+{
+   int set;
+   int nenv;
+   char env[MEMO_ENV][64];
+};
+
+//set by the memo prefix for the next job only
+struct memo_req next_memo;
+
+//the cache directory, empty until memo_dir finds it
+char memo_root[PATH_MAX];
+
+//a key being built
+struct memo_key
+{
+   char text[MEMO_KEY_SIZE];
+   int len;
+   int full;                     //the key did not fit
+   int racy;                     //an input changed a moment ago
+};
+
+/*
+ * Strips a memo prefix from the front of a line.
+ * Returns 1 if a prefix was stripped
+ *         0 if there was none
+ *        -1 if it is not valid
+ */
+int memo_prefix(char** line)
+{
+   char* cur = *line;
+   char word[64];
+
+   if(next_word(&cur, word, sizeof(word)) == NULL || strcmp(word, "memo") != 0)
+      return 0;
+
+   struct memo_req req;
+   memset(&req, 0, sizeof(req));
+   req.set = 1;
+
+   while(1)
+   {
+      char* start = cur;
+      if(next_word(&cur, word, sizeof(word)) == NULL)
+         return -1;
+
+      //the command starts at the first word which is not an option
+      if(strcmp(word, "-e") != 0)
+      {
+         cur = start;
+         break;
+      }
+
+      if(req.nenv == MEMO_ENV || next_word(&cur, req.env[req.nenv], sizeof(req.env[0])) == NULL)
+         return -1;
+      req.nenv++;
+   }
+
+   next_memo = req;
+   *line = cur;
+
+   return 1;
+}
+
+//returns a 64-bit FNV-1a hash of data, continuing from hash
+unsigned long long memo_hash(unsigned long long hash, const void* data, size_t len)
+{
+   const unsigned char* p = data;
+   size_t i;
+   for(i = 0; i < len; i++)
+   {
+      hash ^= p[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+#define MEMO_HASH_INIT 14695981039346656037ULL
+
+//creates a directory and the ones above it
+int memo_mkdirs(char* path)
+{
+   char* slash;
+   for(slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+   {
+      *slash = '\0';
+      int ret = mkdir(path, 0700);
+      *slash = '/';
+      if(ret == -1 && errno != EEXIST)
+         return -1;
+   }
+
+   return (mkdir(path, 0700) == -1 && errno != EEXIST) ? -1 : 0;
+}
+
+/*
+ * Finds the cache directory and creates it the first time.
+ * Returns 0 or -1 if there is none
+ */
+int memo_dir(void)
+{
+   if(memo_root[0] != '\0')
+      return 0;
+
+   char path[PATH_MAX];
+   char* env = getenv("MYSHELL_MEMO");
+   char* home = getenv("HOME");
+   if(env != NULL && env[0] != '\0')
+      snprintf(path, sizeof(path), "%s", env);
+   else if(home != NULL && home[0] != '\0')
+      snprintf(path, sizeof(path), "%s/.cache/myshell/memo", home);
+   else
+      return -1;
+
+   char sub[PATH_MAX + 16];
+   snprintf(sub, sizeof(sub), "%s/keys", path);
+   if(memo_mkdirs(sub) == -1)
+      return -1;
+   snprintf(sub, sizeof(sub), "%s/objects", path);
+   if(memo_mkdirs(sub) == -1)
+      return -1;
+
+   strcpy(memo_root, path);
+   return 0;
+}
+
+//appends a string to a key, nul terminated so fields cannot run together
+void memo_add(struct memo_key* key, const char* text)
+{
+   int len = strlen(text) + 1;
+   if(key->len + len > MEMO_KEY_SIZE)
+   {
+      key->full = 1;
+      return;
+   }
+
+   memcpy(key->text + key->len, text, len);
+   key->len += len;
+}
+
+//appends the identity of a file to a key
+void memo_add_file(struct memo_key* key, const char* tag, const char* path)
+{
+   struct stat sb;
+   char buff[256];
+
+   if(stat(path, &sb) == -1)
+      snprintf(buff, sizeof(buff), "%s missing", tag);
+   else
+   {
+      snprintf(buff, sizeof(buff), "%s %llu:%llu %lld %lld.%09ld", tag,
+               (unsigned long long)sb.st_dev, (unsigned long long)sb.st_ino,
+               (long long)sb.st_size, (long long)sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec);
+
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      long long age = (now.tv_sec - sb.st_mtim.tv_sec) * 1000000000LL + (now.tv_nsec - sb.st_mtim.tv_nsec);
+      if(age < MEMO_RACY)
+         key->racy = 1;
+   }
+
+   memo_add(key, buff);
+}
+
+//builds the key of a job
+void memo_build_key(struct memo_key* key, struct memo_req* req, char** cmds[], int count,
+                    char* infile, int outRed)
+{
+   char buff[PATH_MAX + 8];
+   key->len = 0;
+   key->full = 0;
+   key->racy = 0;
+
+   //an appended output is the same as an overwritten one
+   memo_add(key, outRed == OUT_NONE ? "stdout" : "file");
+
+   int i, j;
+   for(i = 0; i < count; i++)
+   {
+      snprintf(buff, sizeof(buff), "stage %d", i);
+      memo_add(key, buff);
+      for(j = 0; cmds[i][j] != NULL; j++)
+         memo_add(key, cmds[i][j]);
+
+      char path[PATH_MAX];
+      if(find_builtin(cmds[i][0]) < 0 && find_command(cmds[i][0], path, sizeof(path)))
+         memo_add_file(key, "exe", path);
+   }
+
+   if(getcwd(buff, sizeof(buff)) != NULL)
+      memo_add(key, buff);
+
+   if(infile[0] != '\0')
+      memo_add_file(key, "in", infile);
+
+   char* names[MEMO_ENV + 2] = { "LANG", "LC_ALL" };
+   int n = 2;
+   for(i = 0; i < req->nenv; i++)
+      names[n++] = req->env[i];
+
+   //an unset variable differs from an empty one
+   for(i = 0; i < n; i++)
+   {
+      char* value = getenv(names[i]);
+      memo_add(key, value != NULL ? "set" : "unset");
+      memo_add(key, names[i]);
+      if(value != NULL)
+         memo_add(key, value);
+   }
+}
+
+/*
+ * Copies a file to fd with sendfile, falling back to read and write
+ *    where the descriptors do not support it.
+ * Returns the number of bytes copied or -1 on an error
+ */
+long long memo_send(int in, int fd)
+{
+   struct stat sb;
+   if(fstat(in, &sb) == -1)
+      return -1;
+
+   long long sent = 0;
+   while(sent < sb.st_size)
+   {
+      ssize_t n = sendfile(fd, in, NULL, sb.st_size - sent);
+      if(n > 0)
+      {
+         sent += n;
+         continue;
+      }
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n == -1 && (errno == EINVAL || errno == ENOSYS) && sent == 0)
+         break;
+      return -1;
+   }
+
+   if(sent == sb.st_size)
+      return sent;
+
+   char buff[65536];
+   ssize_t n;
+   while((n = read(in, buff, sizeof(buff))) > 0)
+   {
+      ssize_t done = 0;
+      while(done < n)
+      {
+         ssize_t w = write(fd, buff + done, n - done);
+         if(w == -1 && errno == EINTR)
+            continue;
+         if(w <= 0)
+            return -1;
+         done += w;
+      }
+      sent += n;
+   }
+
+   return (n == -1) ? -1 : sent;
+}
+
+/*
+ * Sends a cached output to where the job's output goes.
+ * Returns 0 or -1 on an error
+ */
+int memo_replay(char* path, char* outfile, int outRed)
+{
+   int in = open(path, O_RDONLY | O_CLOEXEC);
+   if(in == -1)
+      return -1;
+
+   int fd = STDOUT_FILENO;
+   if(outRed != OUT_NONE)
+   {
+      fd = openOut(outfile, outRed == OUT_APPEND);
+      if(fd == -1)
+      {
+         close(in);
+         return -1;
+      }
+   }
+   else
+      out_flush();
+
+   long long sent = memo_send(in, fd);
+
+   close(in);
+   if(fd != STDOUT_FILENO)
+      close(fd);
+
+   return (sent == -1) ? -1 : 0;
+}
+
+/*
+ * Looks a key up.
+ * Returns 1 and stores the path of its output in object on a hit
+ */
+int memo_lookup(struct memo_key* key, char* keypath, char* object, int size)
+{
+   int fd = open(keypath, O_RDONLY | O_CLOEXEC);
+   if(fd == -1)
+      return 0;
+
+   //the name of the output, then the key itself
+   char name[40];
+   char* stored = malloc(MEMO_KEY_SIZE + sizeof(name));
+   int len = 0, n;
+   while(stored != NULL && len < MEMO_KEY_SIZE + (int)sizeof(name) &&
+         (n = read(fd, stored + len, MEMO_KEY_SIZE + sizeof(name) - len)) > 0)
+      len += n;
+   close(fd);
+
+   int hit = 0;
+   char* nl = (stored != NULL) ? memchr(stored, '\n', len < (int)sizeof(name) ? len : (int)sizeof(name)) : NULL;
+   if(nl != NULL)
+   {
+      int name_len = nl - stored;
+      memcpy(name, stored, name_len);
+      name[name_len] = '\0';
+
+      int rest = len - name_len - 1;
+      if(rest == key->len && memcmp(nl + 1, key->text, key->len) == 0)
+      {
+         snprintf(object, size, "%s/objects/%s", memo_root, name);
+         hit = (access(object, R_OK) == 0);
+      }
+   }
+
+   free(stored);
+   return hit;
+}
+
+/*
+ * Stores the output of a job under the hash of its contents and
+ *    points its key at it
+ */
+void memo_store(struct memo_key* key, char* keypath, char* temp)
+{
+   int fd = open(temp, O_RDONLY | O_CLOEXEC);
+   if(fd == -1)
+      return;
+
+   struct stat sb;
+   unsigned long long hash = MEMO_HASH_INIT;
+   if(fstat(fd, &sb) == 0 && sb.st_size > 0)
+   {
+      void* data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(data == MAP_FAILED)
+      {
+         close(fd);
+         return;
+      }
+      hash = memo_hash(hash, data, sb.st_size);
+      munmap(data, sb.st_size);
+   }
+   close(fd);
+
+   char name[40];
+   snprintf(name, sizeof(name), "%016llx-%lld", hash, (long long)sb.st_size);
+
+   //an identical output already stored is shared
+   char object[PATH_MAX + 64];
+   snprintf(object, sizeof(object), "%s/objects/%s", memo_root, name);
+   if(link(temp, object) == -1 && errno != EEXIST)
+      return;
+
+   //the key is written aside and renamed so readers never see half of it
+   char keytemp[PATH_MAX + 64];
+   snprintf(keytemp, sizeof(keytemp), "%s.%d", keypath, getpid());
+   fd = open(keytemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+   if(fd == -1)
+      return;
+
+   struct iovec iov[3] = {
+      { name, strlen(name) }, { "\n", 1 }, { key->text, key->len }
+   };
+   ssize_t total = iov[0].iov_len + 1 + key->len;
+   if(writev(fd, iov, 3) == total && close(fd) == 0)
+      rename(keytemp, keypath);
+   else
+      unlink(keytemp);
+}
+
+/*
+ * Runs a job under the memo prefix, replaying its output instead when
+ *    it has been cached.
+ * Returns the exit status of the job
+ */
+int memo_run(struct memo_req* req, char** cmds[], int count, char* infile, char* outfile, int outRed)
+{
+   if(memo_dir() == -1)
+   {
+      fprintf(stderr, "memo: no cache directory, set MYSHELL_MEMO\n");
+      return exec_pipeline(cmds, count, infile, outfile, outRed);
+   }
+
+   //the key sees the variables the job will be given
+   var_sync_env();
+
+   struct memo_key* key = malloc(sizeof(struct memo_key));
+   if(key == NULL)
+      return exec_pipeline(cmds, count, infile, outfile, outRed);
+   memo_build_key(key, req, cmds, count, infile, outRed);
+
+   unsigned long long hash = memo_hash(MEMO_HASH_INIT, key->text, key->len);
+   char keypath[PATH_MAX + 64];
+   snprintf(keypath, sizeof(keypath), "%s/keys/%016llx", memo_root, hash);
+
+   char object[PATH_MAX + 64];
+   if(!key->full && memo_lookup(key, keypath, object, sizeof(object)) &&
+      memo_replay(object, outfile, outRed) == 0)
+   {
+      metrics_count(C_MEMO_HITS);
+      log_line("memo: replayed the cached output\n");
+      free(key);
+      return 0;
+   }
+
+   metrics_count(C_MEMO_MISSES);
+
+   //the job writes to a file in the cache which is then sent on
+   char temp[PATH_MAX + 64];
+   snprintf(temp, sizeof(temp), "%s/objects/tmp.XXXXXX", memo_root);
+   int fd = mkstemp(temp);
+   if(fd == -1)
+   {
+      free(key);
+      return exec_pipeline(cmds, count, infile, outfile, outRed);
+   }
+   close(fd);
+
+   int status = exec_pipeline(cmds, count, infile, temp, OUT_WRITE);
+
+   if(memo_replay(temp, outfile, outRed) == -1)
+      fprintf(stderr, "memo: could not send the output\n");
+
+   if(status == 0 && !key->full && !key->racy)
+      memo_store(key, keypath, temp);
+
+   unlink(temp);
+   free(key);
+
+   return status;
+}
+
+#endif //MEMO_C
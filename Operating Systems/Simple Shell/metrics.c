@@ -0,0 +1,415 @@
+/*
+ * File:   metrics.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Counters and latency histograms describing how the
+ *            shell itself behaves (fork, PATH lookup, execvp,
+ *            wait and parse_command). The data lives in a shared
+ *            mapping so children can record failures which happen
+ *            after fork. It is printed by the shellstat builtin and,
+ *            only when MYSHELL_METRICS names a file, written there in
+ *            Prometheus text format when the shell exits or receives
+ *            SIGUSR1/SIGTERM/SIGHUP.
+ */
+
+#ifndef METRICS_C
+#define METRICS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "stats.c"
+
+//   Histograms are log-linear (HDR style): values below 16ns get
+//their own bucket and every power of two above that is split into
+//16 sub-buckets, giving ~6% relative error up to 2^40ns (~18 min).
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_MAX_BIT  40
+#define HIST_BUCKETS  ((HIST_MAX_BIT - HIST_SUB_BITS + 2) * HIST_SUB)
+
+//histograms kept by the shell
+#define H_FORK   0	//time for fork() to return in the parent
+#define H_LOOKUP 1	//time to search PATH for a command (in the child)
+#define H_PARSE  2	//time spent in parse_command
+#define H_WAIT   3	//time spent blocked reaping a child
+#define NUM_HISTS 4
+
+//counters kept by the shell
+#define C_COMMANDS      0
+#define C_FORKS         1
+#define C_FORK_FAILURES 2
+#define C_EXEC_FAILURES 3
+#define C_LOOKUP_MISSES 4
+#define C_PARSES        5
+#define C_WAITS         6
+#define C_TIMEOUTS      7
+#define C_MEMO_HITS     8
+#define C_MEMO_MISSES   9
+#define NUM_COUNTERS    10
+
+struct histogram
+{
+   unsigned long long count;
+   unsigned long long sum;
+   unsigned long long max;
+   unsigned long long buckets[HIST_BUCKETS];
+};
+
+struct metrics
+{
+   unsigned long long counters[NUM_COUNTERS];
+   struct histogram hists[NUM_HISTS];
+};
+
+//names used by shellstat and the Prometheus output
+const char* counter_names[NUM_COUNTERS] = {
+   "commands", "forks", "fork_failures", "exec_failures",
+   "path_lookup_misses", "parses", "waits", "timeouts",
+   "memo_hits", "memo_misses"
+};
+const char* hist_names[NUM_HISTS] = {
+   "fork", "path_lookup", "parse", "wait"
+};
+
+//shared with every child, NULL until metrics_init is called
+struct metrics* shell_metrics = NULL;
+
+//only the process which called metrics_init writes the metrics file
+pid_t metrics_owner = -1;
+char metrics_path[512];
+
+void metrics_write_file(void);
+
+//returns the histogram bucket which holds value
+int hist_bucket(unsigned long long value)
+{
+   if(value < HIST_SUB)
+      return (int)value;
+
+   int bit = 63 - __builtin_clzll(value);
+   if(bit > HIST_MAX_BIT)
+      return HIST_BUCKETS - 1;
+
+   int sub = (int)((value >> (bit - HIST_SUB_BITS)) & (HIST_SUB - 1));
+   return (bit - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+//returns the largest value which falls in a bucket
+unsigned long long hist_upper(int bucket)
+{
+   if(bucket < HIST_SUB)
+      return bucket;
+
+   int bit = bucket / HIST_SUB + HIST_SUB_BITS - 1;
+   unsigned long long sub = bucket % HIST_SUB;
+   unsigned long long width = 1ULL << (bit - HIST_SUB_BITS);
+
+   return ((HIST_SUB + sub) << (bit - HIST_SUB_BITS)) + width - 1;
+}
+
+//increments a counter (safe to call from children)
+void metrics_count(int counter)
+{
+   if(shell_metrics != NULL)
+      __atomic_add_fetch(&shell_metrics->counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+//records a latency in nanoseconds (safe to call from children)
+void metrics_record(int hist, long long ns)
+{
+   if(shell_metrics == NULL)
+      return;
+
+   if(ns < 0)
+      ns = 0;
+
+   struct histogram* h = &shell_metrics->hists[hist];
+   unsigned long long value = (unsigned long long)ns;
+
+   __atomic_add_fetch(&h->buckets[hist_bucket(value)], 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+   __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+
+   unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+   while(value > max &&
+         !__atomic_compare_exchange_n(&h->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+}
+
+/*
+ * Returns the value below which the given fraction of the
+ *    recorded values fall
+ */
+unsigned long long hist_percentile(struct histogram* h, double fraction)
+{
+   if(h->count == 0)
+      return 0;
+
+   unsigned long long target = (unsigned long long)(h->count * fraction);
+   if(target == 0)
+      target = 1;
+
+   unsigned long long seen = 0;
+   int i;
+   for(i = 0; i < HIST_BUCKETS; i++)
+   {
+      seen += h->buckets[i];
+      if(seen >= target)
+         return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+   }
+
+   return h->max;
+}
+
+//writes the metrics file and lets the signal terminate the shell
+void metrics_fatal_signal(int sig)
+{
+   metrics_write_file();
+
+   signal(sig, SIG_DFL);
+   raise(sig);
+}
+
+//writes the metrics file and keeps running
+void metrics_dump_signal(int sig)
+{
+   metrics_write_file();
+}
+
+//writes the metrics file when the shell exits
+void metrics_at_exit(void)
+{
+   metrics_write_file();
+}
+
+/*
+ * Sets up the shared metrics and, if MYSHELL_METRICS names an output
+ *    file, the handlers which write them out. Nothing is written
+ *    otherwise.
+ */
+void metrics_init(void)
+{
+   void* mem = mmap(NULL, sizeof(struct metrics), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(mem == MAP_FAILED)
+      return;
+
+   shell_metrics = mem;
+   metrics_owner = getpid();
+
+   char* path = getenv("MYSHELL_METRICS");
+   if(path == NULL || path[0] == '\0')
+      return;
+
+   //the file is written from signal handlers so resolve it once
+   char cwd[256];
+   if(path[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+      snprintf(metrics_path, sizeof(metrics_path), "%s/%s", cwd, path);
+   else
+      snprintf(metrics_path, sizeof(metrics_path), "%s", path);
+
+   atexit(metrics_at_exit);
+
+   struct sigaction sa;
+   memset(&sa, 0, sizeof(sa));
+   sigemptyset(&sa.sa_mask);
+   sa.sa_flags = SA_RESTART;
+
+   sa.sa_handler = metrics_dump_signal;
+   sigaction(SIGUSR1, &sa, NULL);
+
+   sa.sa_handler = metrics_fatal_signal;
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGHUP, &sa, NULL);
+}
+
+/*
+ * Prints the counters and latency percentiles (shellstat builtin)
+ */
+void metrics_print(FILE* out)
+{
+   if(shell_metrics == NULL)
+   {
+      fprintf(out, "metrics are not enabled\n");
+      return;
+   }
+
+   int i;
+   for(i = 0; i < NUM_COUNTERS; i++)
+      fprintf(out, "%-20s %llu\n", counter_names[i], shell_metrics->counters[i]);
+
+   unsigned long long lookups = shell_metrics->counters[C_MEMO_HITS] + shell_metrics->counters[C_MEMO_MISSES];
+   if(lookups > 0)
+      fprintf(out, "%-20s %.1f%%\n", "memo_hit_rate", 100.0 * shell_metrics->counters[C_MEMO_HITS] / lookups);
+
+   fprintf(out, "\n%-12s %8s %10s %10s %10s %10s %10s\n",
+           "latency(us)", "count", "mean", "p50", "p90", "p99", "max");
+
+   for(i = 0; i < NUM_HISTS; i++)
+   {
+      struct histogram* h = &shell_metrics->hists[i];
+      double mean = h->count > 0 ? (double)h->sum / h->count : 0;
+
+      fprintf(out, "%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+              hist_names[i], h->count, mean / 1e3,
+              hist_percentile(h, 0.50) / 1e3,
+              hist_percentile(h, 0.90) / 1e3,
+              hist_percentile(h, 0.99) / 1e3,
+              h->max / 1e3);
+   }
+}
+
+//   The writers below only use write() and integer formatting so
+//the file can be produced from a signal handler.
+
+//appends a string to buff
+int put_str(char* buff, int len, const char* str)
+{
+   while(*str != '\0')
+      buff[len++] = *str++;
+   return len;
+}
+
+//appends an unsigned integer to buff
+int put_u64(char* buff, int len, unsigned long long value)
+{
+   char digits[24];
+   int n = 0;
+
+   do
+   {
+      digits[n++] = '0' + value % 10;
+      value /= 10;
+   } while(value > 0);
+
+   while(n > 0)
+      buff[len++] = digits[--n];
+   return len;
+}
+
+//appends a count of nanoseconds as seconds with nine decimals
+int put_seconds(char* buff, int len, unsigned long long ns)
+{
+   len = put_u64(buff, len, ns / 1000000000ULL);
+   buff[len++] = '.';
+
+   unsigned long long frac = ns % 1000000000ULL;
+   unsigned long long place;
+   for(place = 100000000ULL; place > 0; place /= 10)
+      buff[len++] = '0' + (frac / place) % 10;
+   return len;
+}
+
+//writes buff if it is close to full
+int flush_if_full(int fd, char* buff, int len, int size)
+{
+   if(len > size - 256)
+   {
+      write(fd, buff, len);
+      return 0;
+   }
+   return len;
+}
+
+/*
+ * Writes the metrics in Prometheus text format to fd
+ */
+void metrics_write_prometheus(int fd)
+{
+   char buff[4096];
+   int len = 0;
+
+   int i;
+   for(i = 0; i < NUM_COUNTERS; i++)
+   {
+      len = put_str(buff, len, "# TYPE myshell_");
+      len = put_str(buff, len, counter_names[i]);
+      len = put_str(buff, len, "_total counter\nmyshell_");
+      len = put_str(buff, len, counter_names[i]);
+      len = put_str(buff, len, "_total ");
+      len = put_u64(buff, len, shell_metrics->counters[i]);
+      len = put_str(buff, len, "\n");
+      len = flush_if_full(fd, buff, len, sizeof(buff));
+   }
+
+   for(i = 0; i < NUM_HISTS; i++)
+   {
+      struct histogram* h = &shell_metrics->hists[i];
+
+      len = put_str(buff, len, "# TYPE myshell_");
+      len = put_str(buff, len, hist_names[i]);
+      len = put_str(buff, len, "_seconds histogram\n");
+
+      //only the buckets which hold values are written, cumulatively
+      unsigned long long seen = 0;
+      int b;
+      for(b = 0; b < HIST_BUCKETS; b++)
+      {
+         if(h->buckets[b] == 0)
+            continue;
+
+         seen += h->buckets[b];
+
+         len = put_str(buff, len, "myshell_");
+         len = put_str(buff, len, hist_names[i]);
+         len = put_str(buff, len, "_seconds_bucket{le=\"");
+         len = put_seconds(buff, len, hist_upper(b));
+         len = put_str(buff, len, "\"} ");
+         len = put_u64(buff, len, seen);
+         len = put_str(buff, len, "\n");
+         len = flush_if_full(fd, buff, len, sizeof(buff));
+      }
+
+      len = put_str(buff, len, "myshell_");
+      len = put_str(buff, len, hist_names[i]);
+      len = put_str(buff, len, "_seconds_bucket{le=\"+Inf\"} ");
+      len = put_u64(buff, len, h->count);
+      len = put_str(buff, len, "\nmyshell_");
+      len = put_str(buff, len, hist_names[i]);
+      len = put_str(buff, len, "_seconds_sum ");
+      len = put_seconds(buff, len, h->sum);
+      len = put_str(buff, len, "\nmyshell_");
+      len = put_str(buff, len, hist_names[i]);
+      len = put_str(buff, len, "_seconds_count ");
+      len = put_u64(buff, len, h->count);
+      len = put_str(buff, len, "\n");
+      len = flush_if_full(fd, buff, len, sizeof(buff));
+   }
+
+   write(fd, buff, len);
+}
+
+/*
+ * Writes the metrics file through a temporary file so readers
+ *    never see a partial file
+ */
+void metrics_write_file(void)
+{
+   if(shell_metrics == NULL || metrics_path[0] == '\0' || getpid() != metrics_owner)
+      return;
+
+   char tmp[520];
+   int len = put_str(tmp, 0, metrics_path);
+   len = put_str(tmp, len, ".tmp");
+   tmp[len] = '\0';
+
+   int fd = open(tmp, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+   if(fd == -1)
+      return;
+
+   metrics_write_prometheus(fd);
+   close(fd);
+
+   rename(tmp, metrics_path);
+}
+
+#endif //METRICS_C
@@ -0,0 +1,98 @@
+/*
+ * File:   myshell.h
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Interface of libmyshell, which parses and runs the shell's
+ *            pipelines from another program without a shell process
+ *            in between. Nothing in the library is global, so any
+ *            number of threads may parse and run commands at once.
+ *
+ *               myshell_cmd* cmd = myshell_parse("sort -u < in | head", err, sizeof(err));
+ *               struct myshell_job job;
+ *               myshell_run(cmd, -1, out_fd, -1, &job);
+ *               myshell_free(cmd);
+ *
+ *            The line uses the shell's syntax: words separated by
+ *            spaces, | between stages, < for the first stage and
+ *            > or >> for the last one.
+ */
+
+#ifndef MYSHELL_H
+#define MYSHELL_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the most stages a pipeline may be made of
+#define MYSHELL_MAX_STAGES 16
+
+//a parsed command line, opaque to the caller
+typedef struct myshell_cmd myshell_cmd;
+
+//one stage of a running or finished pipeline
+struct myshell_stage
+{
+   pid_t pid;              //-1 if the stage was not started
+   int status;             //exit status (128 + signal when killed)
+   long long wall;         //nanoseconds from the start until it was reaped
+   struct rusage usage;
+};
+
+//a pipeline started by myshell_spawn
+struct myshell_job
+{
+   int count;              //number of stages started
+   int status;             //exit status of the pipeline (its last stage)
+   long long start;        //monotonic start time in nanoseconds
+   struct myshell_stage stages[MYSHELL_MAX_STAGES];
+};
+
+/*
+ * Parses a line into a command. On failure a message is stored in
+ *    err (when it is not NULL).
+ * Returns the command or NULL if the line is not a valid pipeline
+ */
+myshell_cmd* myshell_parse(const char* line, char* err, size_t err_size);
+
+//returns the number of stages in a command
+int myshell_stage_count(const myshell_cmd* cmd);
+
+//returns the argument vector of a stage (NULL terminated)
+char* const* myshell_stage_argv(const myshell_cmd* cmd, int index);
+
+//frees a command returned by myshell_parse
+void myshell_free(myshell_cmd* cmd);
+
+/*
+ * Starts every stage of a command. in_fd, out_fd and err_fd become
+ *    stdin of the first stage, stdout of the last stage and stderr of
+ *    all of them; -1 leaves the caller's own descriptor in place.
+ *    Redirections in the line take precedence over in_fd and out_fd.
+ * Returns 0 or -1 with errno set if not every stage could be started
+ *    (the started ones are still in job and must be waited for)
+ */
+int myshell_spawn(const myshell_cmd* cmd, int in_fd, int out_fd, int err_fd, struct myshell_job* job);
+
+/*
+ * Waits for every stage of a job and fills in their statuses, wall
+ *    times and resource usage. Each stage is reaped as it exits.
+ * Returns the exit status of the job
+ */
+int myshell_wait(struct myshell_job* job);
+
+/*
+ * Spawns a command and waits for it.
+ * Returns the exit status of the job (127 if a stage could not be run)
+ */
+int myshell_run(const myshell_cmd* cmd, int in_fd, int out_fd, int err_fd, struct myshell_job* job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MYSHELL_H
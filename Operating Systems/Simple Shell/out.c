@@ -0,0 +1,229 @@
+/*
+ * File:   out.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  The shell's own output to stdout (the prompt, its messages
+ *            and the output of builtins) is gathered here as pieces
+ *            of a message and written with a single writev. Small
+ *            pieces are copied into a buffer; large ones are pointed
+ *            to where they are and must stay there until out_end.
+ *
+ *            On a terminal every message is written when it ends.
+ *            Otherwise messages are kept until the buffer fills, the
+ *            shell forks (the buffer is written first, so a child
+ *            never starts with a copy of it), a redirection of the
+ *            shell's own stdout is undone, something else is about
+ *            to write to stdout, or the shell exits.
+ */
+
+#ifndef OUT_C
+#define OUT_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define OUT_IOVS 16
+#define OUT_BUFF 8192
+
+//pieces of at least this size are not copied
+#define OUT_DIRECT 512
+
+struct out
+{
+   int fd;
+   int tty;                      //-1 until known
+   int ready;                    //the fork and exit hooks are set
+   struct iovec iov[OUT_IOVS];
+   int count;
+   int borrowed;                 //a piece points into the caller's memory
+   char buff[OUT_BUFF];
+   size_t used;
+};
+
+struct out shell_out = { STDOUT_FILENO, -1 };
+
+/*
+ * Writes everything gathered so far with one writev, or as few as it
+ *    takes when stdout accepts only part of it
+ */
+void out_flush(void)
+{
+   struct out* o = &shell_out;
+
+   struct iovec* iov = o->iov;
+   int count = o->count;
+   while(count > 0)
+   {
+      ssize_t n = writev(o->fd, iov, count);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n == -1)
+         break;
+
+      //skip what was written, which may end inside a piece
+      while(count > 0 && (size_t)n >= iov->iov_len)
+      {
+         n -= iov->iov_len;
+         iov++;
+         count--;
+      }
+      if(count > 0)
+      {
+         iov->iov_base = (char*)iov->iov_base + n;
+         iov->iov_len -= n;
+      }
+   }
+
+   o->count = 0;
+   o->used = 0;
+   o->borrowed = 0;
+}
+
+//a forked child drops what it may have been handed
+void out_forget(void)
+{
+   shell_out.count = 0;
+   shell_out.used = 0;
+   shell_out.borrowed = 0;
+   shell_out.tty = -1;
+}
+
+//sets the hooks which flush before a fork and at exit
+void out_init(void)
+{
+   if(shell_out.ready)
+      return;
+
+   pthread_atfork(out_flush, NULL, out_forget);
+   atexit(out_flush);
+   shell_out.ready = 1;
+}
+
+//adds the len bytes just placed at the end of the buffer as a piece
+void out_claim(size_t len)
+{
+   struct out* o = &shell_out;
+   char* start = o->buff + o->used;
+   o->used += len;
+
+   //the last piece is extended when this one follows it
+   struct iovec* last = (o->count > 0) ? &o->iov[o->count - 1] : NULL;
+   if(last != NULL && (char*)last->iov_base + last->iov_len == start)
+      last->iov_len += len;
+   else
+   {
+      o->iov[o->count].iov_base = start;
+      o->iov[o->count].iov_len = len;
+      o->count++;
+   }
+}
+
+/*
+ * Adds len bytes of data to the message
+ */
+void out_put(const char* data, size_t len)
+{
+   struct out* o = &shell_out;
+
+   if(len == 0)
+      return;
+   out_init();
+
+   if(o->count == OUT_IOVS)
+      out_flush();
+
+   if(len >= OUT_DIRECT)
+   {
+      o->iov[o->count].iov_base = (void*)data;
+      o->iov[o->count].iov_len = len;
+      o->count++;
+      o->borrowed = 1;
+      return;
+   }
+
+   if(o->used + len > OUT_BUFF)
+      out_flush();
+
+   memcpy(o->buff + o->used, data, len);
+   out_claim(len);
+}
+
+//adds a string to the message
+void out_str(const char* s)
+{
+   out_put(s, strlen(s));
+}
+
+/*
+ * Adds formatted text to the message, straight into the buffer
+ */
+void out_printf(const char* format, ...)
+{
+   struct out* o = &shell_out;
+   out_init();
+
+   if(o->count == OUT_IOVS)
+      out_flush();
+
+   va_list args;
+   va_start(args, format);
+   size_t room = OUT_BUFF - o->used;
+   int len = vsnprintf(o->buff + o->used, room, format, args);
+   va_end(args);
+
+   if(len < 0)
+      return;
+
+   if((size_t)len >= room)
+   {
+      out_flush();
+
+      if(len < OUT_BUFF)
+      {
+         va_start(args, format);
+         vsnprintf(o->buff, OUT_BUFF, format, args);
+         va_end(args);
+      }
+      else
+      {
+         //text larger than the whole buffer is formatted on its own
+         char* text = malloc(len + 1);
+         if(text == NULL)
+            return;
+
+         va_start(args, format);
+         vsnprintf(text, len + 1, format, args);
+         va_end(args);
+
+         out_put(text, len);
+         out_flush();
+         free(text);
+         return;
+      }
+   }
+
+   out_claim(len);
+}
+
+/*
+ * Ends a message, which is written now if stdout is a terminal or a
+ *    piece of it is still in the caller's memory
+ */
+void out_end(void)
+{
+   struct out* o = &shell_out;
+
+   if(o->tty == -1)
+      o->tty = isatty(o->fd);
+
+   if(o->count > 0 && (o->tty || o->borrowed))
+      out_flush();
+}
+
+#endif //OUT_C
@@ -0,0 +1,427 @@
+/*
+ * File:   parallel.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Data-parallel pipeline stages:
+ *
+ *               producer | parallel [-j N] [-b SIZE] [-u] filter args
+ *
+ *            The stage's process becomes a coordinator. It cuts its
+ *            input into blocks of about SIZE bytes (1M by default) on
+ *            line boundaries and runs one copy of the filter per block,
+ *            up to N (the number of CPUs) at once. Each copy reads its
+ *            block from a memfd and writes to another, so the
+ *            coordinator never copies output through user space: it is
+ *            sent on with sendfile, in block order by default or as
+ *            soon as each copy finishes with -u. A regular file as
+ *            input is cut without being read, using sendfile too.
+ */
+
+#ifndef PARALLEL_C
+#define PARALLEL_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+
+#include "log.c"
+#include "stats.c"
+
+#define PARALLEL_BLOCK (1024 * 1024)
+#define PARALLEL_MAX_JOBS 256
+
+//one copy of the filter working on one block
+struct par_job
+{
+   pid_t pid;           //-1 when the slot is free
+   long long seq;       //number of the block
+   int in_fd;           //memfd holding the block
+   int out_fd;          //memfd collecting the output
+   int done;
+   int status;
+};
+
+//input left over after the last line of the previous block
+struct par_input
+{
+   char* buff;
+   int len;
+   int size;
+   int eof;
+   int regular;         //stdin is a regular file, cut it in place
+   off_t offset;
+   off_t end;
+};
+
+/*
+ * Copies len bytes from the current offset of in to out with
+ *    sendfile, falling back to read and write.
+ * Returns 0 or -1 on error
+ */
+int par_copy(int out, int in, off_t* offset, off_t len)
+{
+   while(len > 0)
+   {
+      ssize_t n = sendfile(out, in, offset, len > (1 << 30) ? (1 << 30) : len);
+      if(n == -1 && errno == EINTR)
+         continue;
+
+      if(n == -1 && (errno == EINVAL || errno == ENOSYS))
+      {
+         char buff[65536];
+         n = pread(in, buff, len < (off_t)sizeof(buff) ? len : (off_t)sizeof(buff), *offset);
+         if(n <= 0)
+            return -1;
+
+         ssize_t w = 0;
+         while(w < n)
+         {
+            ssize_t m = write(out, buff + w, n - w);
+            if(m == -1 && errno == EINTR)
+               continue;
+            if(m <= 0)
+               return -1;
+            w += m;
+         }
+         *offset += n;
+      }
+      else if(n <= 0)
+         return -1;
+
+      len -= n;
+   }
+
+   return 0;
+}
+
+/*
+ * Finds where a block of a regular file should end: after the first
+ *    newline at or past target.
+ * Returns the offset just past that newline, or the end of the file
+ */
+off_t par_boundary(struct par_input* in, off_t target)
+{
+   char window[65536];
+
+   while(target < in->end)
+   {
+      ssize_t n = pread(STDIN_FILENO, window, sizeof(window), target);
+      if(n <= 0)
+         break;
+
+      char* nl = memchr(window, '\n', n);
+      if(nl != NULL)
+         return target + (nl - window) + 1;
+
+      target += n;
+   }
+
+   return in->end;
+}
+
+/*
+ * Moves the next block of input into a new memfd, rewound for the
+ *    worker to read.
+ * Returns the memfd, or -1 at the end of the input
+ */
+int par_next_block(struct par_input* in, int block)
+{
+   if(in->regular)
+   {
+      if(in->offset >= in->end)
+         return -1;
+
+      off_t stop = par_boundary(in, in->offset + block);
+      off_t start = in->offset;
+
+      int fd = memfd_create("parallel-in", MFD_CLOEXEC);
+      if(fd == -1 || par_copy(fd, STDIN_FILENO, &in->offset, stop - start) == -1)
+      {
+         if(fd != -1)
+            close(fd);
+         return -1;
+      }
+
+      lseek(fd, 0, SEEK_SET);
+      return fd;
+   }
+
+   //fill the buffer until it holds a whole line past the block size
+   int cut = -1;
+   while(cut == -1)
+   {
+      if(in->len >= block)
+      {
+         char* nl = memchr(in->buff + block - 1, '\n', in->len - block + 1);
+         if(nl == NULL)
+            nl = memrchr(in->buff, '\n', block);
+         if(nl != NULL)
+            cut = nl - in->buff + 1;
+      }
+      if(cut != -1 || in->eof)
+         break;
+
+      //a line longer than the buffer makes it grow
+      if(in->len == in->size)
+      {
+         char* grown = realloc(in->buff, in->size * 2);
+         if(grown == NULL)
+            break;
+         in->buff = grown;
+         in->size *= 2;
+      }
+
+      ssize_t n = read(STDIN_FILENO, in->buff + in->len, in->size - in->len);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n <= 0)
+         in->eof = 1;
+      else
+         in->len += n;
+   }
+
+   if(cut == -1)
+      cut = in->len;
+   if(cut == 0)
+      return -1;
+
+   int fd = memfd_create("parallel-in", MFD_CLOEXEC);
+   if(fd == -1)
+      return -1;
+
+   int w = 0;
+   while(w < cut)
+   {
+      ssize_t n = write(fd, in->buff + w, cut - w);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n <= 0)
+      {
+         close(fd);
+         return -1;
+      }
+      w += n;
+   }
+
+   memmove(in->buff, in->buff + cut, in->len - cut);
+   in->len -= cut;
+
+   lseek(fd, 0, SEEK_SET);
+   return fd;
+}
+
+/*
+ * Starts a copy of the filter on one block.
+ * Returns 0 or -1 if it could not be started
+ */
+int par_start(struct par_job* job, char** cmd, int in_fd, long long seq)
+{
+   job->out_fd = memfd_create("parallel-out", MFD_CLOEXEC);
+   if(job->out_fd == -1)
+      return -1;
+
+   job->in_fd = in_fd;
+   job->seq = seq;
+   job->done = 0;
+   job->status = 0;
+   job->pid = fork();
+
+   if(job->pid == 0)
+   {
+      dup2(in_fd, STDIN_FILENO);
+      dup2(job->out_fd, STDOUT_FILENO);
+
+      execvp(cmd[0], cmd);
+      fprintf(stderr, "%s: command not found\n", cmd[0]);
+      exit(127);
+   }
+
+   if(job->pid < 0)
+   {
+      close(job->out_fd);
+      job->pid = -1;
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Sends the output of a finished copy on and frees its slot
+ */
+void par_emit(struct par_job* job)
+{
+   off_t offset = 0;
+   struct stat sb;
+
+   if(fstat(job->out_fd, &sb) == 0 && sb.st_size > 0)
+      par_copy(STDOUT_FILENO, job->out_fd, &offset, sb.st_size);
+
+   close(job->in_fd);
+   close(job->out_fd);
+   job->pid = -1;
+}
+
+/*
+ * Runs a parallel stage in the current process (the stage's child):
+ *    parallel [-j N] [-b SIZE] [-u] cmd args.
+ * Returns the exit status of the stage, that of the last copy which
+ *    failed or 0
+ */
+int parallel_stage(char** argv)
+{
+   long workers = sysconf(_SC_NPROCESSORS_ONLN);
+   long block = PARALLEL_BLOCK;
+   int ordered = 1;
+
+   int i = 1;
+   while(argv[i] != NULL && argv[i][0] == '-')
+   {
+      if(strcmp(argv[i], "-u") == 0)
+         ordered = 0;
+      else if(strcmp(argv[i], "-j") == 0 && argv[i + 1] != NULL)
+         workers = atol(argv[++i]);
+      else if(strcmp(argv[i], "-b") == 0 && argv[i + 1] != NULL)
+      {
+         char* end;
+         block = strtol(argv[++i], &end, 10);
+         if(*end == 'K' || *end == 'k')
+            block <<= 10;
+         else if(*end == 'M' || *end == 'm')
+            block <<= 20;
+      }
+      else
+         break;
+      i++;
+   }
+
+   char** cmd = argv + i;
+   if(cmd[0] == NULL || workers < 1 || block < 1)
+   {
+      fprintf(stderr, "usage: parallel [-j N] [-b SIZE] [-u] command\n");
+      return 2;
+   }
+   if(workers > PARALLEL_MAX_JOBS)
+      workers = PARALLEL_MAX_JOBS;
+
+   char buff[256];
+   snprintf(buff, sizeof(buff), "Parallel stage: %ld workers, %ld byte blocks, %s: %s\n",
+            workers, block, ordered ? "ordered" : "unordered", cmd[0]);
+   log_line(buff);
+
+   struct par_input in;
+   memset(&in, 0, sizeof(in));
+
+   struct stat sb;
+   if(fstat(STDIN_FILENO, &sb) == 0 && S_ISREG(sb.st_mode))
+   {
+      in.regular = 1;
+      in.offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+      in.end = sb.st_size;
+   }
+   else
+   {
+      in.size = block * 2;
+      in.buff = malloc(in.size);
+      if(in.buff == NULL)
+         return 1;
+   }
+
+   struct par_job jobs[PARALLEL_MAX_JOBS];
+   for(i = 0; i < workers; i++)
+      jobs[i].pid = -1;
+
+   long long next_seq = 0, emit_seq = 0;
+   int running = 0, status = 0, more = 1;
+
+   while(1)
+   {
+      //start blocks while there are free slots (and, when ordered,
+      //while the output waiting to be written stays bounded)
+      while(more && running < workers && (!ordered || next_seq < emit_seq + workers))
+      {
+         int fd = par_next_block(&in, block);
+         if(fd == -1)
+         {
+            more = 0;
+            break;
+         }
+
+         for(i = 0; jobs[i].pid != -1; i++)
+            ;
+
+         if(par_start(&jobs[i], cmd, fd, next_seq) == -1)
+         {
+            close(fd);
+            more = 0;
+            status = 1;
+            break;
+         }
+
+         next_seq++;
+         running++;
+      }
+
+      int pending = 0;
+      for(i = 0; i < workers; i++)
+         pending |= (jobs[i].pid != -1);
+      if(!pending)
+         break;
+
+      int wstatus;
+      pid_t pid = waitpid(-1, &wstatus, 0);
+      if(pid == -1)
+      {
+         if(errno == EINTR)
+            continue;
+         break;
+      }
+
+      for(i = 0; i < workers; i++)
+      {
+         if(jobs[i].pid == pid)
+         {
+            jobs[i].done = 1;
+            jobs[i].status = stats_exit_code(wstatus);
+            if(jobs[i].status != 0)
+               status = jobs[i].status;
+            running--;
+
+            //no point cutting more blocks for a command which cannot run
+            if(jobs[i].status == 127)
+               more = 0;
+
+            if(!ordered)
+               par_emit(&jobs[i]);
+         }
+      }
+
+      //write out every block which is next in line
+      int found = 1;
+      while(ordered && found)
+      {
+         found = 0;
+         for(i = 0; i < workers; i++)
+         {
+            if(jobs[i].pid != -1 && jobs[i].done && jobs[i].seq == emit_seq)
+            {
+               par_emit(&jobs[i]);
+               emit_seq++;
+               found = 1;
+            }
+         }
+      }
+   }
+
+   free(in.buff);
+   return status;
+}
+
+#endif //PARALLEL_C
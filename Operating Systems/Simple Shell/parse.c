@@ -6,6 +6,7 @@
  *
  * Notes:     Implements the parse_command
  *         function to be used by main.c
+ *         and libmyshell.c
  */
 
 #include <stdio.h>
@@ -14,27 +15,65 @@
 //Delimiter for parsing the command string
 #define DELIMITER " "
 
+//connectors which may join the commands of a list
+#define LIST_SEQ 0	// ;
+#define LIST_AND 1	// &&
+#define LIST_OR  2	// ||
+
+#ifdef PARSE_NO_VARS
+//   libmyshell has no variables, so its words are kept as they are,
+//and only exports its own API so the parser is kept to itself
+#define expand_word(word) (word)
+#define PARSE_STATIC static
+#else
+//implemented in vars.c, returns a word with its variables expanded
+char* expand_word(char* word);
+#define PARSE_STATIC
+#endif
+
 //function used by main.c to parse command strings
-int pase_command(char* line, char** cmd1, char** cmd2, char* infile, char* outfile);
+PARSE_STATIC int parse_command(char* line, char** cmd1, char** cmd2, int* stages,
+                               char* infile, char* outfile, int file_size);
 
 //function used by parse_command to parse command options
-int parseOption(char** option);
+PARSE_STATIC int parseOption(char** option, char** save);
+
+#ifndef PARSE_NO_VARS
+//function used by main.c to split a line into a list of commands
+int parse_list(char* line, char** cmds, int* connectors, int max);
+#endif
 
-int parse_command(char* line,
-		  char** cmd1, char** cmd2,
-		  char* infile, char* outfile)
+/*
+ * Parses a command into its argvs and redirection file names, which
+ *    are file_size bytes long. cmd1 gets the first stage and cmd2 the
+ *    stages after it one after the other, each ending with NULL.
+ *    stages is set to the number of stages.
+ * Returns the code for what was found (see below), 0 for quit or -1
+ *    if a file name is missing or does not fit
+ */
+PARSE_STATIC int parse_command(char* line,
+		  char** cmd1, char** cmd2, int* stages,
+		  char* infile, char* outfile, int file_size)
 {
-   //initialize strtok
-   char* token = strtok(line, DELIMITER);
+   *stages = 1;
+
+   //initialize strtok_r, whose position is kept here so the library
+   //can parse from many threads
+   char* save = NULL;
+   char* token = strtok_r(line, DELIMITER, &save);
 
    if(token != NULL)
    {
-      //assume the first argument is a command
-      cmd1[0] = token;
-
       //if the command is quit the function is done
       if(strcmp(token, "quit") == 0)
+      {
+         cmd1[0] = token;
+         cmd1[1] = NULL;
          return 0;
+      }
+
+      //assume the first argument is a command
+      cmd1[0] = expand_word(token);
    }
 
    //flags used trackt the presence of pipes and redirections
@@ -43,14 +82,14 @@ int parse_command(char* line,
 
    //initialize variables used in the loop
    char** curCmd = cmd1;
-   int i = 1;
+   int i = (token != NULL) ? 1 : 0;
    int done = 0;
 
    while(done == 0)
    {
       //parse an option
       char* option = NULL;
-      int optCode = parseOption(&option);
+      int optCode = parseOption(&option, &save);
 
       //use the option code to store the option correctly
       if(optCode == 0)
@@ -66,23 +105,30 @@ int parse_command(char* line,
       }
       else if(optCode == 2)
       {
-         //pipe
-         curCmd = cmd2;
+         //pipe, the next stage follows the end of this one in cmd2
+         curCmd[i] = NULL;
+         curCmd = (curCmd == cmd1) ? cmd2 : curCmd + i + 1;
+         (*stages)++;
          pipe = 1;
          i = 0;
       }
+      else if(optCode >= 3 && optCode <= 5 && (option == NULL || (int)strlen(option) >= file_size))
+      {
+         //a redirection without a file or one too long to keep
+         return -1;
+      }
       else if(optCode == 3)
-         strcpy(infile, option);
+         snprintf(infile, file_size, "%s", option);
       else if(optCode == 4)
       {
          //Output redirection overwrite (>)
-         strcpy(outfile, option);
+         snprintf(outfile, file_size, "%s", option);
          outRed = -1;
       }
       else if(optCode == 5)
       {
          //Output redirection append (>>)
-         strcpy(outfile, option);
+         snprintf(outfile, file_size, "%s", option);
          outRed = 1;
       }
       else
@@ -92,6 +138,8 @@ int parse_command(char* line,
       }
    }
 
+   curCmd[i] = NULL;
+
    //build up the return code according to the flags
    int retCode = 1;
    if(infile[0] != '\0')
@@ -114,9 +162,9 @@ int parse_command(char* line,
 //        3 if a input redirection was found
 //        4 if a output redirection was found
 //        5 if a output append was found
-int parseOption(char** option)
+PARSE_STATIC int parseOption(char** option, char** save)
 {
-   char* token = strtok(NULL, DELIMITER);
+   char* token = strtok_r(NULL, DELIMITER, save);
    int retCode = 0;
 
    //if a token could be parsed from the command string
@@ -130,28 +178,119 @@ int parseOption(char** option)
       else if(strcmp(token, "<") == 0)
       {
          //if a input redirection was detected, set option to the filename
-         *option = strtok(NULL, DELIMITER);
+         *option = expand_word(strtok_r(NULL, DELIMITER, save));
          retCode = 3;
       }
       else if(strcmp(token, ">") == 0)
       {
          //if a input redirection was detected, set option to the filename
-         *option = strtok(NULL, DELIMITER);
+         *option = expand_word(strtok_r(NULL, DELIMITER, save));
          retCode = 4;
       }
       else if(strcmp(token, ">>") == 0)
       {
          //if a input redirection was detected, set option to the filename
-         *option = strtok(NULL, DELIMITER);
+         *option = expand_word(strtok_r(NULL, DELIMITER, save));
          retCode = 5;
       }
       else
       {
          //The option is just a standard option
-         *option = token;
+         *option = expand_word(token);
          retCode = 1;
       }
    }
 
    return retCode;
 }
+
+#ifndef PARSE_NO_VARS
+/*
+ * Splits a line into the commands of a list joined by ;, && or ||.
+ *    The line is split in place so each entry of cmds can be handed
+ *    to parse_command. connectors[i] holds the connector which
+ *    precedes cmds[i] (LIST_SEQ for the first command). A connector
+ *    is a word of its own or ends the word before it, as in
+ *    "echo a; echo b".
+ * Returns the number of commands stored in cmds or -1 if there are
+ *    more than max
+ */
+int parse_list(char* line, char** cmds, int* connectors, int max)
+{
+   int count = 0;
+   int connector = LIST_SEQ;
+   char* start = line;
+   char* cur = line;
+   int ended = 0;
+
+   while(count < max)
+   {
+      //skip the delimiters in front of the next token
+      while(*cur == ' ')
+         cur++;
+
+      //find the end of the token
+      char* end = cur;
+      while(*end != ' ' && *end != '\0')
+         end++;
+
+      //a connector may end a word
+      int len = end - cur;
+      int found = -1;
+      int op = 0;
+      if(len >= 1 && end[-1] == ';')
+      {
+         found = LIST_SEQ;
+         op = 1;
+      }
+      else if(len >= 2 && strncmp(end - 2, "&&", 2) == 0)
+      {
+         found = LIST_AND;
+         op = 2;
+      }
+      else if(len >= 2 && strncmp(end - 2, "||", 2) == 0)
+      {
+         found = LIST_OR;
+         op = 2;
+      }
+
+      //a connector or the end of the line finishes the current command
+      if(found != -1 || len == 0)
+      {
+         char* next = (*end == '\0') ? end : end + 1;
+         *(end - op) = '\0';
+
+         //empty commands are dropped rather than executed
+         char* check = start;
+         while(*check == ' ')
+            check++;
+         if(*check != '\0')
+         {
+            cmds[count] = start;
+            connectors[count] = connector;
+            count++;
+         }
+
+         if(len == 0)
+         {
+            ended = 1;
+            break;
+         }
+
+         connector = found;
+         start = next;
+         cur = next;
+      }
+      else
+         cur = end;
+   }
+
+   //the commands past max would be dropped
+   while(!ended && *start == ' ')
+      start++;
+   if(!ended && *start != '\0')
+      return -1;
+
+   return count;
+}
+#endif //PARSE_NO_VARS
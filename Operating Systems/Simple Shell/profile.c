@@ -0,0 +1,243 @@
+/*
+ * File:   profile.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  The profile prefix shows which stage of a pipeline holds it
+ *            back. Each pipe between two stages is split in two with a
+ *            relay process in the middle, which moves the data across
+ *            with splice (without copying it) and counts the bytes and
+ *            the time it spends waiting:
+ *
+ *               for data  - the stage before it is slow to produce
+ *               for space - the stage after it is slow to consume
+ *
+ *            When the job is over a report with each stage's output in
+ *            bytes and MB/s, the share of the time its input was empty
+ *            or its output full and its CPU time from rusage is
+ *            printed to stderr. A relay adds a pipe's worth of
+ *            buffering between the stages.
+ */
+
+#ifndef PROFILE_C
+#define PROFILE_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "stats.c"
+
+//most bytes a relay moves with one splice
+#define PROFILE_CHUNK (1 << 16)
+
+//what a relay measured, shared with the shell
+struct profile_link
+{
+   unsigned long long bytes;
+   long long starved;      //nanoseconds waiting for data
+   long long blocked;      //nanoseconds waiting for space
+   long long start;
+   long long end;
+};
+
+//set by the profile prefix for the next job only
+int next_profile = 0;
+
+//the links of the running job and their relays
+struct profile_link* profile_links = NULL;
+int profile_links_size = 0;
+pid_t* profile_relays = NULL;
+int profile_relays_size = 0;
+int profile_count = 0;
+
+/*
+ * Strips a profile prefix from the front of a line.
+ * Returns 1 if a prefix was stripped, 0 if there was none
+ */
+int profile_prefix(char** line)
+{
+   if(strncmp(*line, "profile", 7) != 0 || ((*line)[7] != ' ' && (*line)[7] != '\0'))
+      return 0;
+
+   next_profile = 1;
+   *line += 7;
+
+   return 1;
+}
+
+/*
+ * Prepares the links between the count stages of a job when it is
+ *    profiled. The mapping is replaced by a larger one when a job
+ *    has more links than it holds.
+ */
+void profile_begin_job(int count)
+{
+   profile_count = 0;
+   if(!next_profile || count < 2)
+      return;
+
+   pid_t* grown = stats_grow(profile_relays, &profile_relays_size, count - 1, sizeof(pid_t));
+   if(grown == NULL)
+      return;
+   profile_relays = grown;
+
+   if(profile_links_size < count - 1)
+   {
+      if(profile_links != NULL)
+         munmap(profile_links, profile_links_size * sizeof(struct profile_link));
+      profile_links = NULL;
+      profile_links_size = 0;
+
+      void* mem = mmap(NULL, (count - 1) * sizeof(struct profile_link), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if(mem == MAP_FAILED)
+         return;
+      profile_links = mem;
+      profile_links_size = count - 1;
+   }
+
+   memset(profile_links, 0, profile_links_size * sizeof(struct profile_link));
+}
+
+//waits until fd is ready and adds the time it took to *total
+void profile_wait(int fd, short events, long long* total)
+{
+   struct pollfd p = { fd, events, 0 };
+   long long start = stats_clock();
+
+   while(poll(&p, 1, -1) == -1 && errno == EINTR)
+      ;
+
+   *total += stats_clock() - start;
+}
+
+/*
+ * Moves everything from in to out with splice until either side is
+ *    closed, measuring into link. Runs in the relay process.
+ */
+void profile_relay_loop(int in, int out, struct profile_link* link)
+{
+   link->start = stats_clock();
+
+   while(1)
+   {
+      ssize_t n = splice(in, NULL, out, NULL, PROFILE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if(n > 0)
+      {
+         link->bytes += n;
+         continue;
+      }
+      if(n == 0 || errno == EPIPE)
+         break;
+      if(errno == EINTR)
+         continue;
+      if(errno != EAGAIN)
+         break;
+
+      //either the pipe in is empty or the pipe out is full
+      struct pollfd p = { in, POLLIN, 0 };
+      if(poll(&p, 1, 0) == 0)
+         profile_wait(in, POLLIN, &link->starved);
+      else
+         profile_wait(out, POLLOUT, &link->blocked);
+   }
+
+   link->end = stats_clock();
+}
+
+/*
+ * Puts a relay after the read end of the pipe from a stage.
+ * Returns the read end the next stage takes its input from, which
+ *    is in itself if the relay could not be started
+ */
+int profile_relay(int in)
+{
+   if(profile_links == NULL || profile_count >= profile_links_size || profile_count >= profile_relays_size)
+      return in;
+
+   int pipefd[2];
+   if(pipe2(pipefd, O_CLOEXEC) == -1)
+      return in;
+
+   struct profile_link* link = &profile_links[profile_count];
+   pid_t pid = fork();
+   if(pid == 0)
+   {
+      //a stage which exits early is seen as EPIPE
+      signal(SIGPIPE, SIG_IGN);
+      close(pipefd[0]);
+      profile_relay_loop(in, pipefd[1], link);
+      _exit(0);
+   }
+
+   close(pipefd[1]);
+   if(pid < 0)
+   {
+      close(pipefd[0]);
+      return in;
+   }
+
+   profile_relays[profile_count++] = pid;
+   close(in);
+
+   return pipefd[0];
+}
+
+//prints the share of time as a percentage, or - without a relay
+void profile_print_share(long long part, struct profile_link* link)
+{
+   long long span = (link != NULL) ? link->end - link->start : 0;
+   if(span > 0)
+      fprintf(stderr, " %8.1f%%", 100.0 * part / span);
+   else
+      fprintf(stderr, " %9s", "-");
+}
+
+/*
+ * Reaps the relays of a profiled job and prints its report
+ */
+void profile_end_job(struct cmd_stats** stages, int count)
+{
+   int i;
+   for(i = 0; i < profile_count; i++)
+      while(waitpid(profile_relays[i], NULL, 0) == -1 && errno == EINTR)
+         ;
+
+   if(!next_profile || profile_links == NULL)
+      return;
+
+   fprintf(stderr, "%-5s %-12s %12s %9s %9s %9s %8s %8s\n",
+           "stage", "command", "bytes out", "MB/s", "in wait", "out wait", "user", "sys");
+
+   for(i = 0; i < count; i++)
+   {
+      //the relays before and after the stage
+      struct profile_link* in = (i > 0 && i - 1 < profile_count) ? &profile_links[i - 1] : NULL;
+      struct profile_link* out = (i < profile_count) ? &profile_links[i] : NULL;
+
+      fprintf(stderr, "%-5d %-12.12s", i + 1, stages[i]->name);
+
+      long long span = (out != NULL) ? out->end - out->start : 0;
+      if(out != NULL)
+         fprintf(stderr, " %12llu %9.1f", out->bytes, span > 0 ? out->bytes / (span / 1e9) / 1e6 : 0.0);
+      else
+         fprintf(stderr, " %12s %9s", "-", "-");
+
+      profile_print_share(in != NULL ? in->starved : 0, in);
+      profile_print_share(out != NULL ? out->blocked : 0, out);
+
+      fprintf(stderr, " %7.3fs %7.3fs\n",
+              stats_tv_usec(&stages[i]->usage.ru_utime) / 1e6,
+              stats_tv_usec(&stages[i]->usage.ru_stime) / 1e6);
+   }
+}
+
+#endif //PROFILE_C
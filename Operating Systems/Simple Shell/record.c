@@ -0,0 +1,96 @@
+/*
+ * File:   record.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Records a session for the replay harness. When
+ *            MYSHELL_RECORD names a file, every line handled by
+ *            the shell is appended to it with its start offset,
+ *            duration and exit status:
+ *
+ *               offset_ns <tab> duration_ns <tab> status <tab> line
+ */
+
+#ifndef RECORD_C
+#define RECORD_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "event.c"
+
+#define RECORD_HEADER "#myshell-session 1\n"
+
+//one recorded command line
+struct record
+{
+   long long offset;    //nanoseconds since the session started
+   long long duration;  //nanoseconds spent handling the line
+   int status;
+   char line[INPUT_MAX];
+};
+
+FILE* record_file = NULL;
+long long record_start = 0;
+
+/*
+ * Starts recording if MYSHELL_RECORD names a file
+ */
+void record_open(void)
+{
+   record_start = stats_clock();
+
+   char* path = getenv("MYSHELL_RECORD");
+   if(path == NULL || path[0] == '\0')
+      return;
+
+   record_file = fopen(path, "w");
+   if(record_file == NULL)
+      return;
+
+   fputs(RECORD_HEADER, record_file);
+}
+
+/*
+ * Appends one handled line to the recording
+ */
+void record_line(char* line, long long start, long long end, int status)
+{
+   if(record_file == NULL)
+      return;
+
+   fprintf(record_file, "%lld\t%lld\t%d\t%s\n", start - record_start, end - start, status, line);
+
+   //keep the recording usable if the session is killed
+   fflush(record_file);
+}
+
+/*
+ * Reads the next record from a recording, skipping comments.
+ * Returns 1 if a record was read
+ *         0 at the end of the file
+ */
+int record_read(FILE* in, struct record* rec)
+{
+   char buff[INPUT_MAX + 64];
+
+   while(fgets(buff, sizeof(buff), in) != NULL)
+   {
+      if(buff[0] == '#' || buff[0] == '\n')
+         continue;
+
+      buff[strcspn(buff, "\n")] = '\0';
+
+      int used = 0;
+      if(sscanf(buff, "%lld\t%lld\t%d\t%n", &rec->offset, &rec->duration, &rec->status, &used) < 3 || used == 0)
+         continue;
+
+      snprintf(rec->line, sizeof(rec->line), "%s", buff + used);
+      return 1;
+   }
+
+   return 0;
+}
+
+#endif //RECORD_C
@@ -6,6 +6,9 @@
  *            and restorations.
  */
 
+#ifndef REDIRECTIONS_C
+#define REDIRECTIONS_C
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,6 +17,42 @@
 #include <fcntl.h>
 #include <limits.h>
 
+#include "out.c"
+
+/*
+ * Opens a file for input redirection without applying it
+ * Returns the file descriptor or -1 if unsuccessful
+ */
+int openIn(char* infile)
+{
+   int fd = open(infile, O_RDONLY);
+   if(fd == -1)
+   {
+      out_printf("Could not open file %s\n", infile);
+      out_end();
+   }
+
+   return fd;
+}
+
+/*
+ * Opens a file for output redirection without applying it,
+ *    appending if append is non-zero and truncating otherwise
+ * Returns the file descriptor or -1 if unsuccessful
+ */
+int openOut(char* outfile, int append)
+{
+   int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+   int fd = open(outfile, flags, S_IRUSR | S_IWUSR);
+   if(fd == -1)
+   {
+      out_printf("Could not open file %s\n", outfile);
+      out_end();
+   }
+
+   return fd;
+}
+
 /*
  * Perform a input redirection and return file descriptors
  *    for stdin and the input file through stdin_loc and
@@ -24,12 +63,9 @@
 int redirIn(char* infile, int* stdin_loc, int* input_loc)
 {
    //open input file
-   int fd = open(infile, O_RDONLY);
+   int fd = openIn(infile);
    if(fd == -1)
-   {
-      printf("Could not open file %s\n", infile);
       return -1;
-   }
 
    //save stdin
    int stdin_temp = dup(STDIN_FILENO);
@@ -64,12 +100,9 @@ int redirIn(char* infile, int* stdin_loc, int* input_loc)
 int redirOutAppend(char* outfile, int* stdout_loc, int* output_loc)
 {
    //open output file
-   int fd = open(outfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+   int fd = openOut(outfile, 1);
    if(fd == -1)
-   {
-      printf("Could not open file %s\n", outfile);
       return -1;
-   }
 
    //save stdout
    int stdout_temp = dup(STDOUT_FILENO);
@@ -104,12 +137,9 @@ int redirOutAppend(char* outfile, int* stdout_loc, int* output_loc)
 int redirOut(char* outfile, int* stdout_loc, int* output_loc)
 {
    //open file
-   int fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   int fd = openOut(outfile, 0);
    if(fd == -1)
-   {
-      printf("Could not open file %s\n", outfile);
       return -1;
-   }
 
    //save stdout
    int stdout_temp = dup(STDOUT_FILENO);
@@ -142,7 +172,10 @@ void resIn(int stdin_curr, int input)
    //restore stdin
    int success = dup2(stdin_curr, STDIN_FILENO);
    if(success == -1)
-      printf("Could not restore stdin file descriptor\n");
+   {
+      out_str("Could not restore stdin file descriptor\n");
+      out_end();
+   }
 
    close(stdin_curr);
    if(input > 2)
@@ -154,12 +187,20 @@ void resIn(int stdin_curr, int input)
  */
 void resOut(int stdout_curr, int output)
 {
+   //what was written while redirected belongs to the file
+   out_flush();
+
    //restore stdout
    int success = dup2(stdout_curr, STDOUT_FILENO);
    if(success == -1)
-      printf("Could not restore stdout file descriptor\n");
+   {
+      out_str("Could not restore stdout file descriptor\n");
+      out_end();
+   }
 
    close(stdout_curr);
    if(output > 2)
       close(output);
 }
+
+#endif //REDIRECTIONS_C
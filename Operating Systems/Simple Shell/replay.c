@@ -0,0 +1,231 @@
+/*
+ * File:   replay.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Replays a session recorded with MYSHELL_RECORD against the
+ *            current build and reports the latency of every command
+ *            next to the recorded one.
+ *
+ *            usage: replay [-t] session.rec
+ *                   replay [-t] -p ./myshell session.rec
+ *
+ *            Without -p the lines are fed to handleList inside this
+ *            process. With -p the shell binary is driven through a
+ *            pty and a command is timed until the next prompt. -t
+ *            keeps the original pacing between commands instead of
+ *            replaying at maximum speed. The report goes to stderr.
+ */
+
+#define MYSHELL_NO_MAIN
+#include "main.c"
+
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+
+#define PROMPT "myshell-% "
+
+//the longest a command may take in pty mode before giving up
+#define PTY_TIMEOUT_MS 60000
+
+/*
+ * Sleeps until the given offset from start has been reached
+ */
+void wait_until(long long start, long long offset)
+{
+   long long remaining = start + offset - stats_clock();
+   if(remaining <= 0)
+      return;
+
+   struct timespec ts;
+   ts.tv_sec = remaining / 1000000000LL;
+   ts.tv_nsec = remaining % 1000000000LL;
+   nanosleep(&ts, NULL);
+}
+
+/*
+ * Reads from the pty until the prompt appears.
+ * Returns 1 when the prompt was seen
+ *         0 if the shell exited or timed out
+ */
+int read_to_prompt(int master)
+{
+   char buff[4096];
+   int matched = 0;
+   int plen = strlen(PROMPT);
+
+   struct pollfd pfd;
+   pfd.fd = master;
+   pfd.events = POLLIN;
+
+   while(poll(&pfd, 1, PTY_TIMEOUT_MS) > 0)
+   {
+      int n = read(master, buff, sizeof(buff));
+      if(n <= 0)
+         return 0;
+
+      //match the prompt across reads
+      int i;
+      for(i = 0; i < n; i++)
+      {
+         if(buff[i] == PROMPT[matched])
+            matched++;
+         else
+            matched = (buff[i] == PROMPT[0]) ? 1 : 0;
+
+         if(matched == plen && i == n - 1)
+            return 1;
+         if(matched == plen)
+            matched = 0;
+      }
+   }
+
+   return 0;
+}
+
+/*
+ * Prints one line of the report
+ */
+void report(int index, struct record* rec, long long replayed, int status)
+{
+   long long delta = replayed - rec->duration;
+   double pct = rec->duration > 0 ? 100.0 * delta / rec->duration : 0;
+
+   char match = (status == -1) ? '?' : (status == rec->status ? ' ' : '!');
+
+   fprintf(stderr, "%5d %12.1f %12.1f %+12.1f %+8.1f%% %c %.40s\n", index,
+           rec->duration / 1e3, replayed / 1e3, delta / 1e3, pct, match, rec->line);
+}
+
+int main(int argc, char* argv[])
+{
+   int timed = 0;
+   char* binary = NULL;
+
+   int opt;
+   while((opt = getopt(argc, argv, "tp:")) != -1)
+   {
+      if(opt == 't')
+         timed = 1;
+      else if(opt == 'p')
+         binary = optarg;
+      else
+      {
+         fprintf(stderr, "usage: %s [-t] [-p shell] session.rec\n", argv[0]);
+         return 2;
+      }
+   }
+
+   if(optind >= argc)
+   {
+      fprintf(stderr, "usage: %s [-t] [-p shell] session.rec\n", argv[0]);
+      return 2;
+   }
+
+   FILE* in = fopen(argv[optind], "r");
+   if(in == NULL)
+   {
+      fprintf(stderr, "Could not open file %s\n", argv[optind]);
+      return 1;
+   }
+
+   //start the shell on a pty and wait for its first prompt
+   int master = -1;
+   pid_t shell = -1;
+   if(binary != NULL)
+   {
+      shell = forkpty(&master, NULL, NULL, NULL);
+      if(shell < 0)
+      {
+         fprintf(stderr, "Could not create pty\n");
+         return 1;
+      }
+      else if(shell == 0)
+      {
+         //the input should not be echoed back into the timings
+         struct termios tio;
+         if(tcgetattr(STDIN_FILENO, &tio) == 0)
+         {
+            tio.c_lflag &= ~ECHO;
+            tcsetattr(STDIN_FILENO, TCSANOW, &tio);
+         }
+
+         execl(binary, binary, (char*)NULL);
+         exit(127);
+      }
+
+      if(!read_to_prompt(master))
+      {
+         fprintf(stderr, "%s did not show a prompt\n", binary);
+         return 1;
+      }
+   }
+
+   fprintf(stderr, "%5s %12s %12s %12s %9s   %s\n", "#", "recorded_us", "replay_us", "delta_us", "delta", "command");
+
+   struct record rec;
+   long long start = stats_clock();
+   long long total_recorded = 0, total_replayed = 0;
+   int count = 0, mismatches = 0;
+
+   while(record_read(in, &rec))
+   {
+      if(timed)
+         wait_until(start, rec.offset);
+
+      long long begin, end;
+      int status = -1;
+      int ret = 1;
+
+      if(binary == NULL)
+      {
+         char line[INPUT_MAX];
+         snprintf(line, sizeof(line), "%s", rec.line);
+
+         begin = stats_clock();
+         ret = handleList(line);
+         end = stats_clock();
+
+         status = last_status;
+      }
+      else
+      {
+         char line[INPUT_MAX + 2];
+         int len = snprintf(line, sizeof(line), "%s\n", rec.line);
+
+         begin = stats_clock();
+         write(master, line, len);
+         ret = read_to_prompt(master);
+         end = stats_clock();
+      }
+
+      count++;
+      report(count, &rec, end - begin, status);
+
+      total_recorded += rec.duration;
+      total_replayed += end - begin;
+      if(status != -1 && status != rec.status)
+         mismatches++;
+
+      //the session ended (quit, or the shell went away)
+      if(ret == 0)
+         break;
+   }
+
+   fclose(in);
+
+   if(shell > 0)
+   {
+      close(master);
+      waitpid(shell, NULL, 0);
+   }
+
+   double pct = total_recorded > 0 ? 100.0 * (total_replayed - total_recorded) / total_recorded : 0;
+   fprintf(stderr, "\n%d commands: recorded %.3fms, replayed %.3fms (%+.1f%%)",
+           count, total_recorded / 1e6, total_replayed / 1e6, pct);
+   if(binary == NULL)
+      fprintf(stderr, ", %d status mismatches", mismatches);
+   fprintf(stderr, "\n");
+
+   return mismatches > 0 ? 1 : 0;
+}
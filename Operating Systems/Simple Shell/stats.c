@@ -0,0 +1,283 @@
+/*
+ * File:   stats.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Reaps children with wait4 and records the wall time
+ *            and resource usage of every command and pipeline
+ *            stage. The stages of the most recent job are kept
+ *            for the time builtin and, when MYSHELL_STATS names a
+ *            file, every record is appended to a per-session file.
+ */
+
+#ifndef STATS_C
+#define STATS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+//resource usage of a single command or pipeline stage
+struct cmd_stats
+{
+   pid_t pid;
+   char name[64];
+   int status;             //exit status (128 + signal when killed)
+   long long start;        //monotonic start time in nanoseconds
+   long long wall;         //wall time in nanoseconds
+   struct rusage usage;
+   int zygote;             //spawned (and reaped) through the zygote
+};
+
+//stages of the most recently executed job, grown to fit the longest
+struct cmd_stats* last_job = NULL;
+int last_job_size = 0;
+int last_job_count = 0;
+long long last_job_start = 0;
+long long last_job_wall = 0;
+int last_job_timed_out = 0;
+
+//per-session stats file, opened on first use
+int stats_fd = -1;
+int stats_checked = 0;
+
+//returns the monotonic clock in nanoseconds
+long long stats_clock(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//converts a timeval from rusage into microseconds
+long long stats_tv_usec(struct timeval* tv)
+{
+   return (long long)tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+/*
+ * Converts a status returned by wait4 into an exit status
+ *    in the same form as $? in sh
+ */
+int stats_exit_code(int status)
+{
+   if(WIFEXITED(status))
+      return WEXITSTATUS(status);
+   if(WIFSIGNALED(status))
+      return 128 + WTERMSIG(status);
+
+   return 1;
+}
+
+/*
+ * Grows an array kept for the stages of a job to hold count entries
+ *    of elem bytes. *size is the number it holds.
+ * Returns the array, which may have moved, or NULL if it could not be
+ *    grown (it is left as it was)
+ */
+void* stats_grow(void* array, int* size, int count, size_t elem)
+{
+   if(count <= *size)
+      return array;
+
+   void* grown = realloc(array, count * elem);
+   if(grown != NULL)
+      *size = count;
+
+   return grown;
+}
+
+/*
+ * Starts a new job of count stages. The stages are added with
+ *    stats_stage before each fork so the wall time includes the cost
+ *    of spawning.
+ * Returns 0 or -1 if there is no room for the stages
+ */
+int stats_begin_job(int count)
+{
+   struct cmd_stats* grown = stats_grow(last_job, &last_job_size, count, sizeof(struct cmd_stats));
+   if(grown == NULL)
+      return -1;
+   last_job = grown;
+
+   last_job_count = 0;
+   last_job_wall = 0;
+   last_job_timed_out = 0;
+   last_job_start = stats_clock();
+
+   return 0;
+}
+
+/*
+ * Reserves the record for the next stage of the current job.
+ * Returns the record or NULL if the job has too many stages
+ */
+struct cmd_stats* stats_stage(char* name)
+{
+   if(last_job_count >= last_job_size)
+      return NULL;
+
+   struct cmd_stats* st = &last_job[last_job_count++];
+   memset(st, 0, sizeof(*st));
+
+   strncpy(st->name, name != NULL ? name : "", sizeof(st->name) - 1);
+   st->pid = -1;
+   st->status = 1;
+   st->start = stats_clock();
+
+   return st;
+}
+
+/*
+ * Opens the per-session stats file named by MYSHELL_STATS with
+ *    the PID of the shell appended, writing a header if it is new.
+ */
+void stats_open(void)
+{
+   stats_checked = 1;
+
+   char* base = getenv("MYSHELL_STATS");
+   if(base == NULL || base[0] == '\0')
+      return;
+
+   char path[512];
+   snprintf(path, sizeof(path), "%s.%d", base, getpid());
+
+   stats_fd = open(path, O_CREAT | O_APPEND | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR);
+   if(stats_fd == -1)
+      return;
+
+   struct stat sb;
+   if(fstat(stats_fd, &sb) == 0 && sb.st_size == 0)
+   {
+      char* header = "#epoch_ms\tpid\tstatus\twall_us\tuser_us\tsys_us\tmaxrss_kb\tnvcsw\tnivcsw\tcommand\n";
+      write(stats_fd, header, strlen(header));
+   }
+}
+
+/*
+ * Appends one record to the stats file if it was requested
+ */
+void stats_record(struct cmd_stats* st)
+{
+   if(!stats_checked)
+      stats_open();
+
+   if(stats_fd == -1)
+      return;
+
+   struct timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+
+   char buff[256];
+   int len = snprintf(buff, sizeof(buff), "%lld\t%d\t%d\t%lld\t%lld\t%lld\t%ld\t%ld\t%ld\t%s\n",
+                      (long long)now.tv_sec * 1000LL + now.tv_nsec / 1000000,
+                      (int)st->pid, st->status, st->wall / 1000,
+                      stats_tv_usec(&st->usage.ru_utime),
+                      stats_tv_usec(&st->usage.ru_stime),
+                      st->usage.ru_maxrss, st->usage.ru_nvcsw,
+                      st->usage.ru_nivcsw, st->name);
+
+   //a single write keeps records from concurrent shells whole
+   if(len > 0)
+      write(stats_fd, buff, len < (int)sizeof(buff) ? len : (int)sizeof(buff) - 1);
+}
+
+/*
+ * Fills in the wall time and exit status of a reaped stage and
+ *    records it
+ */
+void stats_finish(struct cmd_stats* st, int status)
+{
+   st->wall = stats_clock() - st->start;
+   st->status = stats_exit_code(status);
+
+   stats_record(st);
+}
+
+/*
+ * Waits for the child of a stage with wait4 and fills in its
+ *    wall time and resource usage.
+ * Returns the exit status of the child or 1 if the wait failed
+ */
+int stats_reap(struct cmd_stats* st)
+{
+   int status;
+
+   //retry if the wait is interrupted by a signal
+   while(wait4(st->pid, &status, 0, &st->usage) == -1)
+   {
+      if(errno != EINTR)
+      {
+         st->status = 1;
+         return 1;
+      }
+   }
+
+   stats_finish(st, status);
+
+   return st->status;
+}
+
+/*
+ * Reaps the child of a stage if it has exited, without blocking.
+ * Returns 1 if the stage is finished
+ *         0 if the child is still running
+ */
+int stats_try_reap(struct cmd_stats* st)
+{
+   int status;
+   pid_t ret;
+
+   while((ret = wait4(st->pid, &status, WNOHANG, &st->usage)) == -1 && errno == EINTR)
+      ;
+
+   if(ret == 0)
+      return 0;
+
+   if(ret == -1)
+      st->status = 1;
+   else
+      stats_finish(st, status);
+
+   return 1;
+}
+
+/*
+ * Finishes the current job once all of its stages are reaped
+ */
+void stats_end_job(void)
+{
+   last_job_wall = stats_clock() - last_job_start;
+}
+
+/*
+ * Prints the resource usage of the most recent job to stderr
+ *    (used by the time builtin)
+ */
+void stats_print_job(void)
+{
+   int i;
+   for(i = 0; i < last_job_count; i++)
+   {
+      struct cmd_stats* st = &last_job[i];
+      fprintf(stderr, "%-12s pid %-7d status %-3d real %.3fs user %.3fs sys %.3fs maxrss %ldKB csw %ld/%ld\n",
+              st->name, (int)st->pid, st->status,
+              st->wall / 1e9,
+              stats_tv_usec(&st->usage.ru_utime) / 1e6,
+              stats_tv_usec(&st->usage.ru_stime) / 1e6,
+              st->usage.ru_maxrss, st->usage.ru_nvcsw, st->usage.ru_nivcsw);
+   }
+
+   fprintf(stderr, "real %.3fs%s\n", last_job_wall / 1e9, last_job_timed_out ? " (timed out)" : "");
+}
+
+#endif //STATS_C
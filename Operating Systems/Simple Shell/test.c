@@ -0,0 +1,317 @@
+/*
+ * File:   test.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  The test and [ builtins, and true and false, so a loop's
+ *            condition does not fork a process:
+ *
+ *               test EXPRESSION     [ EXPRESSION ]
+ *
+ *            Files:    -e -f -d -r -w -x -s -L -h -b -c -p -S FILE,
+ *                      -t FD, FILE -nt -ot -ef FILE
+ *            Strings:  -n -z STRING, STRING = == != < > STRING
+ *            Integers: N -eq -ne -lt -le -gt -ge N (64-bit)
+ *            Combined: ! EXPR, EXPR -a EXPR, EXPR -o EXPR, ( EXPR )
+ *
+ *            With up to four arguments the POSIX rules decide what
+ *            they mean, so test -n -o and test ! = work as expected.
+ *            The exit status is 0 for true, 1 for false and 2 for an
+ *            error.
+ */
+
+#ifndef TEST_C
+#define TEST_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+struct test
+{
+   char** argv;
+   int argc;
+   int pos;
+   int error;
+};
+
+int test_or(struct test* t);
+
+//returns 1 if word is a unary operator
+int test_unary_op(char* word)
+{
+   return word[0] == '-' && word[1] != '\0' && word[2] == '\0' &&
+          strchr("efdrwxsLhbcpStnz", word[1]) != NULL;
+}
+
+//returns 1 if word is a binary operator
+int test_binary_op(char* word)
+{
+   static char* ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le",
+                          "-gt", "-ge", "-nt", "-ot", "-ef", NULL };
+   int i;
+   for(i = 0; ops[i] != NULL; i++)
+      if(strcmp(word, ops[i]) == 0)
+         return 1;
+
+   return 0;
+}
+
+//reports an error and returns false
+int test_fail(struct test* t, char* format, char* word)
+{
+   if(!t->error)
+      fprintf(stderr, format, word);
+   t->error = 1;
+   return 0;
+}
+
+//converts an operand of an integer comparison
+long long test_integer(struct test* t, char* word)
+{
+   char* end;
+   errno = 0;
+   long long value = strtoll(word, &end, 10);
+
+   while(*end == ' ')
+      end++;
+   if(end == word || *end != '\0' || errno == ERANGE)
+      test_fail(t, "test: %s: integer expression expected\n", word);
+
+   return value;
+}
+
+//evaluates a unary operator
+int test_unary(struct test* t, char* op, char* arg)
+{
+   struct stat sb;
+
+   switch(op[1])
+   {
+      case 'n': return arg[0] != '\0';
+      case 'z': return arg[0] == '\0';
+      case 't': return isatty(test_integer(t, arg));
+      case 'r': return access(arg, R_OK) == 0;
+      case 'w': return access(arg, W_OK) == 0;
+      case 'x': return access(arg, X_OK) == 0;
+      case 'L':
+      case 'h': return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+   }
+
+   if(stat(arg, &sb) == -1)
+      return 0;
+
+   switch(op[1])
+   {
+      case 'e': return 1;
+      case 'f': return S_ISREG(sb.st_mode);
+      case 'd': return S_ISDIR(sb.st_mode);
+      case 's': return sb.st_size > 0;
+      case 'b': return S_ISBLK(sb.st_mode);
+      case 'c': return S_ISCHR(sb.st_mode);
+      case 'p': return S_ISFIFO(sb.st_mode);
+      case 'S': return S_ISSOCK(sb.st_mode);
+   }
+
+   return 0;
+}
+
+//returns 1 if the first time is later than the second
+int test_later(struct timespec* a, struct timespec* b)
+{
+   return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+//evaluates a binary operator
+int test_binary(struct test* t, char* lhs, char* op, char* rhs)
+{
+   if(strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+      return strcmp(lhs, rhs) == 0;
+   if(strcmp(op, "!=") == 0)
+      return strcmp(lhs, rhs) != 0;
+   if(strcmp(op, "<") == 0)
+      return strcmp(lhs, rhs) < 0;
+   if(strcmp(op, ">") == 0)
+      return strcmp(lhs, rhs) > 0;
+
+   if(strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+   {
+      struct stat a, b;
+      int has_a = (stat(lhs, &a) == 0), has_b = (stat(rhs, &b) == 0);
+
+      //a file which does not exist is older than one which does
+      if(op[1] == 'n')
+         return has_a && (!has_b || test_later(&a.st_mtim, &b.st_mtim));
+      if(op[1] == 'o')
+         return has_b && (!has_a || test_later(&b.st_mtim, &a.st_mtim));
+      return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+   }
+
+   long long x = test_integer(t, lhs);
+   long long y = test_integer(t, rhs);
+
+   if(strcmp(op, "-eq") == 0)
+      return x == y;
+   if(strcmp(op, "-ne") == 0)
+      return x != y;
+   if(strcmp(op, "-lt") == 0)
+      return x < y;
+   if(strcmp(op, "-le") == 0)
+      return x <= y;
+   if(strcmp(op, "-gt") == 0)
+      return x > y;
+   return x >= y;
+}
+
+//returns the next argument or NULL at the end
+char* test_next(struct test* t)
+{
+   return (t->pos < t->argc) ? t->argv[t->pos++] : NULL;
+}
+
+//a single test or a parenthesized expression
+int test_primary(struct test* t)
+{
+   char* word = test_next(t);
+   if(word == NULL)
+      return test_fail(t, "test: %sargument expected\n", "");
+
+   if(strcmp(word, "(") == 0)
+   {
+      int value = test_or(t);
+      char* close = test_next(t);
+      if(close == NULL || strcmp(close, ")") != 0)
+         return test_fail(t, "test: %s expected\n", ")");
+      return value;
+   }
+
+   //a binary operator takes precedence, as in test -n = -n
+   if(t->pos + 1 < t->argc && test_binary_op(t->argv[t->pos]))
+   {
+      char* op = test_next(t);
+      return test_binary(t, word, op, test_next(t));
+   }
+
+   if(test_unary_op(word) && t->pos < t->argc)
+      return test_unary(t, word, test_next(t));
+
+   return word[0] != '\0';
+}
+
+int test_not(struct test* t)
+{
+   if(t->pos < t->argc && strcmp(t->argv[t->pos], "!") == 0)
+   {
+      t->pos++;
+      return !test_not(t);
+   }
+
+   return test_primary(t);
+}
+
+int test_and(struct test* t)
+{
+   int value = test_not(t);
+   while(t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0)
+   {
+      t->pos++;
+      value = test_not(t) && value;
+   }
+
+   return value;
+}
+
+int test_or(struct test* t)
+{
+   int value = test_and(t);
+   while(t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0)
+   {
+      t->pos++;
+      value = test_and(t) || value;
+   }
+
+   return value;
+}
+
+/*
+ * Evaluates argc arguments, following the POSIX rules which decide
+ *    by their number how up to four of them are read.
+ * Returns 1 for true, 0 for false
+ */
+int test_eval(struct test* t, char** argv, int argc)
+{
+   t->argv = argv;
+   t->argc = argc;
+   t->pos = 0;
+
+   if(argc == 0)
+      return 0;
+   if(argc == 1)
+      return argv[0][0] != '\0';
+
+   if(argc == 2 || argc == 3 || argc == 4)
+   {
+      //a leading ! applies to the rest when that is a shorter test
+      if(strcmp(argv[0], "!") == 0 && !(argc == 3 && test_binary_op(argv[1])))
+         return !test_eval(t, argv + 1, argc - 1);
+
+      if(argc == 2)
+      {
+         if(!test_unary_op(argv[0]))
+            return test_fail(t, "test: %s: unary operator expected\n", argv[0]);
+         return test_unary(t, argv[0], argv[1]);
+      }
+
+      if(argc == 3 && test_binary_op(argv[1]))
+         return test_binary(t, argv[0], argv[1], argv[2]);
+
+      if(strcmp(argv[0], "(") == 0 && strcmp(argv[argc - 1], ")") == 0)
+         return test_eval(t, argv + 1, argc - 2);
+   }
+
+   int value = test_or(t);
+   if(t->pos < t->argc)
+      return test_fail(t, "test: %s: unexpected argument\n", t->argv[t->pos]);
+
+   return value;
+}
+
+/*
+ * test EXPRESSION and [ EXPRESSION ]
+ */
+int builtin_test(char** argv)
+{
+   int argc = 0;
+   while(argv[argc + 1] != NULL)
+      argc++;
+
+   if(strcmp(argv[0], "[") == 0)
+   {
+      if(argc == 0 || strcmp(argv[argc], "]") != 0)
+      {
+         fprintf(stderr, "[: missing ]\n");
+         return 2;
+      }
+      argc--;
+   }
+
+   struct test t;
+   t.error = 0;
+   int value = test_eval(&t, argv + 1, argc);
+
+   return t.error ? 2 : !value;
+}
+
+int builtin_true(char** argv)
+{
+   return 0;
+}
+
+int builtin_false(char** argv)
+{
+   return 1;
+}
+
+#endif //TEST_C
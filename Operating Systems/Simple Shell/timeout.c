@@ -0,0 +1,281 @@
+/*
+ * File:   timeout.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Deadlines for jobs. A job gets one from the timeout prefix
+ *            (timeout [-k GRACE] DURATION cmd) or from the session's
+ *            default, set with MYSHELL_TIMEOUT or the deadline builtin.
+ *            A job with a deadline is put in its own process group
+ *            (and given the terminal) so that, when the event loop's
+ *            timer fires, the whole group is sent SIGTERM and then
+ *            SIGKILL once the grace period is over. The job then
+ *            exits with status 124 like timeout(1).
+ *
+ *            A duration is a number of seconds with an optional
+ *            suffix: 1.5, 500ms, 30s, 2m or 1h.
+ */
+
+#ifndef TIMEOUT_C
+#define TIMEOUT_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "event.c"
+#include "metrics.c"
+#include "stats.c"
+#include "log.c"
+
+//exit status of a job which ran out of time
+#define TIMEOUT_STATUS 124
+
+//time between SIGTERM and SIGKILL unless one is given
+#define TIMEOUT_GRACE (2 * 1000000000LL)
+
+//the session's default deadline (0 for none) and grace period
+long long session_timeout = 0;
+long long session_grace = TIMEOUT_GRACE;
+int session_timeout_checked = 0;
+
+//set by the timeout prefix for the next job only
+long long next_timeout = 0;
+long long next_grace = 0;
+
+//process group of the job running under a deadline, -1 when none and
+//0 until its first stage has been started
+pid_t timeout_pgid = -1;
+long long timeout_limit = 0;
+long long timeout_grace = 0;
+int timeout_timer = -1;
+int timeout_expired = 0;
+
+//the job was given the terminal and it must be taken back
+int timeout_tty = 0;
+
+/*
+ * Converts a duration like 1.5, 500ms, 30s, 2m or 1h to nanoseconds.
+ * Returns the duration or -1 if it is not valid
+ */
+long long parse_duration(char* text)
+{
+   char* end;
+   double value = strtod(text, &end);
+
+   if(end == text || value < 0)
+      return -1;
+
+   double scale;
+   if(strcmp(end, "") == 0 || strcmp(end, "s") == 0)
+      scale = 1e9;
+   else if(strcmp(end, "ms") == 0)
+      scale = 1e6;
+   else if(strcmp(end, "m") == 0)
+      scale = 60e9;
+   else if(strcmp(end, "h") == 0)
+      scale = 3600e9;
+   else
+      return -1;
+
+   return (long long)(value * scale);
+}
+
+//returns the next space separated word of a line and moves past it
+char* next_word(char** line, char* word, int size)
+{
+   while(**line == ' ')
+      (*line)++;
+
+   int len = 0;
+   while((*line)[len] != ' ' && (*line)[len] != '\0')
+      len++;
+
+   if(len == 0 || len >= size)
+      return NULL;
+
+   memcpy(word, *line, len);
+   word[len] = '\0';
+   *line += len;
+
+   return word;
+}
+
+/*
+ * Strips a timeout prefix from the front of a line, setting the
+ *    deadline of the next job.
+ * Returns 1 if a prefix was stripped
+ *         0 if there was none
+ *        -1 if it is not valid
+ */
+int timeout_prefix(char** line)
+{
+   char* cur = *line;
+   char word[32];
+
+   if(next_word(&cur, word, sizeof(word)) == NULL || strcmp(word, "timeout") != 0)
+      return 0;
+
+   long long grace = 0;
+   if(next_word(&cur, word, sizeof(word)) != NULL && strcmp(word, "-k") == 0)
+   {
+      if(next_word(&cur, word, sizeof(word)) == NULL || (grace = parse_duration(word)) < 0)
+         return -1;
+
+      word[0] = '\0';
+      next_word(&cur, word, sizeof(word));
+   }
+
+   long long limit = (word[0] != '\0') ? parse_duration(word) : -1;
+   if(limit <= 0)
+      return -1;
+
+   next_timeout = limit;
+   next_grace = grace;
+   *line = cur;
+
+   return 1;
+}
+
+/*
+ * Reads the session's default deadline from MYSHELL_TIMEOUT once
+ */
+void timeout_session_init(void)
+{
+   if(session_timeout_checked)
+      return;
+   session_timeout_checked = 1;
+
+   char* text = getenv("MYSHELL_TIMEOUT");
+   if(text != NULL && text[0] != '\0' && parse_duration(text) > 0)
+      session_timeout = parse_duration(text);
+}
+
+/*
+ * Decides whether the job about to start has a deadline. Called
+ *    before its first stage is forked.
+ */
+void timeout_begin_job(void)
+{
+   timeout_session_init();
+
+   timeout_expired = 0;
+   timeout_limit = (next_timeout > 0) ? next_timeout : session_timeout;
+   timeout_grace = (next_timeout > 0 && next_grace > 0) ? next_grace : session_grace;
+
+   //only the event loop can enforce a deadline
+   if(timeout_limit <= 0 || !event_init())
+   {
+      timeout_pgid = -1;
+      return;
+   }
+
+   timeout_pgid = 0;
+   timeout_tty = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+/*
+ * Moves a child of a job with a deadline into the job's process
+ *    group. Called in the child before it executes its command.
+ */
+void timeout_child(void)
+{
+   if(timeout_pgid == -1)
+      return;
+
+   setpgid(0, timeout_pgid);
+
+   //the job reads from the terminal, so it must be in the foreground
+   if(timeout_tty)
+   {
+      signal(SIGTTOU, SIG_IGN);
+      tcsetpgrp(STDIN_FILENO, getpgrp());
+      signal(SIGTTOU, SIG_DFL);
+   }
+}
+
+/*
+ * Puts a newly started stage in the job's process group, the
+ *    first stage's PID becoming the group's ID. Called in the parent.
+ */
+void timeout_spawned(pid_t pid)
+{
+   if(timeout_pgid == -1)
+      return;
+
+   //done in both processes so neither has to wait for the other
+   setpgid(pid, timeout_pgid == 0 ? pid : timeout_pgid);
+
+   if(timeout_pgid == 0)
+   {
+      timeout_pgid = pid;
+      if(timeout_tty)
+         tcsetpgrp(STDIN_FILENO, pid);
+   }
+}
+
+//sends SIGKILL to a job which ignored SIGTERM
+void timeout_kill(void* data)
+{
+   timeout_timer = -1;
+
+   log_line("Deadline grace period over, sending SIGKILL\n");
+   killpg(timeout_pgid, SIGKILL);
+}
+
+//sends SIGTERM to a job which ran past its deadline
+void timeout_fire(void* data)
+{
+   char buff[128];
+   sprintf(buff, "Deadline reached, sending SIGTERM to process group %d\n", (int)timeout_pgid);
+   log_line(buff);
+
+   timeout_expired = 1;
+   killpg(timeout_pgid, SIGTERM);
+
+   timeout_timer = event_timer_add(stats_clock() + timeout_grace, timeout_kill, NULL);
+}
+
+/*
+ * Starts the job's deadline once all of its stages are running
+ */
+void timeout_arm(void)
+{
+   if(timeout_pgid > 0)
+      timeout_timer = event_timer_add(stats_clock() + timeout_limit, timeout_fire, NULL);
+}
+
+/*
+ * Cancels the deadline of a job which has been reaped and takes the
+ *    terminal back.
+ * Returns the job's exit status, TIMEOUT_STATUS if it ran out of time
+ */
+int timeout_end_job(int status)
+{
+   if(timeout_timer != -1)
+      event_timer_cancel(timeout_timer);
+   timeout_timer = -1;
+
+   if(timeout_pgid > 0 && timeout_tty)
+   {
+      signal(SIGTTOU, SIG_IGN);
+      tcsetpgrp(STDIN_FILENO, getpgrp());
+      signal(SIGTTOU, SIG_DFL);
+   }
+
+   timeout_pgid = -1;
+   timeout_tty = 0;
+
+   if(!timeout_expired)
+      return status;
+
+   timeout_expired = 0;
+   last_job_timed_out = 1;
+   metrics_count(C_TIMEOUTS);
+
+   return TIMEOUT_STATUS;
+}
+
+#endif //TIMEOUT_C
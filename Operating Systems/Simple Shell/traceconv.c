@@ -0,0 +1,94 @@
+/*
+ * File:   traceconv.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Converts a binary trace written with MYSHELL_TRACE=binary
+ *            into Chrome trace-event JSON which can be loaded into
+ *            chrome://tracing or Perfetto.
+ *
+ *            usage: traceconv trace.bin [trace.json]
+ */
+
+//log.c reserves space with fallocate, a GNU extension
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.c"
+
+int main(int argc, char* argv[])
+{
+   if(argc < 2)
+   {
+      fprintf(stderr, "usage: %s trace.bin [trace.json]\n", argv[0]);
+      return 2;
+   }
+
+   FILE* in = fopen(argv[1], "rb");
+   if(in == NULL)
+   {
+      fprintf(stderr, "Could not open file %s\n", argv[1]);
+      return 1;
+   }
+
+   FILE* out = stdout;
+   if(argc > 2)
+   {
+      out = fopen(argv[2], "w");
+      if(out == NULL)
+      {
+         fprintf(stderr, "Could not open file %s\n", argv[2]);
+         fclose(in);
+         return 1;
+      }
+   }
+
+   //check the header
+   char header[12];
+   uint32_t version;
+   if(fread(header, 1, sizeof(header), in) != sizeof(header) ||
+      memcmp(header, TRACE_MAGIC, 8) != 0)
+   {
+      fprintf(stderr, "%s is not a binary shell trace\n", argv[1]);
+      return 1;
+   }
+
+   memcpy(&version, header + 8, 4);
+   if(version != TRACE_VERSION)
+   {
+      fprintf(stderr, "Unsupported trace version %u\n", version);
+      return 1;
+   }
+
+   //   Records are written in one piece, so a short read can only be
+   //a record cut off when the shell was killed.
+   struct trace_record rec;
+   char text[TRACE_TEXT_MAX];
+   char buff[TRACE_TEXT_MAX * 6 + 256];
+   int events = 0;
+
+   fputs("[\n", out);
+   while(fread(&rec, sizeof(rec), 1, in) == 1)
+   {
+      if(rec.type >= NUM_EVENTS || rec.len > TRACE_TEXT_MAX ||
+         fread(text, 1, rec.len, in) != rec.len)
+         break;
+
+      int n = trace_format_json(buff, sizeof(buff), rec.ts, rec.pid, rec.type, text, rec.len);
+
+      //the last event must not be followed by a comma
+      if(events > 0)
+         fputs(",\n", out);
+      fwrite(buff, 1, n - 2, out);
+      events++;
+   }
+   fputs("\n]\n", out);
+
+   fclose(in);
+   if(out != stdout)
+      fclose(out);
+
+   fprintf(stderr, "%d events converted\n", events);
+   return 0;
+}
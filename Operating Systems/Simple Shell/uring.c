@@ -0,0 +1,231 @@
+/*
+ * File:   uring.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  A small io_uring, set up with the raw system calls, which
+ *            the shell uses to hand off its own file I/O: the log's
+ *            batched writes and their fsyncs. Requests are queued in
+ *            the submission ring and sent with one io_uring_enter.
+ *
+ *            The ring belongs to the process which set it up, so the
+ *            shell's children and any kernel without io_uring (or
+ *            MYSHELL_URING=0) use plain system calls instead.
+ */
+
+#ifndef URING_C
+#define URING_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+//requests which may be queued at once
+#define URING_ENTRIES 8
+
+struct uring
+{
+   int fd;                       //-1 until set up, -2 when unavailable
+   pid_t owner;
+   int* mine;                    //reads 1 in the owner and 0 in a child
+
+   //submission ring
+   unsigned* sq_head;
+   unsigned* sq_tail;
+   unsigned* sq_mask;
+   unsigned* sq_array;
+   struct io_uring_sqe* sqes;
+
+   //completion ring
+   unsigned* cq_head;
+   unsigned* cq_tail;
+   unsigned* cq_mask;
+   struct io_uring_cqe* cqes;
+
+   unsigned queued;              //prepared but not yet submitted
+   unsigned inflight;            //submitted but not yet completed
+   int error;                    //the first failed request's -errno
+
+   //called with each request's user_data and result as it completes
+   void (*complete)(unsigned long long data, int res);
+};
+
+struct uring shell_uring = { -1 };
+
+//system calls made for the shell's own I/O, for the benchmark
+unsigned long long io_syscalls = 0;
+
+/*
+ * Sets up the ring unless MYSHELL_URING is 0 or the kernel lacks it.
+ * Returns 1 if the ring can be used by this process
+ */
+int uring_ready(void)
+{
+   struct uring* r = &shell_uring;
+
+   if(r->fd >= 0)
+      return (r->mine != NULL) ? *r->mine : r->owner == getpid();
+   if(r->fd == -2)
+      return 0;
+
+   r->fd = -2;
+
+   char* env = getenv("MYSHELL_URING");
+   if(env != NULL && strcmp(env, "0") == 0)
+      return 0;
+
+   struct io_uring_params p;
+   memset(&p, 0, sizeof(p));
+   int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+   if(fd == -1)
+      return 0;
+
+   //both rings share one mapping on any kernel recent enough to matter
+   size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   if(!(p.features & IORING_FEAT_SINGLE_MMAP))
+   {
+      close(fd);
+      return 0;
+   }
+   size_t ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+   char* ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+   if(ring == MAP_FAILED)
+   {
+      close(fd);
+      return 0;
+   }
+
+   void* sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+   if(sqes == MAP_FAILED)
+   {
+      munmap(ring, ring_size);
+      close(fd);
+      return 0;
+   }
+
+   r->sq_head = (unsigned*)(ring + p.sq_off.head);
+   r->sq_tail = (unsigned*)(ring + p.sq_off.tail);
+   r->sq_mask = (unsigned*)(ring + p.sq_off.ring_mask);
+   r->sq_array = (unsigned*)(ring + p.sq_off.array);
+   r->sqes = sqes;
+   r->cq_head = (unsigned*)(ring + p.cq_off.head);
+   r->cq_tail = (unsigned*)(ring + p.cq_off.tail);
+   r->cq_mask = (unsigned*)(ring + p.cq_off.ring_mask);
+   r->cqes = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+   //children must not share the ring with the shell
+   fcntl(fd, F_SETFD, FD_CLOEXEC);
+   r->fd = fd;
+   r->owner = getpid();
+   r->queued = 0;
+   r->inflight = 0;
+   r->error = 0;
+
+   //   A page which reads as zero in a forked child tells the shell
+   //from its children without a getpid every time.
+   r->mine = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if(r->mine != MAP_FAILED && madvise(r->mine, sysconf(_SC_PAGESIZE), MADV_WIPEONFORK) == 0)
+      *r->mine = 1;
+   else
+      r->mine = NULL;
+
+   return 1;
+}
+
+/*
+ * Queues a request.
+ * Returns its entry to be filled in or NULL if the ring is full
+ */
+struct io_uring_sqe* uring_queue(int op, int fd, const void* addr, unsigned len, long long offset)
+{
+   struct uring* r = &shell_uring;
+
+   unsigned tail = *r->sq_tail;
+   if(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= URING_ENTRIES ||
+      r->queued + r->inflight >= URING_ENTRIES)
+      return NULL;
+
+   unsigned index = tail & *r->sq_mask;
+   struct io_uring_sqe* sqe = &r->sqes[index];
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->opcode = op;
+   sqe->fd = fd;
+   sqe->addr = (unsigned long long)(unsigned long)addr;
+   sqe->len = len;
+   sqe->off = (unsigned long long)offset;
+
+   r->sq_array[index] = index;
+   __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   r->queued++;
+
+   return sqe;
+}
+
+//takes the completions which have arrived
+void uring_reap(void)
+{
+   struct uring* r = &shell_uring;
+
+   unsigned head = *r->cq_head;
+   while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+   {
+      struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+      if(cqe->res < 0 && r->error == 0)
+         r->error = cqe->res;
+      if(r->complete != NULL)
+         r->complete(cqe->user_data, cqe->res);
+      head++;
+      r->inflight--;
+   }
+   __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Submits the queued requests and waits until at most left of them
+ *    are still in flight.
+ * Returns 0 or -1 if the ring failed
+ */
+int uring_submit(unsigned left)
+{
+   struct uring* r = &shell_uring;
+
+   while(1)
+   {
+      uring_reap();
+
+      unsigned wait = (r->inflight + r->queued > left) ? r->inflight + r->queued - left : 0;
+      if(r->queued == 0 && wait == 0)
+         return 0;
+
+      io_syscalls++;
+      int n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if(n == -1 && errno == EINTR)
+         continue;
+      if(n == -1)
+         return -1;
+
+      r->queued -= n;
+      r->inflight += n;
+   }
+}
+
+/*
+ * Returns and clears the error of the first failed request, 0 if none
+ */
+int uring_error(void)
+{
+   int error = shell_uring.error;
+   shell_uring.error = 0;
+   return error;
+}
+
+#endif //URING_C
@@ -0,0 +1,780 @@
+/*
+ * File:   vars.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  Shell variables and the environment, kept in one hash
+ *            table of cells. The environment is imported into the
+ *            table the first time a variable is used.
+ *
+ *               NAME=value           sets a shell variable
+ *               NAME=value cmd       exports it to cmd only
+ *               export NAME[=value]  exports a variable
+ *               unset NAME           removes one
+ *               $NAME ${NAME} $? $$  are expanded in command words
+ *               ${#NAME}             the length of the value
+ *               ${NAME:OFF:LEN}      a substring (LEN is optional)
+ *               ${NAME#P} ${NAME##P} the value without the shortest or
+ *                                    longest prefix matching P
+ *               ${NAME%P} ${NAME%%P} the same for a suffix
+ *               $((EXPRESSION))      64-bit arithmetic, see arith.c
+ *
+ *            Cells are never freed, only emptied, so a pointer to one
+ *            stays valid for the whole session. parse.c expands each
+ *            word as it is split off the line, in one pass, and every
+ *            word holding a variable gets a slot which remembers its
+ *            text and the cells it used. A command run more than once,
+ *            like the body of a loop, refreshes just its slots.
+ *
+ *            The block of NAME=value strings passed to exec is only
+ *            rebuilt (and environ pointed at it) before a command is
+ *            started after an exported variable has changed.
+ */
+
+#ifndef VARS_C
+#define VARS_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "arith.c"
+#include "out.c"
+
+#define VAR_BUCKETS 256
+
+//cells a slot remembers, later references are looked up each time
+#define VAR_REFS 8
+
+extern char** environ;
+
+//implemented in main.c
+extern int last_status;
+
+//one variable, never freed once created
+struct var_cell
+{
+   char* name;
+   char* value;            //NULL when the variable is unset
+   int exported;
+   char* env;              //NAME=value for the environment, NULL when stale
+   int env_owned;          //env was allocated here, not imported
+   struct var_cell* next;  //next cell in the same bucket
+};
+
+//a word of a command which holds variables
+struct var_slot
+{
+   char* word;             //the word as it was typed
+   char* result;           //the word with its variables expanded
+   int size;
+   int nrefs;
+   struct var_cell* refs[VAR_REFS];
+   char** arg;             //argv entry holding the result, if any
+   char* file;             //or redirection file name it is copied to
+   int file_size;
+};
+
+struct var_cell* var_table[VAR_BUCKETS];
+int var_ready = 0;
+
+//the environment block built here, NULL while the imported one is used
+char** var_envp = NULL;
+int var_env_dirty = 0;
+
+//NAME=value strings environ may still point to, freed once it is rebuilt
+char** var_retired = NULL;
+int var_nretired = 0;
+int var_retired_size = 0;
+
+//slots of the words of the command being parsed, taken over by the
+//command once it has been parsed
+struct var_slot* var_slots = NULL;
+int var_nslots = 0;
+int var_slots_size = 0;
+
+//a variable set for the duration of a single command
+struct var_saved
+{
+   struct var_cell* cell;
+   char* value;
+   int exported;
+};
+
+#define VAR_SAVED_MAX 16
+struct var_saved var_saved[VAR_SAVED_MAX];
+int var_nsaved = 0;
+
+//returns the bucket of a name (FNV-1a) hashing at most len characters
+unsigned int var_hash(const char* name, int len)
+{
+   unsigned int hash = 2166136261u;
+   int i;
+   for(i = 0; i < len && name[i] != '\0'; i++)
+   {
+      hash ^= (unsigned char)name[i];
+      hash *= 16777619u;
+   }
+
+   return hash % VAR_BUCKETS;
+}
+
+//returns the length of the variable name at the start of text
+int var_name_len(const char* text)
+{
+   if(!isalpha((unsigned char)text[0]) && text[0] != '_')
+      return 0;
+
+   int len = 1;
+   while(isalnum((unsigned char)text[len]) || text[len] == '_')
+      len++;
+
+   return len;
+}
+
+struct var_cell* var_find(const char* name, int len, int create);
+
+/*
+ * Imports the environment the shell was started with
+ */
+void var_init(void)
+{
+   if(var_ready)
+      return;
+   var_ready = 1;
+
+   int i;
+   for(i = 0; environ[i] != NULL; i++)
+   {
+      char* eq = strchr(environ[i], '=');
+      if(eq == NULL)
+         continue;
+
+      struct var_cell* cell = var_find(environ[i], eq - environ[i], 1);
+      if(cell == NULL || cell->value != NULL)
+         continue;
+
+      cell->value = strdup(eq + 1);
+      cell->exported = 1;
+      cell->env = environ[i];
+   }
+}
+
+/*
+ * Finds the cell of the first len characters of name, creating an
+ *    empty one if asked to.
+ * Returns the cell or NULL
+ */
+struct var_cell* var_find(const char* name, int len, int create)
+{
+   var_init();
+
+   unsigned int bucket = var_hash(name, len);
+   struct var_cell* cell;
+   for(cell = var_table[bucket]; cell != NULL; cell = cell->next)
+      if(strncmp(cell->name, name, len) == 0 && cell->name[len] == '\0')
+         return cell;
+
+   if(!create)
+      return NULL;
+
+   cell = calloc(1, sizeof(struct var_cell));
+   if(cell == NULL)
+      return NULL;
+   cell->name = strndup(name, len);
+   cell->next = var_table[bucket];
+   var_table[bucket] = cell;
+
+   return cell;
+}
+
+//drops the NAME=value string of a cell which has changed
+void var_stale(struct var_cell* cell)
+{
+   //   environ keeps pointing to the string until the next sync, so it
+   //is only freed then.
+   if(cell->env_owned)
+   {
+      if(var_nretired == var_retired_size)
+      {
+         int size = (var_retired_size > 0) ? var_retired_size * 2 : 16;
+         char** grown = realloc(var_retired, size * sizeof(char*));
+         if(grown != NULL)
+         {
+            var_retired = grown;
+            var_retired_size = size;
+         }
+      }
+      if(var_nretired < var_retired_size)
+         var_retired[var_nretired++] = cell->env;
+   }
+   cell->env = NULL;
+   cell->env_owned = 0;
+
+   if(cell->exported)
+      var_env_dirty = 1;
+}
+
+/*
+ * Sets the variable of a cell. value may be NULL to unset it and
+ *    exported is 1 to export it, 0 to stop exporting it or -1 to leave
+ *    it as is.
+ */
+void var_set_cell(struct var_cell* cell, const char* value, int exported)
+{
+   //a change of exported value or of the set of exported names
+   var_stale(cell);
+
+   //value may be the cell's own
+   char* copy = (value != NULL) ? strdup(value) : NULL;
+   free(cell->value);
+   cell->value = copy;
+   if(exported != -1)
+      cell->exported = exported;
+
+   var_stale(cell);
+}
+
+/*
+ * Sets a variable by name, see var_set_cell.
+ * Returns 0 or -1 if the name is not valid
+ */
+int var_set(const char* name, const char* value, int exported)
+{
+   int len = strlen(name);
+   if(len == 0 || var_name_len(name) != len)
+      return -1;
+
+   struct var_cell* cell = var_find(name, len, 1);
+   if(cell == NULL)
+      return -1;
+
+   var_set_cell(cell, value, exported);
+   return 0;
+}
+
+/*
+ * Returns the value of a variable or NULL if it is not set
+ */
+char* var_get(const char* name)
+{
+   struct var_cell* cell = var_find(name, strlen(name), 0);
+   return (cell != NULL) ? cell->value : NULL;
+}
+
+/*
+ * Points environ at a block built from the exported variables if any
+ *    of them has changed. Called before a command is started.
+ */
+void var_sync_env(void)
+{
+   if(!var_env_dirty)
+      return;
+
+   int count = 0, i;
+   struct var_cell* cell;
+   for(i = 0; i < VAR_BUCKETS; i++)
+      for(cell = var_table[i]; cell != NULL; cell = cell->next)
+         count += (cell->exported && cell->value != NULL);
+
+   char** block = malloc((count + 1) * sizeof(char*));
+   if(block == NULL)
+      return;
+
+   count = 0;
+   for(i = 0; i < VAR_BUCKETS; i++)
+   {
+      for(cell = var_table[i]; cell != NULL; cell = cell->next)
+      {
+         if(!cell->exported || cell->value == NULL)
+            continue;
+
+         if(cell->env == NULL)
+         {
+            int len = strlen(cell->name) + strlen(cell->value) + 2;
+            cell->env = malloc(len);
+            if(cell->env == NULL)
+               continue;
+            snprintf(cell->env, len, "%s=%s", cell->name, cell->value);
+            cell->env_owned = 1;
+         }
+
+         block[count++] = cell->env;
+      }
+   }
+   block[count] = NULL;
+
+   free(var_envp);
+   var_envp = block;
+   environ = block;
+   var_env_dirty = 0;
+
+   while(var_nretired > 0)
+      free(var_retired[--var_nretired]);
+}
+
+//appends len characters to the result of a slot
+void var_append(struct var_slot* slot, int* len, const char* text, int n)
+{
+   if(*len + n + 1 > slot->size)
+   {
+      int size = (slot->size > 0) ? slot->size : 64;
+      while(*len + n + 1 > size)
+         size *= 2;
+
+      char* grown = realloc(slot->result, size);
+      if(grown == NULL)
+         return;
+      slot->result = grown;
+      slot->size = size;
+   }
+
+   memcpy(slot->result + *len, text, n);
+   *len += n;
+   slot->result[*len] = '\0';
+}
+
+/*
+ * Returns the cell of the next variable a slot refers to. It is looked
+ *    up and remembered the first time, after that the remembered one
+ *    is used.
+ */
+struct var_cell* var_ref(struct var_slot* slot, int cached, int* ref, const char* name, int n)
+{
+   struct var_cell* cell;
+   if(cached && *ref < slot->nrefs)
+      cell = slot->refs[*ref];
+   else
+   {
+      //created if need be so a later assignment lands in it
+      cell = var_find(name, n, 1);
+      if(!cached && slot->nrefs < VAR_REFS)
+         slot->refs[slot->nrefs++] = cell;
+   }
+   (*ref)++;
+
+   return cell;
+}
+
+//where the variables of an arithmetic expression are looked up
+struct var_lookup
+{
+   struct var_slot* slot;
+   int cached;
+   int* ref;
+};
+
+//returns the value of a variable in an arithmetic expression
+long long var_arith_lookup(void* data, const char* name, int len)
+{
+   struct var_lookup* lookup = data;
+   struct var_cell* cell = var_ref(lookup->slot, lookup->cached, lookup->ref, name, len);
+
+   return (cell != NULL && cell->value != NULL) ? strtoll(cell->value, NULL, 0) : 0;
+}
+
+/*
+ * Evaluates the len characters of an arithmetic expression at text.
+ * Returns 0 or -1 if it is not valid (the error has been printed)
+ */
+int var_arith(struct var_lookup* lookup, const char* text, int len, long long* value)
+{
+   char* expr = strndup(text, len);
+   if(expr == NULL)
+      return -1;
+
+   const char* error;
+   *value = arith_eval(expr, var_arith_lookup, lookup, &error);
+   if(error != NULL)
+      fprintf(stderr, "arithmetic: %s: %s\n", error, expr);
+
+   free(expr);
+   return (error != NULL) ? -1 : 0;
+}
+
+/*
+ * Appends the part of a value which an operation of ${NAME...} keeps:
+ *    :OFF[:LEN] a substring, # and ## strip the shortest and longest
+ *    prefix matching a pattern and % and %% the same for a suffix.
+ */
+void var_operate(struct var_slot* slot, int* len, struct var_lookup* lookup,
+                 const char* value, const char* op, const char* close)
+{
+   int vlen = strlen(value);
+
+   if(*op == ':')
+   {
+      const char* colon = memchr(op + 1, ':', close - op - 1);
+      const char* off_end = (colon != NULL) ? colon : close;
+
+      long long off, count = vlen;
+      if(var_arith(lookup, op + 1, off_end - op - 1, &off) == -1)
+         return;
+      if(colon != NULL && var_arith(lookup, colon + 1, close - colon - 1, &count) == -1)
+         return;
+
+      //negative offsets and lengths count back from the end
+      if(off < 0)
+         off = (off + vlen < 0) ? 0 : off + vlen;
+      if(off > vlen)
+         off = vlen;
+      if(count < 0)
+         count = (vlen + count > off) ? vlen + count - off : 0;
+      if(count > vlen - off)
+         count = vlen - off;
+
+      var_append(slot, len, value + off, count);
+      return;
+   }
+
+   if(*op != '#' && *op != '%')
+   {
+      fprintf(stderr, "%.*s: bad substitution\n", (int)(close - op), op);
+      return;
+   }
+
+   int longest = (op[1] == op[0]);
+   char* pattern = strndup(op + 1 + longest, close - op - 1 - longest);
+   char* copy = strdup(value);
+   if(pattern == NULL || copy == NULL)
+   {
+      free(pattern);
+      free(copy);
+      return;
+   }
+
+   //the prefix or suffix is tried from the shortest or longest one
+   int start = 0, end = vlen;
+   int i;
+   for(i = 0; i <= vlen; i++)
+   {
+      int cut = longest ? vlen - i : i;
+      int match;
+
+      if(*op == '#')
+      {
+         char saved = copy[cut];
+         copy[cut] = '\0';
+         match = (fnmatch(pattern, copy, 0) == 0);
+         copy[cut] = saved;
+         if(match)
+            start = cut;
+      }
+      else
+      {
+         match = (fnmatch(pattern, copy + (vlen - cut), 0) == 0);
+         if(match)
+            end = vlen - cut;
+      }
+
+      if(match)
+         break;
+   }
+
+   var_append(slot, len, value + start, end - start);
+   free(pattern);
+   free(copy);
+}
+
+/*
+ * Expands the variables of a slot's word into its result in a single
+ *    pass: $NAME, ${NAME}, ${#NAME}, ${NAME:OFF:LEN}, ${NAME#PATTERN}
+ *    and the like, $((EXPRESSION)), $? and $$. The first time the
+ *    cells are looked up and remembered, after that the remembered
+ *    ones are used.
+ * Returns the result
+ */
+char* var_expand(struct var_slot* slot, int cached)
+{
+   char* cur = slot->word;
+   int len = 0;
+   int ref = 0;
+   char number[32];
+
+   struct var_lookup lookup = { slot, cached, &ref };
+
+   var_append(slot, &len, "", 0);
+
+   while(*cur != '\0')
+   {
+      char* dollar = strchr(cur, '$');
+      if(dollar == NULL)
+      {
+         var_append(slot, &len, cur, strlen(cur));
+         break;
+      }
+      var_append(slot, &len, cur, dollar - cur);
+      cur = dollar + 1;
+
+      //$? and $$
+      if(*cur == '?' || *cur == '$')
+      {
+         snprintf(number, sizeof(number), "%d", (*cur == '?') ? last_status : (int)getpid());
+         var_append(slot, &len, number, strlen(number));
+         cur++;
+         continue;
+      }
+
+      //$((EXPRESSION)), up to the ) which closes the first (
+      if(cur[0] == '(' && cur[1] == '(')
+      {
+         char* end = cur;
+         int depth = 0;
+         while(*end != '\0' && !(*end == ')' && --depth == 0))
+            depth += (*end++ == '(');
+
+         if(*end == ')' && end[-1] == ')' && end - cur >= 3)
+         {
+            long long value;
+            if(var_arith(&lookup, cur + 2, end - 1 - (cur + 2), &value) == 0)
+            {
+               snprintf(number, sizeof(number), "%lld", value);
+               var_append(slot, &len, number, strlen(number));
+            }
+            cur = end + 1;
+            continue;
+         }
+      }
+
+      //${...}
+      if(*cur == '{')
+      {
+         char* close = strchr(cur, '}');
+         int length = (cur[1] == '#');
+         char* name = cur + 1 + length;
+         int n = var_name_len(name);
+
+         if(close != NULL && n > 0 && (!length || name[n] == '}'))
+         {
+            struct var_cell* cell = var_ref(slot, cached, &ref, name, n);
+            char* value = (cell != NULL && cell->value != NULL) ? cell->value : "";
+
+            if(length)
+            {
+               snprintf(number, sizeof(number), "%d", (int)strlen(value));
+               var_append(slot, &len, number, strlen(number));
+            }
+            else if(name + n == close)
+               var_append(slot, &len, value, strlen(value));
+            else
+               var_operate(slot, &len, &lookup, value, name + n, close);
+
+            cur = close + 1;
+            continue;
+         }
+      }
+
+      //$NAME
+      int n = var_name_len(cur);
+      if(n == 0)
+      {
+         //not a variable, keep the $
+         var_append(slot, &len, "$", 1);
+         continue;
+      }
+
+      struct var_cell* cell = var_ref(slot, cached, &ref, cur, n);
+      if(cell != NULL && cell->value != NULL)
+         var_append(slot, &len, cell->value, strlen(cell->value));
+      cur += n;
+   }
+
+   return slot->result;
+}
+
+/*
+ * Expands the variables of a word split off a command line. Called
+ *    by parse.c for every word.
+ * Returns the expanded word, the word itself when it has none
+ */
+char* expand_word(char* word)
+{
+   if(word == NULL || strchr(word, '$') == NULL)
+      return word;
+
+   if(var_nslots == var_slots_size)
+   {
+      int size = (var_slots_size > 0) ? var_slots_size * 2 : 32;
+      struct var_slot* grown = realloc(var_slots, size * sizeof(struct var_slot));
+      if(grown == NULL)
+         return word;
+      var_slots = grown;
+      var_slots_size = size;
+   }
+
+   struct var_slot* slot = &var_slots[var_nslots++];
+   memset(slot, 0, sizeof(struct var_slot));
+   slot->word = word;
+
+   char* result = var_expand(slot, 0);
+   return (result != NULL) ? result : word;
+}
+
+/*
+ * Hands the slots of the words parsed so far to their command.
+ * Returns the slots and stores how many there are in count
+ */
+struct var_slot* var_take_slots(int* count)
+{
+   struct var_slot* slots = var_slots;
+   *count = var_nslots;
+
+   var_slots = NULL;
+   var_nslots = 0;
+   var_slots_size = 0;
+
+   return slots;
+}
+
+/*
+ * Records where the results of a command's slots are used: an argv
+ *    entry holding the result or else the redirection file name the
+ *    result was copied to
+ */
+void var_locate_slots(struct var_slot* slots, int count, char*** argvs, int nargvs,
+                      char** files, int nfiles, int file_size)
+{
+   int i, j, k;
+   for(i = 0; i < count; i++)
+   {
+      for(j = 0; j < nargvs && slots[i].arg == NULL; j++)
+         for(k = 0; argvs[j][k] != NULL; k++)
+            if(argvs[j][k] == slots[i].result)
+               slots[i].arg = &argvs[j][k];
+
+      for(j = 0; j < nfiles && slots[i].arg == NULL && slots[i].file == NULL; j++)
+      {
+         if(strcmp(files[j], slots[i].result) == 0)
+         {
+            slots[i].file = files[j];
+            slots[i].file_size = file_size;
+         }
+      }
+   }
+}
+
+/*
+ * Expands the slots of a command again with the current values of
+ *    their cells, which they do not have to look up
+ */
+void var_refresh(struct var_slot* slots, int count)
+{
+   int i;
+   for(i = 0; i < count; i++)
+   {
+      char* result = var_expand(&slots[i], 1);
+      if(slots[i].arg != NULL)
+         *slots[i].arg = result;
+      else if(slots[i].file != NULL)
+         snprintf(slots[i].file, slots[i].file_size, "%s", result);
+   }
+}
+
+/*
+ * Frees the slots of a command
+ */
+void var_free_slots(struct var_slot* slots, int count)
+{
+   int i;
+   for(i = 0; i < count; i++)
+      free(slots[i].result);
+   free(slots);
+}
+
+/*
+ * Returns the word a command word was expanded from, or the word
+ *    itself if it held no variables
+ */
+char* var_source(char* word, struct var_slot* slots, int count)
+{
+   int i;
+   for(i = 0; i < count; i++)
+      if(slots[i].result == word)
+         return slots[i].word;
+
+   return word;
+}
+
+/*
+ * Counts the NAME=value words at the start of a command. Only words
+ *    typed that way count, not ones a variable expanded to.
+ */
+int var_count_assignments(char** cmd, struct var_slot* slots, int nslots)
+{
+   int count = 0;
+   while(cmd[count] != NULL)
+   {
+      char* word = var_source(cmd[count], slots, nslots);
+      int n = var_name_len(word);
+      if(n == 0 || word[n] != '=')
+         break;
+      count++;
+   }
+
+   return count;
+}
+
+/*
+ * Sets the variables of count NAME=value words. When temporary they
+ *    are exported and the old values kept for var_restore.
+ */
+void var_assign(char** cmd, int count, int temporary)
+{
+   int i;
+   for(i = 0; i < count; i++)
+   {
+      char* eq = strchr(cmd[i], '=');
+      *eq = '\0';
+
+      if(temporary && var_nsaved < VAR_SAVED_MAX)
+      {
+         struct var_cell* cell = var_find(cmd[i], eq - cmd[i], 1);
+         if(cell != NULL)
+         {
+            var_saved[var_nsaved].cell = cell;
+            var_saved[var_nsaved].value = (cell->value != NULL) ? strdup(cell->value) : NULL;
+            var_saved[var_nsaved].exported = cell->exported;
+            var_nsaved++;
+         }
+      }
+
+      var_set(cmd[i], eq + 1, temporary ? 1 : -1);
+      *eq = '=';
+   }
+}
+
+/*
+ * Puts back the variables a command was given, newest first
+ */
+void var_restore(void)
+{
+   while(var_nsaved > 0)
+   {
+      struct var_saved* saved = &var_saved[--var_nsaved];
+      var_set_cell(saved->cell, saved->value, saved->exported);
+      free(saved->value);
+   }
+}
+
+/*
+ * Prints the variables, only the exported ones if asked to
+ */
+void var_print(int exported_only)
+{
+   int i;
+   struct var_cell* cell;
+   for(i = 0; i < VAR_BUCKETS; i++)
+   {
+      for(cell = var_table[i]; cell != NULL; cell = cell->next)
+      {
+         if(cell->value == NULL || (exported_only && !cell->exported))
+            continue;
+         out_printf("%s%s=%s\n", exported_only ? "export " : "", cell->name, cell->value);
+      }
+   }
+   out_end();
+}
+
+#endif //VARS_C
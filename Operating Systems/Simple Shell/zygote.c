@@ -0,0 +1,517 @@
+/*
+ * File:   zygote.c
+ * Author: agent
+ * Date:   10-19-26
+ * Notes:  An optional helper process which spawns commands for the
+ *            shell. It is forked from main() before the shell has
+ *            grown, so forking from it stays cheap however large the
+ *            shell's memory and descriptor tables become. Enabled by
+ *            setting MYSHELL_ZYGOTE.
+ *
+ *            The shell sends a spawn request (argv, environment and
+ *            the stdin/stdout descriptors through SCM_RIGHTS) over a
+ *            socketpair. The zygote replies with the child's PID and,
+ *            once the child has been reaped, its exit status and
+ *            resource usage.
+ */
+
+#ifndef ZYGOTE_C
+#define ZYGOTE_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "stats.c"
+#include "log.c"
+
+//message types
+#define ZY_SPAWN   1	//shell -> zygote
+#define ZY_SPAWNED 2	//zygote -> shell, the child was forked
+#define ZY_EXITED  3	//zygote -> shell, the child was reaped
+
+//descriptors which may accompany a spawn request
+#define ZY_STDIN  1
+#define ZY_STDOUT 2
+
+//the largest spawn request (argv and environment included)
+#define ZY_MSG_MAX 65536
+
+//exits which arrived before the shell asked for them
+#define ZY_PENDING 64
+
+struct zygote_request
+{
+   int type;
+   int index;     //stage number, used for logging
+   int count;     //stages in the pipeline
+   int argc;
+   int envc;
+   int fdmask;    //ZY_STDIN and/or ZY_STDOUT
+   //followed by argc + envc nul terminated strings
+};
+
+struct zygote_reply
+{
+   int type;
+   pid_t pid;
+   int err;             //errno when fork failed
+   int status;          //raw wait status for ZY_EXITED
+   struct rusage usage;
+};
+
+extern char** environ;
+
+//implemented in execute.c
+void exec_stage(char** cmd, int index, int count, int in_fd, int* pipefd,
+                char* infile, char* outfile, int outRed);
+
+//socket to the zygote, -1 when there is none
+int zygote_fd = -1;
+pid_t zygote_pid = -1;
+
+//the shell which started the zygote
+pid_t zygote_owner = -1;
+
+//exits received while waiting for something else
+struct zygote_reply zygote_pending[ZY_PENDING];
+int zygote_num_pending = 0;
+
+void zygote_loop(int sock);
+
+/*
+ * Closes the socket, which makes the zygote exit, and reaps it
+ */
+void zygote_stop(void)
+{
+   if(zygote_pid <= 0 || getpid() != zygote_owner)
+      return;
+
+   if(zygote_fd != -1)
+      close(zygote_fd);
+   zygote_fd = -1;
+
+   waitpid(zygote_pid, NULL, 0);
+   zygote_pid = -1;
+}
+
+/*
+ * Starts the zygote if MYSHELL_ZYGOTE is set.
+ * Returns 1 if the zygote is running
+ */
+int zygote_start(void)
+{
+   char* enabled = getenv("MYSHELL_ZYGOTE");
+   if(enabled == NULL || enabled[0] == '\0' || strcmp(enabled, "0") == 0)
+      return 0;
+
+   int sv[2];
+   if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+      return 0;
+
+   pid_t pid = fork();
+   if(pid < 0)
+   {
+      close(sv[0]);
+      close(sv[1]);
+      return 0;
+   }
+   else if(pid == 0)
+   {
+      close(sv[0]);
+      zygote_loop(sv[1]);
+      _exit(0);
+   }
+
+   close(sv[1]);
+   zygote_fd = sv[0];
+   zygote_pid = pid;
+   zygote_owner = getpid();
+
+   atexit(zygote_stop);
+
+   char buff[64];
+   sprintf(buff, "Started zygote. PID=%d\n", pid);
+   log_line(buff);
+
+   return 1;
+}
+
+/*
+ * Sends a reply to the shell
+ */
+void zygote_send(int sock, struct zygote_reply* reply)
+{
+   while(send(sock, reply, sizeof(*reply), 0) == -1 && errno == EINTR)
+      ;
+}
+
+/*
+ * Forks and executes one spawn request inside the zygote
+ */
+void zygote_handle(int sock, char* msg, int len, int* fds, int nfds)
+{
+   struct zygote_request* req = (struct zygote_request*)msg;
+   struct zygote_reply reply;
+   memset(&reply, 0, sizeof(reply));
+   reply.type = ZY_SPAWNED;
+
+   //unpack the argv and environment strings in place
+   char* args[req->argc + 1];
+   char* envs[req->envc + 1];
+   char* cur = msg + sizeof(*req);
+   char* end = msg + len;
+
+   int i;
+   for(i = 0; i < req->argc + req->envc && cur < end; i++)
+   {
+      if(i < req->argc)
+         args[i] = cur;
+      else
+         envs[i - req->argc] = cur;
+      cur += strlen(cur) + 1;
+   }
+   args[req->argc] = NULL;
+   envs[req->envc] = NULL;
+
+   int in_fd = -1;
+   int pipefd[2] = { -1, -1 };
+   int next = 0;
+   if((req->fdmask & ZY_STDIN) && next < nfds)
+      in_fd = fds[next++];
+   if((req->fdmask & ZY_STDOUT) && next < nfds)
+      pipefd[1] = fds[next++];
+
+   pid_t pid = fork();
+   if(pid == 0)
+   {
+      //the child gets back the default signal handling of a command
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+
+      environ = envs;
+      exec_stage(args, req->index, req->count, in_fd, pipefd, "", "", 0);
+   }
+
+   reply.pid = pid;
+   reply.err = (pid < 0) ? errno : 0;
+   zygote_send(sock, &reply);
+
+   for(i = 0; i < nfds; i++)
+      close(fds[i]);
+}
+
+/*
+ * Reports every child which has terminated to the shell
+ */
+void zygote_reap_children(int sock)
+{
+   struct zygote_reply reply;
+   memset(&reply, 0, sizeof(reply));
+   reply.type = ZY_EXITED;
+
+   while((reply.pid = wait4(-1, &reply.status, WNOHANG, &reply.usage)) > 0)
+      zygote_send(sock, &reply);
+}
+
+/*
+ * Main loop of the zygote: serves spawn requests and reports exits
+ *    until the shell closes its end of the socket
+ */
+void zygote_loop(int sock)
+{
+   //Ctrl-C at the terminal is meant for the commands, not the zygote
+   signal(SIGINT, SIG_IGN);
+   signal(SIGQUIT, SIG_IGN);
+
+   sigset_t mask;
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGCHLD);
+   sigprocmask(SIG_BLOCK, &mask, NULL);
+
+   int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+   if(sfd == -1)
+      _exit(1);
+
+   static char msg[ZY_MSG_MAX];
+
+   while(1)
+   {
+      struct pollfd pfds[2];
+      pfds[0].fd = sock;
+      pfds[0].events = POLLIN;
+      pfds[1].fd = sfd;
+      pfds[1].events = POLLIN;
+
+      if(poll(pfds, 2, -1) == -1)
+      {
+         if(errno == EINTR)
+            continue;
+         _exit(1);
+      }
+
+      if(pfds[1].revents & POLLIN)
+      {
+         struct signalfd_siginfo info;
+         read(sfd, &info, sizeof(info));
+         zygote_reap_children(sock);
+      }
+
+      if(pfds[0].revents & (POLLIN | POLLHUP | POLLERR))
+      {
+         char control[CMSG_SPACE(2 * sizeof(int))];
+         struct iovec iov = { msg, sizeof(msg) };
+         struct msghdr mh;
+         memset(&mh, 0, sizeof(mh));
+         mh.msg_iov = &iov;
+         mh.msg_iovlen = 1;
+         mh.msg_control = control;
+         mh.msg_controllen = sizeof(control);
+
+         int len = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+
+         //the shell has gone away
+         if(len <= 0)
+         {
+            if(len == -1 && errno == EINTR)
+               continue;
+            _exit(0);
+         }
+
+         int fds[2];
+         int nfds = 0;
+         struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+         if(cm != NULL && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+         {
+            nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if(nfds > 2)
+               nfds = 2;
+            memcpy(fds, CMSG_DATA(cm), nfds * sizeof(int));
+         }
+
+         if(len >= (int)sizeof(struct zygote_request) && ((struct zygote_request*)msg)->type == ZY_SPAWN)
+            zygote_handle(sock, msg, len, fds, nfds);
+      }
+   }
+}
+
+/*
+ * Takes the exit of a child out of the ones already received.
+ * Returns 1 if it was there
+ */
+int zygote_take_pending(pid_t pid, struct zygote_reply* reply)
+{
+   int i;
+   for(i = 0; i < zygote_num_pending; i++)
+   {
+      if(zygote_pending[i].pid == pid)
+      {
+         *reply = zygote_pending[i];
+         zygote_pending[i] = zygote_pending[--zygote_num_pending];
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/*
+ * Reads the next reply from the zygote, keeping exits for later
+ *    unless they are the one being waited for.
+ * Returns 1 if a reply of the wanted type (and PID, for exits) was read
+ *         0 if the zygote has gone away
+ */
+int zygote_receive(int type, pid_t pid, struct zygote_reply* reply)
+{
+   //an exit may already have arrived
+   if(type == ZY_EXITED && zygote_take_pending(pid, reply))
+      return 1;
+
+   while(1)
+   {
+      int len = recv(zygote_fd, reply, sizeof(*reply), 0);
+      if(len == -1 && errno == EINTR)
+         continue;
+      if(len != sizeof(*reply))
+         return 0;
+
+      if(reply->type == type && (type != ZY_EXITED || reply->pid == pid))
+         return 1;
+
+      if(reply->type == ZY_EXITED && zygote_num_pending < ZY_PENDING)
+         zygote_pending[zygote_num_pending++] = *reply;
+   }
+}
+
+/*
+ * Asks the zygote to run one stage of a pipeline with in_fd and
+ *    out_fd (-1 to inherit) as its stdin and stdout.
+ * Returns the PID of the child or -1 if it could not be spawned
+ */
+pid_t zygote_spawn(char** cmd, int index, int count, int in_fd, int out_fd)
+{
+   static char msg[ZY_MSG_MAX];
+   struct zygote_request* req = (struct zygote_request*)msg;
+   int len = sizeof(*req);
+
+   req->type = ZY_SPAWN;
+   req->index = index;
+   req->count = count;
+   req->argc = 0;
+   req->envc = 0;
+   req->fdmask = 0;
+
+   //pack argv followed by the environment
+   int i;
+   for(i = 0; cmd[i] != NULL; i++, req->argc++)
+   {
+      int n = strlen(cmd[i]) + 1;
+      if(len + n > ZY_MSG_MAX)
+         return -1;
+      memcpy(msg + len, cmd[i], n);
+      len += n;
+   }
+   for(i = 0; environ[i] != NULL; i++, req->envc++)
+   {
+      int n = strlen(environ[i]) + 1;
+      if(len + n > ZY_MSG_MAX)
+         return -1;
+      memcpy(msg + len, environ[i], n);
+      len += n;
+   }
+
+   int fds[2];
+   int nfds = 0;
+   if(in_fd != -1)
+   {
+      req->fdmask |= ZY_STDIN;
+      fds[nfds++] = in_fd;
+   }
+   if(out_fd != -1)
+   {
+      req->fdmask |= ZY_STDOUT;
+      fds[nfds++] = out_fd;
+   }
+
+   char control[CMSG_SPACE(2 * sizeof(int))];
+   struct iovec iov = { msg, len };
+   struct msghdr mh;
+   memset(&mh, 0, sizeof(mh));
+   mh.msg_iov = &iov;
+   mh.msg_iovlen = 1;
+
+   if(nfds > 0)
+   {
+      mh.msg_control = control;
+      mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+      struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+      cm->cmsg_level = SOL_SOCKET;
+      cm->cmsg_type = SCM_RIGHTS;
+      cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+      memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+   }
+
+   int sent;
+   while((sent = sendmsg(zygote_fd, &mh, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+      ;
+
+   struct zygote_reply reply;
+   if(sent == -1 || !zygote_receive(ZY_SPAWNED, 0, &reply))
+   {
+      //the zygote is unusable, fall back to forking directly
+      close(zygote_fd);
+      zygote_fd = -1;
+      return -1;
+   }
+
+   if(reply.pid < 0)
+      errno = reply.err;
+
+   return reply.pid;
+}
+
+/*
+ * Reads the replies which have arrived without blocking, keeping the
+ *    exits for zygote_reap. Used by the event loop when the socket is
+ *    readable.
+ * Returns 0 if the zygote has gone away
+ */
+int zygote_drain(void)
+{
+   struct zygote_reply reply;
+
+   while(zygote_fd != -1)
+   {
+      int len = recv(zygote_fd, &reply, sizeof(reply), MSG_DONTWAIT);
+      if(len == -1 && errno == EINTR)
+         continue;
+      if(len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return 1;
+
+      if(len != sizeof(reply))
+      {
+         close(zygote_fd);
+         zygote_fd = -1;
+         return 0;
+      }
+
+      if(reply.type == ZY_EXITED && zygote_num_pending < ZY_PENDING)
+         zygote_pending[zygote_num_pending++] = reply;
+   }
+
+   return 0;
+}
+
+/*
+ * Returns 1 if the exit of a child has already been received, so
+ *    zygote_reap will not block
+ */
+int zygote_exited(pid_t pid)
+{
+   int i;
+   for(i = 0; i < zygote_num_pending; i++)
+      if(zygote_pending[i].pid == pid)
+         return 1;
+
+   return zygote_fd == -1;
+}
+
+/*
+ * Waits for a child spawned by the zygote and fills in its wall
+ *    time and resource usage like stats_reap.
+ * Returns the exit status of the child or 1 if it was lost
+ */
+int zygote_reap(struct cmd_stats* st)
+{
+   //exits received before the zygote went away are still good
+   struct zygote_reply reply;
+   if(!zygote_take_pending(st->pid, &reply) &&
+      (zygote_fd == -1 || !zygote_receive(ZY_EXITED, st->pid, &reply)))
+   {
+      st->status = 1;
+      return 1;
+   }
+
+   st->usage = reply.usage;
+   st->wall = stats_clock() - st->start;
+   st->status = stats_exit_code(reply.status);
+
+   stats_record(st);
+
+   return st->status;
+}
+
+#endif //ZYGOTE_C